@@ -1,9 +1,6 @@
 
-CREATE TABLE IF NOT EXISTS asteroid
-(
-  entity INT PRIMARY KEY
-    REFERENCES entity (entity) ON DELETE CASCADE
-);
+-- asteroid has no columns, so it is declared in components.yml as a tag and
+-- stored as a bitset; has_tag(entity, 'asteroid') tests membership directly.
 
 CREATE TABLE IF NOT EXISTS explosion
 (
@@ -20,64 +17,55 @@ CREATE TABLE IF NOT EXISTS bullet
   damage INT
 );
 
-CREATE TABLE IF NOT EXISTS asteroid_hit
-(
-  entity INTEGER REFERENCES entity (entity),
-  bullet INTEGER REFERENCES entity (entity),
-  damage INT
-)
-
-CREATE TABLE IF NOT EXISTS var
-(
-  key PRIMARY KEY, value
-);
+-- asteroid_hit is an event channel declared in events.yml. Its events last
+-- for the tick they are emitted in, so it never needs to be emptied.
 
 -- System to start a new game
 BEGIN TRANSACTION;
-  INSERT OR REPLACE INTO var VALUES ( "score", 0 );
-  INSERT OR REPLACE INTO var VALUES ( "lives", 3 );
+  SELECT set_var('score', 0);
+  SELECT set_var('lives', 3);
 COMMIT TRANSACTION;
 
 -- System to add an asteroid to the game
 BEGIN TRANSACTION;
   INSERT OR ROLLBACK INTO entity (id) VALUES (NULL);
-  INSERT OR REPLACE INTO var VALUES ( "last_entity", last_insert_rowid() );
+  SELECT set_var('last_entity', last_insert_rowid());
   INSERT OR ROLLBACK INTO location (entity, x, y, theta) VALUES (
-    (SELECT value FROM var WHERE key = "last_entity"),
-    (abs(random()) % 200) - 100, (abs(random()) % 200) - 100, radians(random() % 360)
+    var('last_entity'),
+    rand_int(-100, 99), rand_int(-100, 99), radians(rand_int(0, 359))
   );
   INSERT OR ROLLBACK INTO mobile VALUES (
-    (SELECT value FROM var WHERE key = "last_entity"),
-    0, (random() % 10) * 0.1 + 0.5, 100, 0
+    var('last_entity'),
+    0, rand_int(0, 9) * 0.1 + 0.5, 100, 0
   );
   INSERT OR ROLLBACK INTO collision VALUES (
-    (SELECT value FROM var WHERE key = "last_entity"),
-    (random() % 5) * 0.5 + 3
+    var('last_entity'),
+    rand_int(0, 4) * 0.5 + 3
   );
   INSERT OR ROLLBACK INTO asteroid (entity) VALUES (
-    (SELECT value FROM var WHERE key = "last_entity")
+    var('last_entity')
   );
 COMMIT TRANSACTION;
 
 -- System to add a bullet to the game
 BEGIN TRANSACTION;
   INSERT OR ROLLBACK INTO entity (id) VALUES (NULL);
-  INSERT OR REPLACE INTO var VALUES ( "last_entity", last_insert_rowid() );
+  SELECT set_var('last_entity', last_insert_rowid());
   INSERT OR ROLLBACK INTO location (entity, x, y, theta) VALUES (
-    (SELECT value FROM var WHERE key = "last_entity")
+    var('last_entity')
   );
   UPDATE location SET
     (x, y, prev_x, prev_y, theta) = (
       SELECT x - sin(theta), y + cos(theta), x, y, theta FROM location
       WHERE entity = (SELECT entity FROM entity WHERE id = "player")
     )
-  WHERE entity = ((SELECT value FROM var WHERE key = "last_entity"));
+  WHERE entity = var('last_entity');
   INSERT OR ROLLBACK INTO mobile VALUES (
-    (SELECT value FROM var WHERE key = "last_entity"),
+    var('last_entity'),
     0, 5, 100, 0
   );
   INSERT OR ROLLBACK INTO bullet (entity) VALUES (
-    (SELECT value FROM var WHERE key = "last_entity"),
+    var('last_entity'),
     sim_time(), 0.5
   );
 COMMIT TRANSACTION;
@@ -88,9 +76,7 @@ DELETE FROM entity WHERE entity IN (
 );
 
 -- Stored views which make circle to circle collisions easier to deal with in SQL
-CREATE VIEW collision_location AS SELECT
-  location.entity AS entity, x, y, radius
-  FROM location INNER JOIN collision USING(entity);
+-- collision_location is materialized from views.yml
 
 CREATE VIEW player_location AS SELECT
   location.entity AS entity, x, y, radius
@@ -105,8 +91,8 @@ CREATE VIEW player_collision AS SELECT
 
 -- System to destroy player ships when they collide with something. Also loses 1 life
 BEGIN TRANSACTION;
-  UPDATE var SET value = value - 1
-    WHERE key = "lives" AND (SELECT count(collider) > 0 FROM player_collision);
+  SELECT set_var('lives', var('lives') - 1)
+    WHERE (SELECT count(collider) > 0 FROM player_collision);
   DELETE FROM entity WHERE entity IN (
     SELECT player FROM player_collision GROUP BY player
   );
@@ -129,21 +115,20 @@ CREATE VIEW bullet_collision AS SELECT
 BEGIN TRANSACTION;
   INSERT INTO asteroid_hit (entity, bullet, damage)
     SELECT collider, projectile, damage FROM bullet_collision
-    WHERE collider IN (SELECT entity FROM asteroid);
-  DELETE FROM bullet WHERE entity IN (SELECT bullet FROM asteroid_hit)
+    WHERE has_tag(collider, 'asteroid');
+  DELETE FROM bullet WHERE entity IN (SELECT bullet FROM asteroid_hit())
   UPDATE collision SET radius = radius - damage
-    FROM asteroid_hit
+    FROM asteroid_hit()
     WHERE collision.entity = asteroid_hit.entity;
-  DELETE FROM asteroid_hit;
 COMMIT TRANSACTION;
 
 -- System to convert asteroids with collision.radius < 0 into explosions
 -- This also gives 100 score for each asteroid destroyed
 BEGIN TRANSACTION;
-  UPDATE var SET value = value + 100 * (
+  SELECT set_var('score', var('score') + 100 * (
     SELECT count(entity) FROM collision INNER JOIN asteroid USING (entity)
     WHERE radius <= 0
-  ) WHERE key = "score";
+  ));
   INSERT INTO explosion
     SELECT asteroid.entity, sim_time() FROM collision INNER JOIN asteroid USING (entity)
     WHERE radius <= 0;
@@ -153,25 +138,25 @@ COMMIT TRANSACTION;
 
 -- System to convert the oldest explosion back into new a collision if it's old enough
 BEGIN TRANSACTION;
-  INSERT OR REPLACE INTO var VALUES ( "last_entity", (
+  SELECT set_var('last_entity', (
     SELECT entity FROM explosion WHERE age < (sim_time() - 10) ORDER BY age ASC LIMIT 1
   ));
   UPDATE location SET
-    x = abs(random()) % 200) - 100, y = (abs(random()) % 200) - 100, theta = radians(abs(random()) % 360)
+    x = rand_int(-100, 99), y = rand_int(-100, 99), theta = radians(rand_int(0, 359))
     WHERE
-      entity = (SELECT value FROM var WHERE key = "last_entity");
+      entity = var('last_entity');
   UPDATE mobile SET
-    accel = 0, vel = (random() % 10) * 0.1 + 0.5, max_vel = 100, rotation = 0
+    accel = 0, vel = rand_int(0, 9) * 0.1 + 0.5, max_vel = 100, rotation = 0
     WHERE
-      entity = (SELECT value FROM var WHERE key = "last_entity");
+      entity = var('last_entity');
   INSERT OR ROLLBACK INTO collision VALUES (
-    (SELECT value FROM var WHERE key = "last_entity"),
-    (random() % 5) * 0.5 + 3
+    var('last_entity'),
+    rand_int(0, 4) * 0.5 + 3
   );
   INSERT OR ROLLBACK INTO asteroid (entity) VALUES (
-    (SELECT value FROM var WHERE key = "last_entity")
+    var('last_entity')
   );
-  DELETE FROM explosion WHERE entity = (SELECT value FROM var WHERE key = "last_entity");
+  DELETE FROM explosion WHERE entity = var('last_entity');
 COMMIT TRANSACTION;
 
 -- Render Systems are just select statements used to let the engine know what needs to be rendered.
@@ -190,10 +175,10 @@ SELECT x, y, radius FROM location INNER JOIN explosion
 WHERE location.entity = explosion.entity AND explosion.age < (sim_time() - 2);
 
 -- Score and lives rendering
-SELECT key, value FROM var WHERE key = "score" OR key = "lives";
+SELECT var('score'), var('lives');
 
 -- Render system to tell the engine if there is an active game
-SELECT active = value > 0 FROM var WHERE key = "lives";
+SELECT var('lives') > 0 AS active;
 
 -- other things not yet in this description fo the game:
 --   player respawn mechanics
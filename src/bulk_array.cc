@@ -0,0 +1,277 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "bulk_array.h"
+
+// Exception includes
+#include "exceptions.h"
+
+#include <cmath>
+#include <string>
+
+// Unit Testing includes
+#include "doctest.h"
+
+// Logging system includes
+#include "loguru.hpp"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+SCENARIO("class bulkArray")
+{
+  GIVEN("a database with a location table and arrays of new values")
+  {
+    sqlite3 *db;
+    sqlite3_open(":memory:", &db);
+    nebula::bulkArray::registerModule(db);
+    sqlite3_exec(db,
+        "CREATE TABLE location (entity INTEGER PRIMARY KEY, x REAL, y REAL);"
+        "INSERT INTO location VALUES (1, 0, 0), (2, 0, 0), (3, 0, 0);",
+        nullptr,
+        nullptr,
+        nullptr);
+    std::vector<sqlite3_int64> entities = {3, 1};
+    std::vector<double> xs              = {30.0, 10.0};
+    std::vector<double> ys              = {NAN, 1.0};
+    nebula::bulkArray array(entities.data(), entities.size());
+    array.addColumn(xs.data());
+    array.addColumn(ys.data());
+    WHEN("they are applied with a single UPDATE FROM")
+    {
+      sqlite3_stmt *stmt;
+      REQUIRE(sqlite3_prepare_v2(db,
+                  "UPDATE location SET x = b.c0, y = b.c1 FROM bulk_array(?1) "
+                  "AS b WHERE location.entity = b.entity;",
+                  -1,
+                  &stmt,
+                  nullptr)
+              == SQLITE_OK);
+      array.bind(stmt, 1);
+      REQUIRE(sqlite3_step(stmt) == SQLITE_DONE);
+      sqlite3_finalize(stmt);
+      THEN("only the listed entities change and NaN is written as NULL")
+      {
+        sqlite3_prepare_v2(db,
+            "SELECT entity, x, y FROM location ORDER BY entity;",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_double(stmt, 1) == 10.0);
+        REQUIRE(sqlite3_column_double(stmt, 2) == 1.0);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_double(stmt, 1) == 0.0);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_double(stmt, 1) == 30.0);
+        REQUIRE(sqlite3_column_type(stmt, 2) == SQLITE_NULL);
+        sqlite3_finalize(stmt);
+      }
+    }
+    WHEN("the function is used without a bound array")
+    {
+      THEN("it yields no rows")
+      {
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db,
+            "SELECT count(*) FROM bulk_array(NULL);",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_int(stmt, 0) == 0);
+        sqlite3_finalize(stmt);
+      }
+    }
+    WHEN("too many columns are added")
+    {
+      THEN("an exception is thrown")
+      {
+        for (size_t i = array.columnCount(); i < nebula::bulkArray::maxColumns;
+             ++i)
+        {
+          array.addColumn(xs.data());
+        }
+        REQUIRE_THROWS(array.addColumn(xs.data()));
+      }
+    }
+    sqlite3_close(db);
+  }
+}
+#endif
+
+namespace nebula {
+
+namespace {
+
+const char *const pointerType = "nebula_bulk_array";
+
+struct arrayCursor {
+  sqlite3_vtab_cursor _base;
+  const bulkArray *_array;
+  size_t _row;
+};
+
+int arrayConnect(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err)
+{
+  std::string sql = "CREATE TABLE x(entity INTEGER";
+  for (size_t c = 0; c < bulkArray::maxColumns; ++c) {
+    sql += ", c" + std::to_string(c) + " REAL";
+  }
+  sql += ", source HIDDEN);";
+  int res = sqlite3_declare_vtab(db, sql.c_str());
+  if (res != SQLITE_OK) {
+    return res;
+  }
+  *vtab = new sqlite3_vtab();
+  return SQLITE_OK;
+}
+
+int arrayDisconnect(sqlite3_vtab *vtab)
+{
+  delete vtab;
+  return SQLITE_OK;
+}
+
+// The hidden source column must be given, as the argument of the function.
+int arrayBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+  const int source = bulkArray::maxColumns + 1;
+  for (int i = 0; i < info->nConstraint; ++i) {
+    const auto &c = info->aConstraint[i];
+    if (c.iColumn == source && c.op == SQLITE_INDEX_CONSTRAINT_EQ) {
+      if (!c.usable) {
+        return SQLITE_CONSTRAINT;
+      }
+      info->aConstraintUsage[i].argvIndex = 1;
+      info->aConstraintUsage[i].omit      = 1;
+      info->estimatedCost                 = 1000.0;
+      info->estimatedRows                 = 1000;
+      return SQLITE_OK;
+    }
+  }
+  return SQLITE_CONSTRAINT;
+}
+
+int arrayOpen(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+  auto cur    = new arrayCursor();
+  cur->_array = nullptr;
+  cur->_row   = 0;
+  *cursor     = &cur->_base;
+  return SQLITE_OK;
+}
+
+int arrayClose(sqlite3_vtab_cursor *cursor)
+{
+  delete reinterpret_cast<arrayCursor *>(cursor);
+  return SQLITE_OK;
+}
+
+int arrayFilter(sqlite3_vtab_cursor *cursor,
+    int plan,
+    const char *idxStr,
+    int argc,
+    sqlite3_value **argv)
+{
+  auto cur    = reinterpret_cast<arrayCursor *>(cursor);
+  cur->_array = static_cast<const bulkArray *>(
+      sqlite3_value_pointer(argv[0], pointerType));
+  cur->_row   = 0;
+  return SQLITE_OK;
+}
+
+int arrayNext(sqlite3_vtab_cursor *cursor)
+{
+  reinterpret_cast<arrayCursor *>(cursor)->_row++;
+  return SQLITE_OK;
+}
+
+int arrayEof(sqlite3_vtab_cursor *cursor)
+{
+  auto cur = reinterpret_cast<arrayCursor *>(cursor);
+  return !cur->_array || cur->_row >= cur->_array->size();
+}
+
+int arrayColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int col)
+{
+  auto cur = reinterpret_cast<arrayCursor *>(cursor);
+  if (col == 0) {
+    sqlite3_result_int64(ctx, cur->_array->entity(cur->_row));
+  } else if (static_cast<size_t>(col) <= cur->_array->columnCount()) {
+    double value = cur->_array->value(cur->_row, col - 1);
+    if (std::isnan(value)) {
+      sqlite3_result_null(ctx);
+    } else {
+      sqlite3_result_double(ctx, value);
+    }
+  } else {
+    sqlite3_result_null(ctx);
+  }
+  return SQLITE_OK;
+}
+
+int arrayRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+  *rowid = reinterpret_cast<arrayCursor *>(cursor)->_row;
+  return SQLITE_OK;
+}
+
+sqlite3_module arrayModule = {
+    0,               // iVersion
+    nullptr,         // xCreate
+    arrayConnect,    // xConnect
+    arrayBestIndex,  // xBestIndex
+    arrayDisconnect, // xDisconnect
+    nullptr,         // xDestroy
+    arrayOpen,       // xOpen
+    arrayClose,      // xClose
+    arrayFilter,     // xFilter
+    arrayNext,       // xNext
+    arrayEof,        // xEof
+    arrayColumn,     // xColumn
+    arrayRowid,      // xRowid
+    nullptr,         // xUpdate
+    nullptr,         // xBegin
+    nullptr,         // xSync
+    nullptr,         // xCommit
+    nullptr,         // xRollback
+    nullptr,         // xFindFunction
+    nullptr,         // xRename
+};
+
+} // namespace
+
+bulkArray::bulkArray(const sqlite3_int64 *entities, size_t count)
+    : _entities(entities), _count(count)
+{
+}
+
+void bulkArray::registerModule(sqlite3 *db)
+{
+  if (sqlite3_create_module_v2(db, "bulk_array", &arrayModule, nullptr, nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(db);
+  }
+}
+
+void bulkArray::addColumn(const double *values)
+{
+  if (_columns.size() == maxColumns) {
+    throw nebulaException("bulk_array supports at most "
+                          + std::to_string(maxColumns) + " value columns");
+  }
+  _columns.push_back(values);
+}
+
+void bulkArray::bind(sqlite3_stmt *stmt, int index) const
+{
+  sqlite3_bind_pointer(
+      stmt, index, const_cast<bulkArray *>(this), pointerType, nullptr);
+}
+
+} // namespace nebula
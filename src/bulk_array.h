@@ -0,0 +1,60 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_BULK_ARRAY_H
+#define NEBULA_BULK_ARRAY_H
+
+#include <cstddef>
+#include <vector>
+
+extern "C" {
+#include "sqlite3.h"
+}
+
+namespace nebula {
+
+// Contiguous C++ arrays of entities and values, exposed to SQL through the
+// bulk_array(?) table-valued function in the manner of SQLite's carray
+// extension. Rows read as (entity, c0, c1, ...); NaN values read as NULL.
+// The arrays are borrowed, and must outlive any statement stepping them.
+class bulkArray {
+public:
+  static constexpr size_t maxColumns = 16;
+
+private:
+  const sqlite3_int64 *_entities;
+  size_t _count;
+  std::vector<const double *> _columns;
+
+public:
+  bulkArray(const sqlite3_int64 *entities, size_t count);
+
+  static void registerModule(sqlite3 *db);
+
+  size_t size() const
+  {
+    return _count;
+  }
+
+  size_t columnCount() const
+  {
+    return _columns.size();
+  }
+
+  sqlite3_int64 entity(size_t row) const
+  {
+    return _entities[row];
+  }
+
+  double value(size_t row, size_t col) const
+  {
+    return _columns[col][row];
+  }
+
+  void addColumn(const double *values);
+  void bind(sqlite3_stmt *stmt, int index) const;
+};
+
+} // namespace nebula
+
+#endif // NEBULA_BULK_ARRAY_H
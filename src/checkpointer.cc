@@ -0,0 +1,149 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "checkpointer.h"
+
+// Exception includes
+#include "exceptions.h"
+
+// Unit Testing includes
+#include "doctest.h"
+
+// Logging system includes
+#include "loguru.hpp"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+#include <filesystem>
+
+static int _walHook(void *self, sqlite3 *db, const char *database, int frames)
+{
+  static_cast<nebula::checkpointer *>(self)->committed(frames);
+  return SQLITE_OK;
+}
+
+SCENARIO("class checkpointer")
+{
+  GIVEN("a database file in WAL mode and a checkpointer for it")
+  {
+    auto path = (std::filesystem::temp_directory_path()
+                 / "nebula-checkpointer.db")
+                    .string();
+    for (auto suffix : {"", "-wal", "-shm"}) {
+      std::filesystem::remove(path + suffix);
+    }
+    sqlite3 *db;
+    REQUIRE(sqlite3_open(path.c_str(), &db) == SQLITE_OK);
+    REQUIRE(sqlite3_exec(db,
+                "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL; "
+                "CREATE TABLE t (v);",
+                nullptr,
+                nullptr,
+                nullptr)
+            == SQLITE_OK);
+    {
+      nebula::checkpointer background(path, 4);
+      sqlite3_wal_hook(db, _walHook, &background);
+      WHEN("commits grow the log past the threshold")
+      {
+        for (int i = 0; i < 16; ++i) {
+          REQUIRE(sqlite3_exec(db,
+                      "INSERT INTO t VALUES (zeroblob(8192));",
+                      nullptr,
+                      nullptr,
+                      nullptr)
+                  == SQLITE_OK);
+        }
+        THEN("the background thread checkpoints it")
+        {
+          for (int i = 0; i < 500 && background.checkpoints() == 0; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          }
+          REQUIRE(background.checkpoints() > 0);
+        }
+      }
+      sqlite3_wal_hook(db, nullptr, nullptr);
+    }
+    sqlite3_close(db);
+    for (auto suffix : {"", "-wal", "-shm"}) {
+      std::filesystem::remove(path + suffix);
+    }
+  }
+}
+#endif
+
+namespace nebula {
+
+checkpointer::checkpointer(const std::string &path,
+    int frames,
+    std::chrono::milliseconds interval)
+    : _db(nullptr), _frames(frames), _interval(interval), _logged(0),
+      _stop(false), _checkpoints(0)
+{
+  int res = sqlite3_open_v2(
+      path.c_str(), &_db, SQLITE_OPEN_READWRITE, nullptr);
+  if (res != SQLITE_OK) {
+    sqlite3_close(_db);
+    throw sqliteException(res);
+  }
+  // Reading the schema once opens the log on this connection
+  if (sqlite3_exec(_db,
+          "SELECT count(*) FROM sqlite_master;",
+          nullptr,
+          nullptr,
+          nullptr)
+      != SQLITE_OK)
+  {
+    sqliteException error(_db);
+    sqlite3_close(_db);
+    throw error;
+  }
+  _thread = std::thread(&checkpointer::run, this);
+}
+
+checkpointer::~checkpointer()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _wake.notify_one();
+  _thread.join();
+  sqlite3_close(_db);
+}
+
+void checkpointer::committed(int frames)
+{
+  bool full;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _logged = frames;
+    full    = frames >= _frames;
+  }
+  if (full) {
+    _wake.notify_one();
+  }
+}
+
+void checkpointer::run()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (!_stop) {
+    _wake.wait_for(
+        lock, _interval, [this] { return _stop || _logged >= _frames; });
+    if (_stop || _logged == 0) {
+      continue;
+    }
+    _logged = 0;
+    lock.unlock();
+    int res = sqlite3_wal_checkpoint_v2(
+        _db, nullptr, SQLITE_CHECKPOINT_PASSIVE, nullptr, nullptr);
+    if (res == SQLITE_OK) {
+      ++_checkpoints;
+    } else {
+      LOG_S(WARNING) << "Checkpoint failed: " << sqlite3_errmsg(_db);
+    }
+    lock.lock();
+  }
+}
+
+} // namespace nebula
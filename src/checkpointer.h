@@ -0,0 +1,61 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_CHECKPOINTER_H
+#define NEBULA_CHECKPOINTER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include "sqlite3.h"
+}
+
+namespace nebula {
+
+// Copies the write-ahead log of a database file back into the file on a
+// thread of its own, through a connection of its own. With the log synced
+// only here, a commit on the writing connection appends to the log and
+// returns without waiting on the disk. Checkpoints are passive: they copy
+// what no reader still needs and never block the writer.
+class checkpointer {
+  sqlite3 *_db;
+  int _frames;
+  std::chrono::milliseconds _interval;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  // Frames in the log as of the last commit, 0 once checkpointed
+  int _logged;
+  bool _stop;
+  std::atomic<uint64_t> _checkpoints;
+  std::thread _thread;
+
+  void run();
+
+public:
+  // Checkpoints once the log holds frames pages, or every interval while
+  // it holds any.
+  checkpointer(const std::string &path,
+      int frames,
+      std::chrono::milliseconds interval = std::chrono::seconds(1));
+  checkpointer(const checkpointer &other) = delete;
+  ~checkpointer();
+
+  // For the writing connection's sqlite3_wal_hook(), after every commit.
+  void committed(int frames);
+
+  // Checkpoints that ran to completion, whether or not they emptied the log
+  uint64_t checkpoints() const
+  {
+    return _checkpoints;
+  }
+};
+
+} // namespace nebula
+
+#endif // NEBULA_CHECKPOINTER_H
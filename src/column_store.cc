@@ -0,0 +1,964 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "column_store.h"
+
+// Exception includes
+#include "exceptions.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <limits>
+
+// Unit Testing includes
+#include "doctest.h"
+
+// Logging system includes
+#include "loguru.hpp"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+SCENARIO("class columnStore")
+{
+  GIVEN("a database with a column_store virtual table")
+  {
+    sqlite3 *db;
+    sqlite3_open(":memory:", &db);
+    std::map<std::string, std::unique_ptr<nebula::columnStore>> stores;
+    nebula::columnStore::registerModule(db, stores);
+    REQUIRE(sqlite3_exec(db,
+                "CREATE VIRTUAL TABLE location USING column_store(x F32, y "
+                "F32, theta REAL);",
+                nullptr,
+                nullptr,
+                nullptr)
+            == SQLITE_OK);
+    REQUIRE(stores.count("location") == 1);
+    auto &store = *stores["location"];
+    WHEN("rows are inserted out of order through SQL")
+    {
+      REQUIRE(sqlite3_exec(db,
+                  "INSERT INTO location VALUES (3, 3.5, 0.1, 0.1);"
+                  "INSERT INTO location VALUES (1, 1.5, 0.1, 0.1);"
+                  "INSERT INTO location (entity, x) VALUES (2, 2.5);",
+                  nullptr,
+                  nullptr,
+                  nullptr)
+              == SQLITE_OK);
+      THEN("they are kept sorted by entity in packed float columns")
+      {
+        REQUIRE(store.size() == 3);
+        REQUIRE(store.entities()[0] == 1);
+        REQUIRE(store.entities()[2] == 3);
+        REQUIRE(store.f32("x")[1] == 2.5f);
+        REQUIRE(store.f32("theta") == nullptr);
+      }
+      THEN("SQL reads widen the floats and honor NULL")
+      {
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db,
+            "SELECT y, theta FROM location WHERE entity = 2;",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_type(stmt, 0) == SQLITE_NULL);
+        sqlite3_finalize(stmt);
+        sqlite3_prepare_v2(db,
+            "SELECT y FROM location WHERE entity = 1;",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_double(stmt, 0) == static_cast<double>(0.1f));
+        sqlite3_finalize(stmt);
+      }
+      THEN("duplicate entities are rejected")
+      {
+        REQUIRE(sqlite3_exec(db,
+                    "INSERT INTO location VALUES (3, 0, 0, 0);",
+                    nullptr,
+                    nullptr,
+                    nullptr)
+                != SQLITE_OK);
+      }
+      AND_WHEN("the store is tracked while rows are updated")
+      {
+        store.track();
+        REQUIRE(sqlite3_exec(db,
+                    "UPDATE location SET x = 0 WHERE entity >= 2;"
+                    "DELETE FROM location WHERE entity = 1;",
+                    nullptr,
+                    nullptr,
+                    nullptr)
+                == SQLITE_OK);
+        THEN("each touched entity is reported once")
+        {
+          REQUIRE(store.takeDirty()
+                  == std::vector<sqlite3_int64> {1, 2, 3});
+          REQUIRE(store.takeDirty().empty());
+        }
+      }
+      AND_WHEN("rows are updated and deleted")
+      {
+        REQUIRE(sqlite3_exec(db,
+                    "UPDATE location SET x = x + 1 WHERE entity > 1;"
+                    "DELETE FROM location WHERE entity = 1;",
+                    nullptr,
+                    nullptr,
+                    nullptr)
+                == SQLITE_OK);
+        THEN("the packed columns reflect the changes")
+        {
+          REQUIRE(store.size() == 2);
+          REQUIRE(store.entities()[0] == 2);
+          REQUIRE(store.f32("x")[0] == 3.5f);
+          REQUIRE(store.f32("x")[1] == 4.5f);
+        }
+      }
+      AND_WHEN("a transaction writing the rows is rolled back")
+      {
+        REQUIRE(sqlite3_exec(db,
+                    "BEGIN; UPDATE location SET x = 9 WHERE entity = 1;"
+                    "DELETE FROM location WHERE entity = 2;"
+                    "INSERT INTO location VALUES (4, 4.5, 0, 0);"
+                    "SAVEPOINT inner; DELETE FROM location;"
+                    "ROLLBACK TO inner; RELEASE inner;",
+                    nullptr,
+                    nullptr,
+                    nullptr)
+                == SQLITE_OK);
+        REQUIRE(store.size() == 3);
+        REQUIRE(store.f32("x")[0] == 9.0f);
+        REQUIRE(sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr)
+                == SQLITE_OK);
+        THEN("the packed columns are as they were before it")
+        {
+          REQUIRE(store.entities() == std::vector<sqlite3_int64> {1, 2, 3});
+          REQUIRE(store.f32("x")[0] == 1.5f);
+          REQUIRE(store.f32("x")[1] == 2.5f);
+          sqlite3_stmt *stmt;
+          sqlite3_prepare_v2(db,
+              "SELECT y FROM location WHERE entity = 2;",
+              -1,
+              &stmt,
+              nullptr);
+          REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+          REQUIRE(sqlite3_column_type(stmt, 0) == SQLITE_NULL);
+          sqlite3_finalize(stmt);
+        }
+      }
+      AND_WHEN("a statement fails part way through")
+      {
+        REQUIRE(sqlite3_exec(db,
+                    "INSERT INTO location SELECT entity + 3, x, y, theta "
+                    "FROM location UNION ALL SELECT 1, 0, 0, 0;",
+                    nullptr,
+                    nullptr,
+                    nullptr)
+                != SQLITE_OK);
+        THEN("the rows it had written are undone")
+        {
+          REQUIRE(store.size() == 3);
+        }
+      }
+      AND_WHEN("the rows are copied into another store")
+      {
+        nebula::columnStore copy({{"x", nebula::columnStore::type::f32},
+            {"y", nebula::columnStore::type::f32},
+            {"theta", nebula::columnStore::type::real}});
+        copy.copyFrom(store);
+        THEN("it holds the same entities and values")
+        {
+          REQUIRE(copy.entities() == store.entities());
+          REQUIRE(copy.f32("x")[2] == store.f32("x")[2]);
+          REQUIRE(copy.f32("y")[0] == store.f32("y")[0]);
+        }
+      }
+    }
+    sqlite3_close(db);
+  }
+}
+#endif
+
+namespace nebula {
+
+namespace {
+
+struct storeTable {
+  sqlite3_vtab _base;
+  sqlite3 *_db;
+  columnStore *_store;
+  std::map<std::string, std::unique_ptr<columnStore>> *_stores;
+  std::string _name;
+  std::vector<size_t> _savepoints;
+};
+
+struct storeCursor {
+  sqlite3_vtab_cursor _base;
+  size_t _row;
+  size_t _end;
+};
+
+enum storePlan {
+  planEqual        = 1,
+  planGreater      = 2,
+  planGreaterEqual = 4,
+  planLess         = 8,
+  planLessEqual    = 16
+};
+
+std::string declaration(const columnStore &store)
+{
+  std::string sql = "CREATE TABLE x(entity INTEGER";
+  for (const auto &col : store.columns()) {
+    sql += ", " + col._name;
+    switch (col._type) {
+    case columnStore::type::f32:
+    case columnStore::type::real:
+      sql += " REAL";
+      break;
+    case columnStore::type::integer:
+      sql += " INTEGER";
+      break;
+    case columnStore::type::text:
+      sql += " TEXT";
+      break;
+    }
+  }
+  return sql + ");";
+}
+
+int storeConnect(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err,
+    bool create)
+{
+  auto stores = static_cast<
+      std::map<std::string, std::unique_ptr<columnStore>> *>(aux);
+  std::string name = argv[2];
+  try {
+    if (create) {
+      std::vector<std::pair<std::string, columnStore::type>> columns;
+      for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto split      = arg.find_first_of(" \t");
+        if (split == std::string::npos) {
+          throw nebulaException("Column without a type: " + arg);
+        }
+        auto start = arg.find_first_not_of(" \t", split);
+        columns.emplace_back(arg.substr(0, split),
+            columnStore::parseType(arg.substr(start)));
+      }
+      (*stores)[name] = std::make_unique<columnStore>(columns);
+    } else if (stores->count(name) == 0) {
+      *err = sqlite3_mprintf("no column store named %s", name.c_str());
+      return SQLITE_ERROR;
+    }
+    auto table     = new storeTable();
+    table->_db     = db;
+    table->_store  = (*stores)[name].get();
+    table->_stores = stores;
+    table->_name   = name;
+    int res = sqlite3_declare_vtab(db, declaration(*table->_store).c_str());
+    if (res != SQLITE_OK) {
+      delete table;
+      return res;
+    }
+    sqlite3_vtab_config(db, SQLITE_VTAB_CONSTRAINT_SUPPORT, 1);
+    *vtab = &table->_base;
+  } catch (std::exception &e) {
+    *err = sqlite3_mprintf("%s", e.what());
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+int storeCreate(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err)
+{
+  return storeConnect(db, aux, argc, argv, vtab, err, true);
+}
+
+int storeReconnect(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err)
+{
+  return storeConnect(db, aux, argc, argv, vtab, err, false);
+}
+
+int storeDisconnect(sqlite3_vtab *vtab)
+{
+  delete reinterpret_cast<storeTable *>(vtab);
+  return SQLITE_OK;
+}
+
+int storeDestroy(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<storeTable *>(vtab);
+  table->_stores->erase(table->_name);
+  delete table;
+  return SQLITE_OK;
+}
+
+// Constraints on the entity column are answered by binary search over the
+// sorted entity array. They are not omitted, so the bounds computed in
+// storeFilter only need to be a superset of the matching rows.
+int storeBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+  auto table = reinterpret_cast<storeTable *>(vtab);
+  int plan   = 0;
+  int eq     = -1;
+  int lower  = -1;
+  int upper  = -1;
+  for (int i = 0; i < info->nConstraint; ++i) {
+    const auto &c = info->aConstraint[i];
+    if (!c.usable || (c.iColumn != 0 && c.iColumn != -1)) {
+      continue;
+    }
+    switch (c.op) {
+    case SQLITE_INDEX_CONSTRAINT_EQ:
+      eq = i;
+      break;
+    case SQLITE_INDEX_CONSTRAINT_GT:
+    case SQLITE_INDEX_CONSTRAINT_GE:
+      lower = i;
+      break;
+    case SQLITE_INDEX_CONSTRAINT_LT:
+    case SQLITE_INDEX_CONSTRAINT_LE:
+      upper = i;
+      break;
+    }
+  }
+  double rows = table->_store->size() + 1;
+  int arg     = 1;
+  if (eq >= 0) {
+    plan |= planEqual;
+    info->aConstraintUsage[eq].argvIndex = arg++;
+    info->idxFlags |= SQLITE_INDEX_SCAN_UNIQUE;
+    rows = 1;
+  } else {
+    if (lower >= 0) {
+      plan |= info->aConstraint[lower].op == SQLITE_INDEX_CONSTRAINT_GT
+                ? planGreater
+                : planGreaterEqual;
+      info->aConstraintUsage[lower].argvIndex = arg++;
+      rows /= 4;
+    }
+    if (upper >= 0) {
+      plan |= info->aConstraint[upper].op == SQLITE_INDEX_CONSTRAINT_LT
+                ? planLess
+                : planLessEqual;
+      info->aConstraintUsage[upper].argvIndex = arg++;
+      rows /= 4;
+    }
+  }
+  if (info->nOrderBy == 1
+      && (info->aOrderBy[0].iColumn == 0 || info->aOrderBy[0].iColumn == -1)
+      && !info->aOrderBy[0].desc)
+  {
+    info->orderByConsumed = 1;
+  }
+  info->idxNum        = plan;
+  info->estimatedRows = static_cast<sqlite3_int64>(rows) + 1;
+  info->estimatedCost = (eq >= 0 ? 1.0 : rows) + 1.0;
+  return SQLITE_OK;
+}
+
+int storeOpen(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+  auto cur = new storeCursor();
+  *cursor  = &cur->_base;
+  return SQLITE_OK;
+}
+
+int storeClose(sqlite3_vtab_cursor *cursor)
+{
+  delete reinterpret_cast<storeCursor *>(cursor);
+  return SQLITE_OK;
+}
+
+bool lowerBoundOf(sqlite3_value *value, bool exclusive, sqlite3_int64 &bound)
+{
+  switch (sqlite3_value_numeric_type(value)) {
+  case SQLITE_INTEGER:
+    bound = sqlite3_value_int64(value);
+    if (exclusive && bound < std::numeric_limits<sqlite3_int64>::max()) {
+      ++bound;
+    }
+    return true;
+  case SQLITE_FLOAT: {
+    double v = std::floor(sqlite3_value_double(value));
+    bound    = v < -9.2e18 ? std::numeric_limits<sqlite3_int64>::min()
+             : v > 9.2e18  ? std::numeric_limits<sqlite3_int64>::max()
+                           : static_cast<sqlite3_int64>(v);
+    return true;
+  }
+  case SQLITE_NULL:
+    return false;
+  default:
+    bound = std::numeric_limits<sqlite3_int64>::min();
+    return true;
+  }
+}
+
+bool upperBoundOf(sqlite3_value *value, bool exclusive, sqlite3_int64 &bound)
+{
+  switch (sqlite3_value_numeric_type(value)) {
+  case SQLITE_INTEGER:
+    bound = sqlite3_value_int64(value);
+    if (exclusive && bound > std::numeric_limits<sqlite3_int64>::min()) {
+      --bound;
+    }
+    return true;
+  case SQLITE_FLOAT: {
+    double v = std::ceil(sqlite3_value_double(value));
+    bound    = v < -9.2e18 ? std::numeric_limits<sqlite3_int64>::min()
+             : v > 9.2e18  ? std::numeric_limits<sqlite3_int64>::max()
+                           : static_cast<sqlite3_int64>(v);
+    return true;
+  }
+  case SQLITE_NULL:
+    return false;
+  default:
+    bound = std::numeric_limits<sqlite3_int64>::max();
+    return true;
+  }
+}
+
+int storeFilter(sqlite3_vtab_cursor *cursor,
+    int plan,
+    const char *idxStr,
+    int argc,
+    sqlite3_value **argv)
+{
+  auto cur   = reinterpret_cast<storeCursor *>(cursor);
+  auto store = reinterpret_cast<storeTable *>(cursor->pVtab)->_store;
+  sqlite3_int64 lo = std::numeric_limits<sqlite3_int64>::min();
+  sqlite3_int64 hi = std::numeric_limits<sqlite3_int64>::max();
+  bool valid       = true;
+  int arg          = 0;
+  if (plan & planEqual) {
+    valid = lowerBoundOf(argv[arg], false, lo)
+         && upperBoundOf(argv[arg], false, hi);
+    ++arg;
+  }
+  if (plan & (planGreater | planGreaterEqual)) {
+    valid = valid && lowerBoundOf(argv[arg++], plan & planGreater, lo);
+  }
+  if (plan & (planLess | planLessEqual)) {
+    valid = valid && upperBoundOf(argv[arg++], plan & planLess, hi);
+  }
+  cur->_row = store->lowerBound(lo);
+  cur->_end = cur->_row;
+  if (valid && lo <= hi) {
+    cur->_end = hi == std::numeric_limits<sqlite3_int64>::max()
+                  ? store->size()
+                  : store->lowerBound(hi + 1);
+  }
+  return SQLITE_OK;
+}
+
+int storeNext(sqlite3_vtab_cursor *cursor)
+{
+  reinterpret_cast<storeCursor *>(cursor)->_row++;
+  return SQLITE_OK;
+}
+
+int storeEof(sqlite3_vtab_cursor *cursor)
+{
+  auto cur = reinterpret_cast<storeCursor *>(cursor);
+  return cur->_row >= cur->_end;
+}
+
+int storeColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int col)
+{
+  auto cur   = reinterpret_cast<storeCursor *>(cursor);
+  auto store = reinterpret_cast<storeTable *>(cursor->pVtab)->_store;
+  if (col == 0) {
+    sqlite3_result_int64(ctx, store->entities()[cur->_row]);
+  } else {
+    store->result(cur->_row, col - 1, ctx);
+  }
+  return SQLITE_OK;
+}
+
+int storeRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+  auto cur   = reinterpret_cast<storeCursor *>(cursor);
+  auto store = reinterpret_cast<storeTable *>(cursor->pVtab)->_store;
+  *rowid     = store->entities()[cur->_row];
+  return SQLITE_OK;
+}
+
+int storeUpdate(
+    sqlite3_vtab *vtab, int argc, sqlite3_value **argv, sqlite3_int64 *rowid)
+{
+  auto table = reinterpret_cast<storeTable *>(vtab);
+  auto store = table->_store;
+  if (argc == 1) {
+    auto row = store->find(sqlite3_value_int64(argv[0]));
+    if (row != columnStore::npos) {
+      store->remove(row);
+    }
+    return SQLITE_OK;
+  }
+  sqlite3_int64 entity;
+  if (sqlite3_value_type(argv[2]) != SQLITE_NULL) {
+    entity = sqlite3_value_int64(argv[2]);
+  } else if (sqlite3_value_type(argv[1]) != SQLITE_NULL) {
+    entity = sqlite3_value_int64(argv[1]);
+  } else {
+    entity = store->size() > 0 ? store->entities().back() + 1 : 1;
+  }
+  bool isUpdate = sqlite3_value_type(argv[0]) != SQLITE_NULL;
+  if (isUpdate && sqlite3_value_int64(argv[0]) != entity) {
+    auto old = store->find(sqlite3_value_int64(argv[0]));
+    if (old != columnStore::npos) {
+      store->remove(old);
+    }
+    isUpdate = false;
+  }
+  size_t row = store->find(entity);
+  if (!isUpdate && row != columnStore::npos
+      && sqlite3_vtab_on_conflict(table->_db) != SQLITE_REPLACE)
+  {
+    sqlite3_free(vtab->zErrMsg);
+    vtab->zErrMsg = sqlite3_mprintf(
+        "UNIQUE constraint failed: %s.entity", table->_name.c_str());
+    return SQLITE_CONSTRAINT;
+  }
+  try {
+    if (row == columnStore::npos) {
+      row = store->insert(entity);
+    }
+    for (size_t c = 0; c < store->columns().size(); ++c) {
+      store->set(row, c, argv[3 + c]);
+    }
+  } catch (std::bad_alloc &e) {
+    return SQLITE_NOMEM;
+  }
+  *rowid = entity;
+  return SQLITE_OK;
+}
+
+// The store logs its changes from xBegin to xCommit or xRollback. As with
+// event channels, SQLite reports the innermost savepoint open when the
+// transaction first writes, and outer ones share its position in the log.
+int storeBegin(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<storeTable *>(vtab);
+  table->_store->begin();
+  table->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int storeCommit(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<storeTable *>(vtab);
+  table->_store->commit();
+  table->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int storeRollback(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<storeTable *>(vtab);
+  table->_store->rollback();
+  table->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int storeSavepoint(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<storeTable *>(vtab);
+  auto here  = table->_store->savepoint();
+  table->_savepoints.resize(savepoint + 1, here);
+  table->_savepoints[savepoint] = here;
+  return SQLITE_OK;
+}
+
+int storeRelease(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<storeTable *>(vtab);
+  if (static_cast<size_t>(savepoint) < table->_savepoints.size()) {
+    table->_savepoints.resize(savepoint);
+  }
+  return SQLITE_OK;
+}
+
+int storeRollbackTo(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<storeTable *>(vtab);
+  if (static_cast<size_t>(savepoint) < table->_savepoints.size()) {
+    table->_store->rollbackTo(table->_savepoints[savepoint]);
+    table->_savepoints.resize(savepoint + 1);
+  }
+  return SQLITE_OK;
+}
+
+sqlite3_module storeModule = {
+    2,               // iVersion
+    storeCreate,     // xCreate
+    storeReconnect,  // xConnect
+    storeBestIndex,  // xBestIndex
+    storeDisconnect, // xDisconnect
+    storeDestroy,    // xDestroy
+    storeOpen,       // xOpen
+    storeClose,      // xClose
+    storeFilter,     // xFilter
+    storeNext,       // xNext
+    storeEof,        // xEof
+    storeColumn,     // xColumn
+    storeRowid,      // xRowid
+    storeUpdate,     // xUpdate
+    storeBegin,      // xBegin
+    nullptr,         // xSync
+    storeCommit,     // xCommit
+    storeRollback,   // xRollback
+    nullptr,         // xFindFunction
+    nullptr,         // xRename
+    storeSavepoint,  // xSavepoint
+    storeRelease,    // xRelease
+    storeRollbackTo, // xRollbackTo
+};
+
+} // namespace
+
+columnStore::columnStore(
+    const std::vector<std::pair<std::string, type>> &columns)
+    : _version(0), _tracked(false), _logging(false)
+{
+  for (const auto &[name, dtype] : columns) {
+    column col;
+    col._name = name;
+    col._type = dtype;
+    _columns.emplace_back(std::move(col));
+  }
+}
+
+void columnStore::registerModule(
+    sqlite3 *db, std::map<std::string, std::unique_ptr<columnStore>> &stores)
+{
+  if (sqlite3_create_module_v2(
+          db, "column_store", &storeModule, &stores, nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(db);
+  }
+}
+
+columnStore::type columnStore::parseType(const std::string &dtype)
+{
+  std::string upper;
+  for (auto c : dtype) {
+    upper += std::toupper(c);
+  }
+  if (upper == "F32") {
+    return type::f32;
+  }
+  if (upper == "REAL") {
+    return type::real;
+  }
+  if (upper == "INTEGER") {
+    return type::integer;
+  }
+  if (upper == "TEXT") {
+    return type::text;
+  }
+  throw nebulaException("Unsupported column store type: " + dtype);
+}
+
+std::vector<sqlite3_int64> columnStore::takeDirty()
+{
+  std::vector<sqlite3_int64> dirty;
+  dirty.swap(_dirty);
+  std::sort(dirty.begin(), dirty.end());
+  dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+  return dirty;
+}
+
+const float *columnStore::f32(const std::string &name) const
+{
+  for (const auto &col : _columns) {
+    if (col._name == name && col._type == type::f32) {
+      return col._f32.data();
+    }
+  }
+  return nullptr;
+}
+
+size_t columnStore::lowerBound(sqlite3_int64 entity) const
+{
+  return std::lower_bound(_entities.begin(), _entities.end(), entity)
+       - _entities.begin();
+}
+
+size_t columnStore::find(sqlite3_int64 entity) const
+{
+  size_t row = lowerBound(entity);
+  if (row < _entities.size() && _entities[row] == entity) {
+    return row;
+  }
+  return npos;
+}
+
+// Entities are normally created in increasing order, so inserts are almost
+// always appends to the end of each column.
+size_t columnStore::insert(sqlite3_int64 entity)
+{
+  size_t row = lowerBound(entity);
+  ++_version;
+  if (_tracked) {
+    _dirty.push_back(entity);
+  }
+  if (_logging) {
+    _undo.push_back({change::kind::inserted, 0, npos, entity, 0, 0.0, {}});
+  }
+  _entities.insert(_entities.begin() + row, entity);
+  for (auto &col : _columns) {
+    switch (col._type) {
+    case type::f32:
+      col._f32.insert(col._f32.begin() + row, 0.0f);
+      break;
+    case type::real:
+      col._real.insert(col._real.begin() + row, 0.0);
+      break;
+    case type::integer:
+      col._integer.insert(col._integer.begin() + row, 0);
+      break;
+    case type::text:
+      col._text.insert(col._text.begin() + row, std::string());
+      break;
+    }
+    col._null.insert(col._null.begin() + row, 1);
+  }
+  return row;
+}
+
+void columnStore::remove(size_t row)
+{
+  ++_version;
+  if (_tracked) {
+    _dirty.push_back(_entities[row]);
+  }
+  if (_logging) {
+    for (size_t c = 0; c < _columns.size(); ++c) {
+      logCell(change::kind::written, row, c);
+    }
+    _undo.push_back(
+        {change::kind::removed, 0, npos, _entities[row], 0, 0.0, {}});
+  }
+  _entities.erase(_entities.begin() + row);
+  for (auto &col : _columns) {
+    switch (col._type) {
+    case type::f32:
+      col._f32.erase(col._f32.begin() + row);
+      break;
+    case type::real:
+      col._real.erase(col._real.begin() + row);
+      break;
+    case type::integer:
+      col._integer.erase(col._integer.begin() + row);
+      break;
+    case type::text:
+      col._text.erase(col._text.begin() + row);
+      break;
+    }
+    col._null.erase(col._null.begin() + row);
+  }
+}
+
+// Whole vectors are assigned, reusing this store's capacity, which is far
+// cheaper than replaying the rows through SQL.
+void columnStore::copyFrom(const columnStore &other)
+{
+  ++_version;
+  if (_tracked) {
+    _dirty.insert(_dirty.end(), _entities.begin(), _entities.end());
+    _dirty.insert(
+        _dirty.end(), other._entities.begin(), other._entities.end());
+  }
+  if (_logging) {
+    _replaced.emplace_back(_entities, _columns);
+    _undo.push_back({change::kind::replaced, 0, npos, 0, 0, 0.0, {}});
+  }
+  _entities = other._entities;
+  for (size_t c = 0; c < _columns.size(); ++c) {
+    auto &col    = _columns[c];
+    auto &from   = other._columns[c];
+    col._f32     = from._f32;
+    col._real    = from._real;
+    col._integer = from._integer;
+    col._text    = from._text;
+    col._null    = from._null;
+  }
+}
+
+void columnStore::set(size_t row, size_t c, sqlite3_value *value)
+{
+  if (_logging) {
+    logCell(change::kind::written, row, c);
+  }
+  auto &col      = _columns[c];
+  col._null[row] = sqlite3_value_type(value) == SQLITE_NULL;
+  ++_version;
+  if (_tracked && (_dirty.empty() || _dirty.back() != _entities[row])) {
+    _dirty.push_back(_entities[row]);
+  }
+  switch (col._type) {
+  case type::f32:
+    col._f32[row] = col._null[row]
+                      ? std::numeric_limits<float>::quiet_NaN()
+                      : static_cast<float>(sqlite3_value_double(value));
+    break;
+  case type::real:
+    col._real[row] = sqlite3_value_double(value);
+    break;
+  case type::integer:
+    col._integer[row] = sqlite3_value_int64(value);
+    break;
+  case type::text: {
+    auto text      = sqlite3_value_text(value);
+    col._text[row] = text ? reinterpret_cast<const char *>(text) : "";
+    break;
+  }
+  }
+}
+
+void columnStore::result(size_t row, size_t c, sqlite3_context *ctx) const
+{
+  const auto &col = _columns[c];
+  if (col._null[row]) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+  switch (col._type) {
+  case type::f32:
+    sqlite3_result_double(ctx, col._f32[row]);
+    break;
+  case type::real:
+    sqlite3_result_double(ctx, col._real[row]);
+    break;
+  case type::integer:
+    sqlite3_result_int64(ctx, col._integer[row]);
+    break;
+  case type::text:
+    sqlite3_result_text(
+        ctx, col._text[row].c_str(), col._text[row].size(), SQLITE_TRANSIENT);
+    break;
+  }
+}
+
+void columnStore::logCell(change::kind kind, size_t row, size_t c)
+{
+  const auto &col = _columns[c];
+  change logged   = {kind, col._null[row], c, _entities[row], 0, 0.0, {}};
+  switch (col._type) {
+  case type::f32:
+    logged._real = col._f32[row];
+    break;
+  case type::real:
+    logged._real = col._real[row];
+    break;
+  case type::integer:
+    logged._integer = col._integer[row];
+    break;
+  case type::text:
+    logged._text = col._text[row];
+    break;
+  }
+  _undo.emplace_back(std::move(logged));
+}
+
+// A removed row is logged as its cells followed by the removal, so undoing
+// in reverse inserts it again before restoring them.
+void columnStore::undo(const change &c)
+{
+  if (c._kind == change::kind::replaced) {
+    ++_version;
+    if (_tracked) {
+      _dirty.insert(_dirty.end(), _entities.begin(), _entities.end());
+    }
+    _entities = std::move(_replaced.back().first);
+    _columns  = std::move(_replaced.back().second);
+    _replaced.pop_back();
+    if (_tracked) {
+      _dirty.insert(_dirty.end(), _entities.begin(), _entities.end());
+    }
+    return;
+  }
+  if (c._kind == change::kind::removed) {
+    insert(c._entity);
+    return;
+  }
+  size_t row = find(c._entity);
+  if (row == npos) {
+    return;
+  }
+  if (c._kind == change::kind::inserted) {
+    remove(row);
+    return;
+  }
+  ++_version;
+  if (_tracked) {
+    _dirty.push_back(c._entity);
+  }
+  auto &col      = _columns[c._column];
+  col._null[row] = c._null;
+  switch (col._type) {
+  case type::f32:
+    col._f32[row] = static_cast<float>(c._real);
+    break;
+  case type::real:
+    col._real[row] = c._real;
+    break;
+  case type::integer:
+    col._integer[row] = c._integer;
+    break;
+  case type::text:
+    col._text[row] = c._text;
+    break;
+  }
+}
+
+void columnStore::begin()
+{
+  _logging = true;
+}
+
+void columnStore::rollbackTo(size_t savepoint)
+{
+  bool logging = _logging;
+  _logging     = false;
+  while (_undo.size() > savepoint) {
+    undo(_undo.back());
+    _undo.pop_back();
+  }
+  _logging = logging;
+}
+
+void columnStore::commit()
+{
+  _logging = false;
+  _undo.clear();
+  _replaced.clear();
+}
+
+void columnStore::rollback()
+{
+  rollbackTo(0);
+  commit();
+}
+
+} // namespace nebula
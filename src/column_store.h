@@ -0,0 +1,140 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_COLUMN_STORE_H
+#define NEBULA_COLUMN_STORE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "sqlite3.h"
+}
+
+namespace nebula {
+
+// Native columnar storage for a component, kept sorted by entity and exposed
+// to SQL through the column_store virtual table module. Columns of type f32
+// are stored as packed 32-bit floats and widened to REAL when read by SQL.
+class columnStore {
+public:
+  enum class type : uint8_t {
+    f32,
+    real,
+    integer,
+    text
+  };
+
+  struct column {
+    std::string _name;
+    type _type;
+    std::vector<float> _f32;
+    std::vector<double> _real;
+    std::vector<sqlite3_int64> _integer;
+    std::vector<std::string> _text;
+    std::vector<uint8_t> _null;
+  };
+
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+private:
+  // One logged change: the entity was inserted, its row removed after its
+  // cells were logged, one cell written, or every row replaced by
+  // copyFrom() after the rows were kept in _replaced. Cells of type f32
+  // keep their value in _real.
+  struct change {
+    enum class kind : uint8_t {
+      inserted,
+      removed,
+      written,
+      replaced
+    };
+
+    kind _kind;
+    uint8_t _null;
+    size_t _column;
+    sqlite3_int64 _entity;
+    sqlite3_int64 _integer;
+    double _real;
+    std::string _text;
+  };
+
+  std::vector<sqlite3_int64> _entities;
+  std::vector<column> _columns;
+  uint64_t _version;
+  bool _tracked;
+  std::vector<sqlite3_int64> _dirty;
+  bool _logging;
+  std::vector<change> _undo;
+  std::vector<std::pair<std::vector<sqlite3_int64>, std::vector<column>>>
+      _replaced;
+
+  void logCell(change::kind kind, size_t row, size_t col);
+  void undo(const change &c);
+
+public:
+  columnStore(const std::vector<std::pair<std::string, type>> &columns);
+
+  static void registerModule(sqlite3 *db,
+      std::map<std::string, std::unique_ptr<columnStore>> &stores);
+  static type parseType(const std::string &dtype);
+
+  size_t size() const
+  {
+    return _entities.size();
+  }
+
+  const std::vector<sqlite3_int64> &entities() const
+  {
+    return _entities;
+  }
+
+  const std::vector<column> &columns() const
+  {
+    return _columns;
+  }
+
+  // Incremented on every write, for consumers caching derived data.
+  uint64_t version() const
+  {
+    return _version;
+  }
+
+  // While tracked, every written or removed entity is recorded until the
+  // owner collects it with takeDirty().
+  void track()
+  {
+    _tracked = true;
+  }
+
+  std::vector<sqlite3_int64> takeDirty();
+  const float *f32(const std::string &name) const;
+  size_t find(sqlite3_int64 entity) const;
+  size_t lowerBound(sqlite3_int64 entity) const;
+  size_t insert(sqlite3_int64 entity);
+  void remove(size_t row);
+  void set(size_t row, size_t col, sqlite3_value *value);
+  // Replaces every row with those of a store of the same schema.
+  void copyFrom(const columnStore &other);
+  void result(size_t row, size_t col, sqlite3_context *ctx) const;
+
+  // Changes are logged from begin() until commit() or rollback(), so that
+  // a transaction rolled back by SQLite restores the rows it wrote. A
+  // savepoint() is a position in the log for rollbackTo().
+  void begin();
+  size_t savepoint() const
+  {
+    return _undo.size();
+  }
+  void rollbackTo(size_t savepoint);
+  void commit();
+  void rollback();
+};
+
+} // namespace nebula
+
+#endif // NEBULA_COLUMN_STORE_H
@@ -6,6 +6,14 @@
 // Exception includes
 #include "exceptions.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string_view>
+#include <type_traits>
+
 // Unit Testing includes
 #include "doctest.h"
 
@@ -13,28 +21,871 @@
 #include "loguru.hpp"
 
 #ifndef DOCTEST_CONFIG_DISABLE
+#include <filesystem>
+
+namespace nebula::components {
+
+// As produced by module::componentHeader() for test/ecs-module
+struct location {
+  float x;
+  float y;
+  double theta;
+};
+
+struct mobile {
+  double accel;
+  double vel;
+  double max_vel;
+  double rotation;
+};
+
+} // namespace nebula::components
+
+namespace nebula {
+
+template <>
+struct componentTraits<components::location> {
+  static constexpr const char *name = "location";
+  static constexpr auto fields
+      = std::make_tuple(makeField("x", &components::location::x),
+          makeField("y", &components::location::y),
+          makeField("theta", &components::location::theta));
+};
+
+template <>
+struct componentTraits<components::mobile> {
+  static constexpr const char *name = "mobile";
+  static constexpr auto fields
+      = std::make_tuple(makeField("accel", &components::mobile::accel),
+          makeField("vel", &components::mobile::vel),
+          makeField("max_vel", &components::mobile::max_vel),
+          makeField("rotation", &components::mobile::rotation));
+};
+
+} // namespace nebula
+
+static double _queryReal(sqlite3 *db, const std::string &sql)
+{
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+  sqlite3_step(stmt);
+  double res = sqlite3_column_double(stmt, 0);
+  sqlite3_finalize(stmt);
+  return res;
+}
+
 SCENARIO("class ecs")
 {
   GIVEN("an ecs object")
   {
     REQUIRE_NOTHROW(nebula::ecs state);
   }
+  GIVEN("an ecs object with a module loaded")
+  {
+    nebula::ecs state;
+    auto mod = nebula::module("test/ecs-module", true);
+    mod.loadModule();
+    state.loadModule(mod);
+    state.execute("INSERT INTO entity (entity) VALUES (1), (2);"
+                  "INSERT INTO location VALUES (1, 0.0, 0.0, 0.0), "
+                  "(2, 99.0, 0.0, -1.5707963267948966);"
+                  "INSERT INTO mobile VALUES (1, 1.0, 0.0, 5.0, 0.0), "
+                  "(2, 4.0, 0.0, 5.0, 0.0);");
+    WHEN("a tick is run")
+    {
+      state.tick(0.5);
+      THEN("native and SQL systems have updated the components in order")
+      {
+        REQUIRE(_queryReal(state, "SELECT vel FROM mobile WHERE entity = 1")
+                == 1.0);
+        REQUIRE(_queryReal(state, "SELECT vel FROM mobile WHERE entity = 2")
+                == 4.0);
+        REQUIRE(_queryReal(state, "SELECT y FROM location WHERE entity = 1")
+                == 0.5);
+        REQUIRE(std::abs(
+                    _queryReal(state, "SELECT x FROM location WHERE entity = 2")
+                    + 99.0)
+                < 1e-9);
+        REQUIRE(_queryReal(state, "SELECT sim_time()") == 0.5);
+      }
+      THEN("f32 components expose their packed columns")
+      {
+        REQUIRE(state.getColumnStore("mobile") == nullptr);
+        auto location = state.getColumnStore("location");
+        REQUIRE(location != nullptr);
+        REQUIRE(location->size() == 2);
+        REQUIRE(location->f32("y")[0] == 0.5f);
+        REQUIRE(location->f32("x")[1] == -99.0f);
+      }
+    }
+    WHEN("double-buffered components are written by several systems")
+    {
+      state.execute("INSERT INTO signal VALUES (1, 1.0, 2.0);"
+                    "INSERT INTO flare VALUES (1, 3.0, 4.0);");
+      state.tick(0.5);
+      THEN("every system reads the values from before the tick")
+      {
+        REQUIRE(_queryReal(state, "SELECT a FROM signal") == 2.0);
+        REQUIRE(_queryReal(state, "SELECT b FROM signal") == 1.0);
+        REQUIRE(_queryReal(state, "SELECT a FROM flare") == 4.0);
+        REQUIRE(_queryReal(state, "SELECT b FROM flare") == 3.0);
+      }
+      AND_WHEN("another tick is run")
+      {
+        state.tick(0.5);
+        THEN("the previous copy has moved on to the last tick's values")
+        {
+          REQUIRE(_queryReal(state, "SELECT a FROM signal") == 1.0);
+          REQUIRE(_queryReal(state, "SELECT b FROM flare") == 4.0);
+        }
+      }
+      AND_WHEN("a buffered row is deleted before the next tick")
+      {
+        state.execute("DELETE FROM signal WHERE entity = 1;");
+        state.tick(0.5);
+        THEN("its previous copy goes too")
+        {
+          REQUIRE(_queryReal(state, "SELECT count(*) FROM signal_prev") == 0.0);
+        }
+      }
+      AND_WHEN("the next tick fails")
+      {
+        state.execute("CREATE TRIGGER fail_tick AFTER UPDATE ON signal BEGIN "
+                      "SELECT RAISE(ABORT, 'failed'); END;");
+        REQUIRE_THROWS(state.tick(0.5));
+        THEN("the packed previous copy is restored")
+        {
+          REQUIRE(state.getColumnStore("flare_prev")->f32("a")[0] == 3.0f);
+          REQUIRE(_queryReal(state, "SELECT a FROM signal_prev") == 1.0);
+        }
+      }
+    }
+    WHEN("entities are tagged")
+    {
+      state.execute("INSERT INTO entity (entity) VALUES (3);"
+                    "INSERT INTO asteroid VALUES (1), (3);");
+      THEN("has_tag() and the counts see the bitset")
+      {
+        REQUIRE(state.count("asteroid") == 2);
+        REQUIRE(_queryReal(state, "SELECT has_tag(3, 'asteroid')") == 1.0);
+        REQUIRE(_queryReal(state, "SELECT has_tag(2, 'asteroid')") == 0.0);
+        REQUIRE(_queryReal(state,
+                    "SELECT count(*) FROM location WHERE has_tag(entity, "
+                    "'asteroid')")
+                == 1.0);
+        REQUIRE_THROWS(state.execute("SELECT has_tag(1, 'mobile');"));
+      }
+      AND_WHEN("a tagged entity is deleted")
+      {
+        state.execute("DELETE FROM entity WHERE entity = 3;");
+        THEN("its tag is cleared")
+        {
+          REQUIRE(state.count("asteroid") == 1);
+          REQUIRE_FALSE(state.getTagSet("asteroid")->has(3));
+          REQUIRE(state.getTagSet("asteroid")->has(1));
+        }
+      }
+    }
+    WHEN("a sparse component is written by a system")
+    {
+      state.execute("INSERT INTO shield VALUES (2, 1.0);");
+      state.tick(0.5);
+      THEN("the sparse set holds the updated row")
+      {
+        REQUIRE(state.count("shield") == 1);
+        REQUIRE(state.getSparseSet("shield")->find(2) == 0);
+        REQUIRE(_queryReal(state, "SELECT strength FROM shield") == 1.5);
+      }
+      AND_WHEN("its entity is deleted")
+      {
+        state.execute("DELETE FROM entity WHERE entity = 2;");
+        THEN("the row is removed as well")
+        {
+          REQUIRE(state.count("shield") == 0);
+        }
+      }
+    }
+    WHEN("a system program from a .sql include runs for several ticks")
+    {
+      state.execute("INSERT INTO shield VALUES (2, 1.0);");
+      state.tick(0.5);
+      state.tick(0.5);
+      THEN("its blocks ran once per tick after the systems before it")
+      {
+        REQUIRE(_queryReal(state, "SELECT count(*) FROM shield_log") == 2.0);
+        REQUIRE(_queryReal(state,
+                    "SELECT total FROM shield_log ORDER BY tick DESC LIMIT 1")
+                == 2.0);
+      }
+    }
+    WHEN("events are appended to a channel before a tick")
+    {
+      state.execute("INSERT INTO shield VALUES (2, 1.0);"
+                    "INSERT INTO hit VALUES (2, 0.25), (2, 0.5), (1, 4.0);");
+      auto hit = state.getEventChannel("hit");
+      REQUIRE(hit->size() == 3);
+      REQUIRE(hit->real("damage")[1] == 0.5);
+      state.tick(0.5);
+      THEN("systems read them during the tick and they are cleared after")
+      {
+        REQUIRE(_queryReal(state, "SELECT strength FROM shield") == 0.75);
+        REQUIRE(hit->size() == 0);
+        REQUIRE(_queryReal(state, "SELECT count(*) FROM hit") == 0.0);
+      }
+    }
+    WHEN("an entity is attached to a moving one")
+    {
+      state.execute("INSERT INTO entity (entity) VALUES (3), (4);"
+                    "INSERT INTO location VALUES (3, 0.0, 0.0, 0.0), "
+                    "(4, 0.0, 0.0, 0.0);"
+                    "INSERT INTO hierarchy VALUES (3, 1, 0.0, 2.0, 0.25), "
+                    "(4, 3, 1.0, 0.0, 0.0);"
+                    "INSERT INTO brain VALUES (4, 0.0);");
+      state.tick(0.5);
+      THEN("it follows its parent at the end of the tick")
+      {
+        REQUIRE(_queryReal(state, "SELECT y FROM location WHERE entity = 3")
+                == 2.5);
+        REQUIRE(_queryReal(state, "SELECT theta FROM location WHERE "
+                                  "entity = 4")
+                == 0.25);
+      }
+      AND_WHEN("its parent is deleted")
+      {
+        state.execute("DELETE FROM entity WHERE entity = 1;");
+        THEN("the whole subtree goes with it")
+        {
+          REQUIRE(_queryReal(state, "SELECT count(*) FROM entity") == 1.0);
+          REQUIRE(state.count("hierarchy") == 0);
+          REQUIRE(_queryReal(state, "SELECT count(*) FROM brain") == 0.0);
+        }
+      }
+    }
+    WHEN("an entity with a timed component is created")
+    {
+      state.execute("INSERT INTO entity (entity) VALUES (3);"
+                    "INSERT INTO fuse VALUES (3, 0.0);"
+                    "SELECT schedule_timer('fuse_spark', 3);");
+      state.tick(0.5);
+      THEN("timers due by now have fired and later ones wait")
+      {
+        REQUIRE(_queryReal(state, "SELECT sparks FROM fuse") == 1.0);
+        REQUIRE(_queryReal(state, "SELECT count(*) FROM entity") == 3.0);
+      }
+      AND_WHEN("its timer falls due")
+      {
+        state.tick(0.5);
+        THEN("the entity expires")
+        {
+          REQUIRE(_queryReal(state, "SELECT count(*) FROM entity") == 2.0);
+          REQUIRE(_queryReal(state, "SELECT count(*) FROM fuse") == 0.0);
+        }
+      }
+      AND_WHEN("the component is removed first")
+      {
+        state.execute("DELETE FROM fuse WHERE entity = 3;");
+        state.tick(0.5);
+        state.tick(0.5);
+        THEN("the timer is disarmed")
+        {
+          REQUIRE(_queryReal(state, "SELECT count(*) FROM entity") == 3.0);
+        }
+      }
+    }
+    WHEN("a statement fails after its triggers armed a timer")
+    {
+      state.execute("INSERT INTO entity (entity) VALUES (4);");
+      REQUIRE_THROWS(state.execute(
+          "INSERT INTO fuse SELECT 4, 0.0 UNION ALL SELECT 4, 0.0;"));
+      state.tick(0.5);
+      state.tick(0.5);
+      state.tick(0.5);
+      THEN("the timer is not left armed")
+      {
+        REQUIRE(
+            _queryReal(state, "SELECT count(*) FROM entity WHERE entity = 4")
+            == 1.0);
+      }
+    }
+    WHEN("entities are spawned from a pool until it runs dry")
+    {
+      std::vector<sqlite3_int64> spawned;
+      for (int i = 0; i < 4; ++i) {
+        spawned.emplace_back(static_cast<sqlite3_int64>(
+            _queryReal(state, "SELECT spawn('spark');")));
+      }
+      THEN("the pool's entities were created once, with their components")
+      {
+        REQUIRE(spawned == std::vector<sqlite3_int64> {3, 4, 5, 6});
+        REQUIRE(state.count("spark") == 4);
+        REQUIRE(_queryReal(state, "SELECT total(life) FROM particle") == 4.0);
+        REQUIRE(state.spawn("spark") == -1);
+      }
+      AND_WHEN("one is released")
+      {
+        state.execute("DELETE FROM spark WHERE entity = 4;");
+        THEN("the next spawn reuses it without creating rows")
+        {
+          REQUIRE(state.spawn("spark") == 4);
+          REQUIRE(_queryReal(state, "SELECT count(*) FROM entity") == 6.0);
+          REQUIRE(_queryReal(state, "SELECT count(*) FROM particle") == 4.0);
+        }
+      }
+      AND_WHEN("one is released after its components changed")
+      {
+        state.execute("UPDATE particle SET life = 0.25 WHERE entity = 4;");
+        state.despawn("spark", 4);
+        THEN("spawning it again resets the components to the pool's values")
+        {
+          REQUIRE(state.spawn("spark") == 4);
+          REQUIRE(
+              _queryReal(state, "SELECT life FROM particle WHERE entity = 4")
+              == 1.0);
+        }
+      }
+    }
+    WHEN("a statement spawning from a pool fails")
+    {
+      REQUIRE_THROWS(
+          state.execute("INSERT INTO brain VALUES "
+                        "(spawn('spark'), 0.0), (1, 0.0), (1, 0.0);"));
+      THEN("the pool is as if it had never been spawned from")
+      {
+        REQUIRE(state.count("particle") == 0);
+        REQUIRE(state.spawn("spark") == 3);
+        REQUIRE(state.count("particle") == 4);
+      }
+    }
+    WHEN("a sliced system runs with a tick budget")
+    {
+      state.execute("INSERT INTO entity (entity) VALUES (3), (4), (5);"
+                    "INSERT INTO brain VALUES (1, 0.0), (2, 0.0), (3, 0.0), "
+                    "(4, 0.0), (5, 0.0);");
+      state.setBudget(1e-9);
+      state.tick(0.5);
+      THEN("one slice runs per tick once the budget is spent")
+      {
+        REQUIRE(_queryReal(state, "SELECT sum(thought) FROM brain") == 2.0);
+        state.tick(0.5);
+        state.tick(0.5);
+        REQUIRE(_queryReal(state, "SELECT min(thought) FROM brain") == 1.0);
+        state.tick(0.5);
+        REQUIRE(_queryReal(state, "SELECT thought FROM brain WHERE entity = 1")
+                == 2.0);
+        REQUIRE(_queryReal(state, "SELECT thought FROM brain WHERE entity = 3")
+                == 1.0);
+      }
+      AND_WHEN("the budget is removed")
+      {
+        state.setBudget(0.0);
+        state.tick(0.5);
+        THEN("the rest of the pass completes within the tick")
+        {
+          REQUIRE(_queryReal(state, "SELECT sum(thought) FROM brain") == 5.0);
+        }
+      }
+    }
+    WHEN("systems running every other tick share a component")
+    {
+      state.execute("INSERT INTO timer VALUES (1, 0.0, 0.0, 0.0, 0.0);");
+      for (int i = 0; i < 4; ++i) {
+        state.tick(0.5);
+      }
+      THEN("they alternate and see the time since their last run")
+      {
+        REQUIRE(_queryReal(state, "SELECT fired FROM timer") == 2.0);
+        REQUIRE(_queryReal(state, "SELECT fired_b FROM timer") == 2.0);
+        REQUIRE(_queryReal(state, "SELECT waited FROM timer") == 1.5);
+      }
+    }
+    WHEN("a triggered system skips ticks before its trigger fires")
+    {
+      state.execute("INSERT INTO beacon VALUES (1, 0.0);");
+      for (int i = 0; i < 3; ++i) {
+        state.tick(0.5);
+      }
+      state.execute("INSERT INTO beacon VALUES (2, 0.0);");
+      state.tick(0.5);
+      THEN("deltaT() covers only the time since its last scheduled slot")
+      {
+        REQUIRE(_queryReal(state, "SELECT sum(charge) FROM beacon") == 1.0);
+      }
+    }
+    WHEN("an entity stays idle for longer than sleep_after")
+    {
+      state.execute("INSERT INTO entity (entity) VALUES (3);"
+                    "INSERT INTO mobile VALUES (3, 0.0, 0.0, 5.0, 0.0);"
+                    "INSERT INTO timer (entity, nudged) VALUES (1, 0), "
+                    "(3, 0);");
+      for (int i = 0; i < 3; ++i) {
+        state.tick(0.5);
+      }
+      THEN("it leaves the active set and active systems skip it")
+      {
+        REQUIRE(_queryReal(state, "SELECT count(*) FROM active") == 2.0);
+        REQUIRE(_queryReal(state, "SELECT nudged FROM timer WHERE entity = 1")
+                == 3.0);
+        REQUIRE(_queryReal(state, "SELECT nudged FROM timer WHERE entity = 3")
+                == 2.0);
+      }
+      AND_WHEN("one of its watched components is written")
+      {
+        state.execute("UPDATE mobile SET accel = 1.0 WHERE entity = 3;");
+        THEN("it is active again")
+        {
+          REQUIRE(
+              _queryReal(state, "SELECT count(*) FROM active WHERE entity = 3")
+              == 1.0);
+        }
+      }
+      AND_WHEN("a watched component is rewritten with the same values")
+      {
+        state.execute("UPDATE mobile SET accel = 0.0 WHERE entity = 3;");
+        THEN("it stays asleep")
+        {
+          REQUIRE(
+              _queryReal(state, "SELECT count(*) FROM active WHERE entity = 3")
+              == 0.0);
+        }
+      }
+    }
+    WHEN("a component grows enough to change the best join order")
+    {
+      state.tick(0.5);
+      state.execute("WITH RECURSIVE n(i) AS (SELECT 10 UNION ALL SELECT i + 1 "
+                    "FROM n WHERE i < 99) INSERT INTO entity (entity) SELECT "
+                    "i FROM n;"
+                    "INSERT INTO mobile SELECT entity, 0.0, 0.0, 1.0, 0.0 "
+                    "FROM entity WHERE entity >= 10;");
+      state.tick(0.5);
+      THEN("the planner is given the new row counts")
+      {
+        REQUIRE(_queryReal(state,
+                    "SELECT stat FROM sqlite_stat1 WHERE tbl = 'mobile'")
+                == 92.0);
+        REQUIRE(_queryReal(state,
+                    "SELECT stat FROM sqlite_stat1 WHERE tbl = 'signal'")
+                == 1.0);
+      }
+    }
+    WHEN("a module param is changed")
+    {
+      REQUIRE(state.param("field_width") == 200.0);
+      state.setParam("field_width", 100.0);
+      state.tick(0.5);
+      THEN("systems use the new value")
+      {
+        REQUIRE(std::abs(
+                    _queryReal(state, "SELECT x FROM location WHERE entity = 2")
+                    - 1.0)
+                < 1e-9);
+        REQUIRE_THROWS(state.setParam("field_height", 1.0));
+      }
+    }
+    WHEN("math functions are called from SQL outside of a system")
+    {
+      THEN("they are available and use the precise libm results")
+      {
+        REQUIRE(_queryReal(state, "SELECT sin(0.5)") == std::sin(0.5));
+        REQUIRE(_queryReal(state, "SELECT cos(0.5)") == std::cos(0.5));
+        REQUIRE(_queryReal(state, "SELECT sqrt(2.25)") == 1.5);
+        REQUIRE(_queryReal(state, "SELECT sqrt(-1) IS NULL") == 1.0);
+      }
+    }
+    WHEN("component rows are inserted, replaced, updated and deleted")
+    {
+      REQUIRE(state.count("mobile") == 2);
+      state.execute("INSERT INTO entity (entity) VALUES (3);"
+                    "INSERT INTO mobile VALUES (3, 0.0, 2.0, 5.0, 0.0);"
+                    "INSERT OR REPLACE INTO mobile VALUES (3, 0.0, 3.0, 5.0, "
+                    "0.0);"
+                    "UPDATE mobile SET vel = vel + 1.0 WHERE entity = 1;"
+                    "DELETE FROM mobile WHERE entity = 2;");
+      THEN("counts and sums are maintained without scanning")
+      {
+        REQUIRE(state.count("mobile") == 2);
+        REQUIRE(state.count("location") == 2);
+        REQUIRE(state.aggregate("mobile_count") == 2.0);
+        REQUIRE(state.aggregate("total_vel") == 4.0);
+        REQUIRE(_queryReal(state, "SELECT component_count('mobile')") == 2.0);
+        REQUIRE(_queryReal(state, "SELECT aggregate('total_vel')") == 4.0);
+      }
+      THEN("a failed statement leaves them matching the table")
+      {
+        REQUIRE_THROWS(state.execute("INSERT INTO mobile VALUES (4, 0.0, "
+                                     "9.0, 5.0, 0.0), (1, 0.0, 9.0, 5.0, "
+                                     "0.0);"));
+        REQUIRE(state.count("mobile") == 2);
+        REQUIRE(state.aggregate("total_vel") == 4.0);
+      }
+    }
+    WHEN("global variables are read and written")
+    {
+      state.execute("SELECT set_var('lives', var('lives') - 1);"
+                    "SELECT set_var('last_entity', max(entity)) FROM entity;");
+      state.setVar("player", std::string("ship"));
+      THEN("SQL and C++ see the same typed values")
+      {
+        REQUIRE(std::get<sqlite3_int64>(state.var("lives")) == 2);
+        REQUIRE(std::get<double>(state.var("speed")) == 1.5);
+        REQUIRE(std::get<sqlite3_int64>(state.var("last_entity")) == 2);
+        REQUIRE(_queryReal(state,
+                    "SELECT count(*) FROM entity WHERE entity = "
+                    "var('last_entity') AND var('player') = 'ship'")
+                == 1.0);
+        REQUIRE(std::holds_alternative<std::monostate>(state.var("missing")));
+        REQUIRE(_queryReal(state, "SELECT var('missing') IS NULL") == 1.0);
+      }
+      AND_WHEN("a statement setting one fails")
+      {
+        REQUIRE_THROWS(state.execute("INSERT INTO brain VALUES "
+                                     "(1, set_var('lives', 0)), (1, 0.0);"));
+        THEN("the variable keeps the value it had before the statement")
+        {
+          REQUIRE(std::get<sqlite3_int64>(state.var("lives")) == 2);
+        }
+      }
+    }
+    WHEN("random numbers are drawn after seeding the world")
+    {
+      state.seed(1234);
+      double first  = _queryReal(state, "SELECT rand_int(1, 1000000)");
+      double second = _queryReal(state, "SELECT rand_uniform(-1.0, 1.0)");
+      THEN("reseeding replays the same values")
+      {
+        REQUIRE(second >= -1.0);
+        REQUIRE(second < 1.0);
+        state.seed(1234);
+        REQUIRE(_queryReal(state, "SELECT rand_int(1, 1000000)") == first);
+        REQUIRE(_queryReal(state, "SELECT rand_uniform(-1.0, 1.0)") == second);
+        auto expected = nebula::rng::stream(1234, "");
+        expected.next();
+        expected.next();
+        REQUIRE(state.random().next() == expected.next());
+      }
+    }
+    WHEN("components are read through a typed query")
+    {
+      using namespace nebula::components;
+      std::vector<sqlite3_int64> entities;
+      double accel = 0.0;
+      for (auto &[entity, loc, mob] : state.query<location, mobile>()) {
+        entities.push_back(entity);
+        accel += mob.accel;
+        if (entity == 2) {
+          REQUIRE(loc.x == 99.0f);
+        }
+      }
+      THEN("each entity is returned once with all of its components")
+      {
+        REQUIRE(entities == std::vector<sqlite3_int64> {1, 2});
+        REQUIRE(accel == 5.0);
+      }
+      THEN("the cached statement can be iterated again")
+      {
+        size_t rows = 0;
+        for (auto &row : state.query<location, mobile>()) {
+          rows += std::get<2>(row).max_vel == 5.0;
+        }
+        REQUIRE(rows == 2);
+      }
+    }
+    WHEN("components are written in bulk from arrays")
+    {
+      std::vector<sqlite3_int64> entities = {3, 4};
+      std::vector<double> xs              = {7.0, 8.0};
+      std::vector<double> vels            = {2.5, 3.5};
+      state.execute("INSERT INTO entity (entity) VALUES (3), (4);");
+      state.bulkInsert("location", entities.data(), 2, {{"x", xs.data()}});
+      state.bulkInsert("mobile", entities.data(), 2, {{"vel", vels.data()}});
+      state.bulkUpdate("location", entities.data(), 1, {{"y", vels.data()}});
+      state.bulkUpdate("mobile", entities.data() + 1, 1, {{"vel", xs.data()}});
+      THEN("packed and plain components hold the new rows")
+      {
+        REQUIRE(state.getColumnStore("location")->size() == 4);
+        REQUIRE(_queryReal(state, "SELECT x FROM location WHERE entity = 4")
+                == 8.0);
+        REQUIRE(_queryReal(state, "SELECT y FROM location WHERE entity = 3")
+                == 2.5);
+        REQUIRE(_queryReal(state, "SELECT vel FROM mobile WHERE entity = 3")
+                == 2.5);
+        REQUIRE(_queryReal(state, "SELECT vel FROM mobile WHERE entity = 4")
+                == 7.0);
+      }
+      THEN("materialized views see the bulk writes")
+      {
+        REQUIRE(_queryReal(state,
+                    "SELECT y FROM moving_location WHERE entity = 3")
+                == 2.5);
+      }
+    }
+    WHEN("a render is requested repeatedly")
+    {
+      auto &first = state.getRender("moving");
+      REQUIRE(first._stride == 3);
+      REQUIRE(first._values.size() == 6);
+      auto version = first._version;
+      THEN("it is reused while its inputs are unchanged")
+      {
+        REQUIRE(state.getRender("moving")._version == version);
+        state.execute("UPDATE entity SET id = 'ship' WHERE entity = 1;");
+        REQUIRE(state.getRender("moving")._version == version);
+      }
+      THEN("it is refreshed after one of its inputs changes")
+      {
+        state.execute("UPDATE mobile SET vel = 3.0 WHERE entity = 1;");
+        auto &data = state.getRender("moving");
+        REQUIRE(data._version == version + 1);
+        REQUIRE(data._values[2] == 3.0f);
+        state.tick(0.5);
+        REQUIRE(state.getRender("moving")._version == version + 2);
+      }
+      THEN("a delete without a WHERE clause is still seen")
+      {
+        state.execute("DELETE FROM mobile;");
+        REQUIRE(state.getRender("moving")._values.empty());
+      }
+      THEN("DROP statements still drop what they name")
+      {
+        state.execute("CREATE TABLE scratch (value);"
+                      "CREATE TRIGGER scratch_insert AFTER INSERT ON mobile "
+                      "BEGIN INSERT INTO scratch VALUES (1); END;"
+                      "DROP TRIGGER scratch_insert;"
+                      "DROP TABLE scratch;");
+        REQUIRE(_queryReal(state,
+                    "SELECT count(*) FROM sqlite_master "
+                    "WHERE name IN ('scratch', 'scratch_insert')")
+                == 0.0);
+      }
+    }
+    WHEN("an entity is deleted")
+    {
+      state.execute("DELETE FROM entity WHERE entity = 1;");
+      THEN("systems triggered by the lower count run on the next tick")
+      {
+        REQUIRE(state.count("location") == 1);
+        state.tick(0.5);
+        REQUIRE(_queryReal(state, "SELECT accel FROM mobile WHERE entity = 2")
+                == 5.0);
+      }
+      THEN("its packed component row is removed as well")
+      {
+        REQUIRE(state.getColumnStore("location")->size() == 1);
+        REQUIRE(_queryReal(state, "SELECT count(*) FROM moving_location")
+                == 1.0);
+      }
+    }
+    WHEN("components feeding a materialized view change")
+    {
+      REQUIRE(_queryReal(state, "SELECT count(*) FROM moving_location")
+              == 2.0);
+      state.execute("UPDATE mobile SET vel = 2.0 WHERE entity = 2;");
+      state.tick(0.5);
+      THEN("the view matches a fresh evaluation of its join")
+      {
+        REQUIRE(_queryReal(state,
+                    "SELECT count(*) FROM moving_location AS v JOIN location "
+                    "USING (entity) JOIN mobile USING (entity) WHERE v.x = "
+                    "location.x AND v.y = location.y AND v.vel = mobile.vel")
+                == 2.0);
+        REQUIRE(_queryReal(state,
+                    "SELECT vel FROM moving_location WHERE entity = 2")
+                == 5.0);
+      }
+    }
+    WHEN("a tick fails and is rolled back")
+    {
+      state.tick(0.5);
+      state.execute("CREATE TRIGGER fail_tick AFTER UPDATE ON brain BEGIN "
+                    "SELECT rand_int(1, 1000000);"
+                    "SELECT RAISE(ABORT, 'failed'); END;"
+                    "INSERT INTO entity (entity) VALUES (3);"
+                    "INSERT INTO brain VALUES (3, 0.0);");
+      REQUIRE_THROWS(state.tick(0.5));
+      THEN("the simulation time has not moved on")
+      {
+        REQUIRE(_queryReal(state, "SELECT sim_time()") == 0.5);
+      }
+      THEN("numbers drawn during it are drawn again")
+      {
+        state.execute("DROP TRIGGER fail_tick;"
+                      "CREATE TABLE draws (value INTEGER);"
+                      "CREATE TRIGGER draw AFTER UPDATE ON brain BEGIN "
+                      "INSERT INTO draws VALUES (rand_int(1, 1000000)); END;");
+        state.tick(0.5);
+        auto expected = nebula::rng::stream(0, "think");
+        REQUIRE(_queryReal(state,
+                    "SELECT value FROM draws ORDER BY rowid LIMIT 1")
+                == expected.integer(1, 1000000));
+      }
+    }
+  }
+  GIVEN("a world kept in a database file")
+  {
+    auto dir  = std::filesystem::temp_directory_path();
+    auto path = (dir / "nebula-world.db").string();
+    for (auto suffix : {"", "-wal", "-shm"}) {
+      std::filesystem::remove(path + suffix);
+    }
+    {
+      nebula::ecs state(path);
+      auto mod = nebula::module("test/world-module", true);
+      mod.loadModule();
+      state.loadModule(mod);
+      state.execute("INSERT INTO entity (entity) VALUES (1), (2);"
+                    "INSERT INTO location VALUES (1, 0.0, 0.0);"
+                    "INSERT INTO mobile VALUES (1, 2.0);"
+                    "INSERT INTO fuse VALUES (2, 0.0);");
+      state.tick(0.5);
+      // Saved when the world is destroyed rather than with a tick
+      state.setVar("lives", sqlite3_int64(2));
+      REQUIRE(_queryReal(state,
+                  "SELECT journal_mode = 'wal' FROM pragma_journal_mode")
+              == 1.0);
+    }
+    WHEN("it is opened again and the module loaded into it")
+    {
+      nebula::ecs state(path);
+      auto mod = nebula::module("test/world-module", true);
+      mod.loadModule();
+      state.loadModule(mod);
+      THEN("its components are read back from the file")
+      {
+        REQUIRE(_queryReal(state, "SELECT count(*) FROM entity") == 2.0);
+        REQUIRE(_queryReal(state, "SELECT x FROM location WHERE entity = 1")
+                == 1.0);
+        REQUIRE(_queryReal(state, "SELECT count(*) FROM tick_log") == 1.0);
+      }
+      THEN("its clock and variables carry on from where they were")
+      {
+        REQUIRE(_queryReal(state, "SELECT sim_time()") == 0.5);
+        REQUIRE(std::get<sqlite3_int64>(state.var("lives")) == 2);
+      }
+      THEN("its timers fall due when they were armed to")
+      {
+        state.tick(0.25);
+        REQUIRE(_queryReal(state, "SELECT count(*) FROM entity") == 2.0);
+        state.tick(0.25);
+        REQUIRE(_queryReal(state, "SELECT count(*) FROM entity") == 1.0);
+        REQUIRE(_queryReal(state, "SELECT max(time) FROM tick_log") == 1.0);
+      }
+    }
+    WHEN("a module with native components is loaded into it")
+    {
+      nebula::ecs state(path);
+      auto mod = nebula::module("test/ecs-module", true);
+      mod.loadModule();
+      THEN("it is refused before anything is created")
+      {
+        REQUIRE_THROWS(state.loadModule(mod));
+        REQUIRE(_queryReal(state,
+                    "SELECT count(*) FROM sqlite_master WHERE name = 'shield'")
+                == 0.0);
+      }
+    }
+    WHEN("a native component was created in it by hand")
+    {
+      {
+        nebula::ecs state(path);
+        state.execute("CREATE VIRTUAL TABLE marker USING tag_set;");
+      }
+      THEN("it can no longer be opened")
+      {
+        REQUIRE_THROWS(std::make_unique<nebula::ecs>(path));
+      }
+    }
+    for (auto suffix : {"", "-wal", "-shm"}) {
+      std::filesystem::remove(path + suffix);
+    }
+  }
 }
 #endif
 
 namespace nebula {
 
-ecs::ecs() : _db(nullptr)
+ecs::ecs() : ecs(":memory:")
+{
+}
+
+ecs::ecs(const std::string &path, sqlite3_int64 mmapSize, int checkpointFrames)
+    : _db(nullptr), _dataVersion(nullptr), _sweep(nullptr), _sleep(nullptr),
+      _saveClock(nullptr), _saveVar(nullptr), _saveArmed(nullptr),
+      _saveDisarmed(nullptr), _deltaT(0.0), _simTime(0.0), _budget(0.0),
+      _ticks(0), _sleepAfter(60), _math(trig::precision::precise), _seed(0),
+      _random(rng::stream(0, "")), _stream(&_random), _dropping(false),
+      _resumed(false)
 {
   LOG_SCOPE_FUNCTION(INFO);
   int res = sqlite3_open_v2(
-      ":memory:", &_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
+      path.c_str(), &_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
   if (res != SQLITE_OK) {
     throw sqliteException(res);
   }
+  if (path != ":memory:") {
+    // Native components live in memory only, so a file declaring one would
+    // come back with it empty.
+    std::string native;
+    sqlite3_stmt *stmt;
+    res = sqlite3_prepare_v2(_db,
+        "SELECT name FROM sqlite_master WHERE sql LIKE "
+        "'CREATE VIRTUAL TABLE %';",
+        -1,
+        &stmt,
+        nullptr);
+    if (res == SQLITE_OK) {
+      res = sqlite3_step(stmt);
+      if (res == SQLITE_ROW) {
+        native = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+      }
+      sqlite3_finalize(stmt);
+    }
+    if (res != SQLITE_ROW && res != SQLITE_DONE) {
+      sqliteException error(_db);
+      sqlite3_close(_db);
+      throw error;
+    }
+    if (!native.empty()) {
+      sqlite3_close(_db);
+      throw nebulaException("World database " + path
+                            + " declares native component " + native);
+    }
+    // Synchronous NORMAL only syncs the log when it is checkpointed, which
+    // the checkpointer does on its own thread instead of at commit.
+    std::string sql = "PRAGMA journal_mode = WAL; PRAGMA synchronous = "
+                      "NORMAL; PRAGMA mmap_size = "
+                    + std::to_string(mmapSize) + ";";
+    if (sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, nullptr)
+        != SQLITE_OK)
+    {
+      throw sqliteException(_db);
+    }
+    sqlite3_stmt *mode;
+    if (sqlite3_prepare_v2(_db, "PRAGMA journal_mode;", -1, &mode, nullptr)
+        != SQLITE_OK)
+    {
+      throw sqliteException(_db);
+    }
+    if (sqlite3_step(mode) != SQLITE_ROW) {
+      sqliteException error(_db);
+      sqlite3_finalize(mode);
+      throw error;
+    }
+    std::string journal
+        = reinterpret_cast<const char *>(sqlite3_column_text(mode, 0));
+    sqlite3_finalize(mode);
+    if (journal != "wal") {
+      throw nebulaException("World database " + path
+                            + " cannot use a write-ahead log");
+    }
+    // Replaces the automatic checkpoints run by the committing connection
+    _checkpointer = std::make_unique<checkpointer>(path, checkpointFrames);
+    sqlite3_wal_hook(_db, _walHook, this);
+    LOG_S(INFO) << "SQL: World database opened: " << path;
+  }
   sqlite3_stmt *insertEntityTable;
   if (sqlite3_prepare_v2(_db,
-          "CREATE TABLE entity (entity INTEGER PRIMARY KEY, id TEXT UNIQUE);",
+          "CREATE TABLE IF NOT EXISTS entity (entity INTEGER PRIMARY KEY, "
+          "id TEXT UNIQUE);",
           -1,
           &insertEntityTable,
           nullptr)
@@ -49,12 +900,2163 @@ ecs::ecs() : _db(nullptr)
   if (sqlite3_finalize(insertEntityTable) != SQLITE_OK) {
     throw sqliteException(_db);
   }
+  // The active set: entities that met an activity condition or had a
+  // watched component written within the last _sleepAfter ticks
+  if (sqlite3_exec(_db,
+          "CREATE TABLE IF NOT EXISTS active (entity INTEGER PRIMARY KEY, "
+          "idle INTEGER NOT NULL DEFAULT 0); CREATE TRIGGER IF NOT EXISTS "
+          "active_entity_delete AFTER DELETE ON entity BEGIN DELETE FROM "
+          "active WHERE entity = OLD.entity; END;",
+          nullptr,
+          nullptr,
+          nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  if (sqlite3_create_function_v2(_db,
+          "deltaT",
+          0,
+          SQLITE_UTF8,
+          this,
+          _sqlDeltaT,
+          nullptr,
+          nullptr,
+          nullptr)
+          != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "sim_time",
+             0,
+             SQLITE_UTF8,
+             this,
+             _sqlSimTime,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "clamp",
+             3,
+             SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+             nullptr,
+             _sqlClamp,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "sin",
+             1,
+             SQLITE_UTF8,
+             this,
+             _sqlSin,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "cos",
+             1,
+             SQLITE_UTF8,
+             this,
+             _sqlCos,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "sqrt",
+             1,
+             SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+             nullptr,
+             _sqlSqrt,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "_ecs_count",
+             2,
+             SQLITE_UTF8,
+             this,
+             _sqlCountDelta,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "_ecs_sum",
+             2,
+             SQLITE_UTF8,
+             this,
+             _sqlSumDelta,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "component_count",
+             1,
+             SQLITE_UTF8,
+             this,
+             _sqlComponentCount,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "aggregate",
+             1,
+             SQLITE_UTF8,
+             this,
+             _sqlAggregate,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "has_tag",
+             2,
+             SQLITE_UTF8,
+             this,
+             _sqlHasTag,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "schedule_timer",
+             2,
+             SQLITE_UTF8,
+             this,
+             _sqlScheduleTimer,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "schedule_timer",
+             3,
+             SQLITE_UTF8,
+             this,
+             _sqlScheduleTimer,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "cancel_timer",
+             2,
+             SQLITE_UTF8,
+             this,
+             _sqlCancelTimer,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "spawn",
+             1,
+             SQLITE_UTF8,
+             this,
+             _sqlSpawn,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "var",
+             1,
+             SQLITE_UTF8 | SQLITE_INNOCUOUS,
+             this,
+             _sqlVar,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "set_var",
+             2,
+             SQLITE_UTF8,
+             this,
+             _sqlSetVar,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "rand_uniform",
+             0,
+             SQLITE_UTF8,
+             this,
+             _sqlRandUniform,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "rand_uniform",
+             2,
+             SQLITE_UTF8,
+             this,
+             _sqlRandUniform,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK
+      || sqlite3_create_function_v2(_db,
+             "rand_int",
+             2,
+             SQLITE_UTF8,
+             this,
+             _sqlRandInt,
+             nullptr,
+             nullptr,
+             nullptr)
+             != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  LOG_S(INFO) << "SQL: Engine functions registered";
+  columnStore::registerModule(_db, _columnStores);
+  tagSet::registerModule(_db, _tagSets);
+  sparseSet::registerModule(_db, _sparseSets);
+  eventChannel::registerModule(_db, _eventChannels);
+  bulkArray::registerModule(_db);
+  // Lets the delete triggers maintaining counts see rows removed by REPLACE,
+  // and deleting an entity cascade to its component tables
+  if (sqlite3_exec(_db,
+          "PRAGMA recursive_triggers = ON; PRAGMA foreign_keys = ON;",
+          nullptr,
+          nullptr,
+          nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  sqlite3_update_hook(_db, _updateHook, this);
+  sqlite3_set_authorizer(_db, _authorizer, this);
+  if (sqlite3_prepare_v2(
+          _db, "PRAGMA data_version;", -1, &_dataVersion, nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  if (_checkpointer) {
+    resume();
+  }
 }
 
 ecs::~ecs()
 {
   LOG_SCOPE_FUNCTION(INFO);
+  if (_checkpointer) {
+    // Keeps what statements changed since the last tick
+    try {
+      execute("BEGIN TRANSACTION;");
+      saveWorld(_ticks);
+      execute("COMMIT TRANSACTION;");
+    } catch (std::exception &e) {
+      sqlite3_exec(_db, "ROLLBACK TRANSACTION;", nullptr, nullptr, nullptr);
+      LOG_S(WARNING) << "World database not saved: " << e.what();
+    }
+  }
+  for (auto &sys : _systems) {
+    sqlite3_finalize(sys._stmt);
+    sqlite3_finalize(sys._sliceEnd);
+    for (auto stmt : sys._program) {
+      sqlite3_finalize(stmt);
+    }
+  }
+  _systems.clear();
+  for (auto &[name, render] : _renders) {
+    sqlite3_finalize(render._stmt);
+  }
+  for (auto &view : _views) {
+    sqlite3_finalize(view._delete);
+    sqlite3_finalize(view._insert);
+  }
+  for (auto &buf : _buffers) {
+    sqlite3_finalize(buf._clear);
+    sqlite3_finalize(buf._copy);
+    sqlite3_finalize(buf._forget);
+  }
+  for (auto &timer : _timers) {
+    sqlite3_finalize(timer._fire);
+  }
+  for (auto &[name, pool] : _pools) {
+    for (auto stmt : pool._reset) {
+      sqlite3_finalize(stmt);
+    }
+  }
+  for (auto &[type, stmt] : _queries) {
+    sqlite3_finalize(stmt);
+  }
+  for (auto &[sql, stmt] : _bulkWrites) {
+    sqlite3_finalize(stmt);
+  }
+  sqlite3_finalize(_dataVersion);
+  sqlite3_finalize(_sweep);
+  sqlite3_finalize(_sleep);
+  sqlite3_finalize(_saveClock);
+  sqlite3_finalize(_saveVar);
+  sqlite3_finalize(_saveArmed);
+  sqlite3_finalize(_saveDisarmed);
+  _hierarchy.reset();
+  // Closing the last connection checkpoints whatever is left of the log
+  _checkpointer.reset();
   sqlite3_close(_db);
 }
 
+// Counts row changes per table so cached render results can tell whether
+// any of their inputs were written since they last ran.
+void ecs::_updateHook(void *self,
+    int op,
+    const char *database,
+    const char *table,
+    sqlite3_int64 rowid)
+{
+  auto &counts = static_cast<ecs *>(self)->_changeCounts;
+  auto count   = counts.find(std::string_view(table));
+  if (count == counts.end()) {
+    counts.emplace(table, 1);
+  } else {
+    ++count->second;
+  }
+}
+
+int ecs::_walHook(void *self, sqlite3 *db, const char *database, int frames)
+{
+  auto &background = static_cast<ecs *>(self)->_checkpointer;
+  if (background) {
+    background->committed(frames);
+  }
+  return SQLITE_OK;
+}
+
+// SQLite skips the update hook when it truncates a table for a DELETE
+// without a WHERE clause; returning SQLITE_IGNORE disables that shortcut.
+int ecs::_authorizer(void *self,
+    int action,
+    const char *arg1,
+    const char *arg2,
+    const char *database,
+    const char *trigger)
+{
+  // DROP statements ask about deleting from the schema table and, after
+  // the drop itself, from the dropped table; ignoring either would skip the
+  // drop.
+  auto world       = static_cast<ecs *>(self);
+  bool dropping    = world->_dropping;
+  world->_dropping = action == SQLITE_DROP_TABLE || action == SQLITE_DROP_VIEW
+                     || action == SQLITE_DROP_TEMP_TABLE
+                     || action == SQLITE_DROP_TEMP_VIEW
+                     || action == SQLITE_DROP_VTABLE;
+  if (action != SQLITE_DELETE || dropping
+      || sqlite3_strnicmp(arg1, "sqlite_", 7) == 0)
+  {
+    return SQLITE_OK;
+  }
+  return SQLITE_IGNORE;
+}
+
+void ecs::_sqlDeltaT(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  sqlite3_result_double(
+      ctx, static_cast<ecs *>(sqlite3_user_data(ctx))->_deltaT);
+}
+
+void ecs::_sqlSimTime(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  sqlite3_result_double(
+      ctx, static_cast<ecs *>(sqlite3_user_data(ctx))->_simTime);
+}
+
+void ecs::_sqlClamp(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  for (int i = 0; i < 3; ++i) {
+    if (sqlite3_value_type(argv[i]) == SQLITE_NULL) {
+      sqlite3_result_null(ctx);
+      return;
+    }
+  }
+  double value = sqlite3_value_double(argv[0]);
+  double lo    = sqlite3_value_double(argv[1]);
+  double hi    = sqlite3_value_double(argv[2]);
+  sqlite3_result_double(ctx, value < lo ? lo : (value > hi ? hi : value));
+}
+
+// sin() and cos() follow the precision of the module whose system is running,
+// and the default precise libm results outside of systems.
+void ecs::_sqlSin(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+  auto self = static_cast<ecs *>(sqlite3_user_data(ctx));
+  sqlite3_result_double(
+      ctx, trig::sin(sqlite3_value_double(argv[0]), self->_math));
+}
+
+void ecs::_sqlCos(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+  auto self = static_cast<ecs *>(sqlite3_user_data(ctx));
+  sqlite3_result_double(
+      ctx, trig::cos(sqlite3_value_double(argv[0]), self->_math));
+}
+
+void ecs::_sqlSqrt(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  double value = sqlite3_value_double(argv[0]);
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL || value < 0.0) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+  sqlite3_result_double(ctx, std::sqrt(value));
+}
+
+// Called by the triggers trackCount() and createAggregate() install.
+void ecs::_sqlCountDelta(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto &counts = static_cast<ecs *>(sqlite3_user_data(ctx))->_rowCounts;
+  auto name    = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+  auto count   = counts.find(std::string_view(name ? name : ""));
+  if (count != counts.end()) {
+    count->second += sqlite3_value_int64(argv[1]);
+  }
+  sqlite3_result_null(ctx);
+}
+
+void ecs::_sqlSumDelta(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto &aggregates = static_cast<ecs *>(sqlite3_user_data(ctx))->_aggregates;
+  auto name  = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+  auto found = aggregates.find(std::string_view(name ? name : ""));
+  if (found != aggregates.end()) {
+    found->second._sum += sqlite3_value_double(argv[1]);
+  }
+  sqlite3_result_null(ctx);
+}
+
+void ecs::_sqlComponentCount(
+    sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto self = static_cast<ecs *>(sqlite3_user_data(ctx));
+  auto name = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+  try {
+    sqlite3_result_int64(ctx, self->count(name ? name : ""));
+  } catch (nebulaException &e) {
+    sqlite3_result_error(ctx, e.what(), -1);
+  }
+}
+
+void ecs::_sqlAggregate(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto self = static_cast<ecs *>(sqlite3_user_data(ctx));
+  auto name = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+  try {
+    sqlite3_result_double(ctx, self->aggregate(name ? name : ""));
+  } catch (nebulaException &e) {
+    sqlite3_result_error(ctx, e.what(), -1);
+  }
+}
+
+// The tag name is nearly always a literal, so the set it names is looked up
+// once per statement and kept as auxiliary data on that argument.
+void ecs::_sqlHasTag(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto set = static_cast<const tagSet *>(sqlite3_get_auxdata(ctx, 1));
+  if (!set) {
+    auto self = static_cast<ecs *>(sqlite3_user_data(ctx));
+    auto name = reinterpret_cast<const char *>(sqlite3_value_text(argv[1]));
+    set       = self->getTagSet(name ? name : "");
+    if (!set) {
+      std::string error = "Component '" + std::string(name ? name : "")
+                        + "' is not a tag";
+      sqlite3_result_error(ctx, error.c_str(), -1);
+      return;
+    }
+    sqlite3_set_auxdata(ctx, 1, const_cast<tagSet *>(set), nullptr);
+  }
+  sqlite3_result_int(ctx,
+      sqlite3_value_numeric_type(argv[0]) == SQLITE_INTEGER
+          && set->has(sqlite3_value_int64(argv[0])));
+}
+
+// schedule_timer(name, entity[, seconds]) waits the timer's own delay when
+// no seconds are given.
+void ecs::_sqlScheduleTimer(
+    sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto self = static_cast<ecs *>(sqlite3_user_data(ctx));
+  auto name = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+  try {
+    std::string timer = name ? name : "";
+    double seconds    = argc > 2 ? sqlite3_value_double(argv[2])
+                                 : self->_timers[self->timerId(timer)]._after;
+    self->scheduleTimer(timer, sqlite3_value_int64(argv[1]), seconds);
+    sqlite3_result_null(ctx);
+  } catch (nebulaException &e) {
+    sqlite3_result_error(ctx, e.what(), -1);
+  }
+}
+
+void ecs::_sqlCancelTimer(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto self = static_cast<ecs *>(sqlite3_user_data(ctx));
+  auto name = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+  try {
+    self->cancelTimer(name ? name : "", sqlite3_value_int64(argv[1]));
+    sqlite3_result_null(ctx);
+  } catch (nebulaException &e) {
+    sqlite3_result_error(ctx, e.what(), -1);
+  }
+}
+
+void ecs::_sqlSpawn(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto self = static_cast<ecs *>(sqlite3_user_data(ctx));
+  auto name = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+  try {
+    sqlite3_int64 entity = self->spawn(name ? name : "");
+    if (entity < 0) {
+      sqlite3_result_null(ctx);
+    } else {
+      sqlite3_result_int64(ctx, entity);
+    }
+  } catch (std::exception &e) {
+    sqlite3_result_error(ctx, e.what(), -1);
+  }
+}
+
+// var() reads the variable on every call, so rows a statement visits after
+// a set_var() see the new value. It is registered as innocuous, not as
+// deterministic, which would let SQLite reuse one result for the statement.
+void ecs::_sqlVar(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto &vars = static_cast<ecs *>(sqlite3_user_data(ctx))->_vars;
+  auto name  = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+  auto found = name ? vars.find(std::string_view(name)) : vars.end();
+  if (found == vars.end()) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+  std::visit(
+      [ctx](const auto &value) {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<T, sqlite3_int64>) {
+          sqlite3_result_int64(ctx, value);
+        } else if constexpr (std::is_same_v<T, double>) {
+          sqlite3_result_double(ctx, value);
+        } else if constexpr (std::is_same_v<T, std::string>) {
+          sqlite3_result_text(
+              ctx, value.c_str(), value.size(), SQLITE_TRANSIENT);
+        } else {
+          sqlite3_result_null(ctx);
+        }
+      },
+      found->second);
+}
+
+void ecs::_sqlSetVar(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto self = static_cast<ecs *>(sqlite3_user_data(ctx));
+  auto name = reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+  if (!name) {
+    sqlite3_result_error(ctx, "set_var() needs a variable name", -1);
+    return;
+  }
+  switch (sqlite3_value_type(argv[1])) {
+  case SQLITE_INTEGER:
+    self->setVar(name, sqlite3_value_int64(argv[1]));
+    break;
+  case SQLITE_FLOAT:
+    self->setVar(name, sqlite3_value_double(argv[1]));
+    break;
+  case SQLITE_NULL:
+    self->setVar(name, std::monostate());
+    break;
+  default:
+    self->setVar(name,
+        std::string(reinterpret_cast<const char *>(sqlite3_value_text(argv[1])),
+            sqlite3_value_bytes(argv[1])));
+  }
+  sqlite3_result_value(ctx, argv[1]);
+}
+
+void ecs::_sqlRandUniform(
+    sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto &random = static_cast<ecs *>(sqlite3_user_data(ctx))->random();
+  if (argc == 0) {
+    sqlite3_result_double(ctx, random.uniform());
+    return;
+  }
+  sqlite3_result_double(ctx,
+      random.uniform(
+          sqlite3_value_double(argv[0]), sqlite3_value_double(argv[1])));
+}
+
+void ecs::_sqlRandInt(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+  auto &random = static_cast<ecs *>(sqlite3_user_data(ctx))->random();
+  sqlite3_result_int64(ctx,
+      random.integer(
+          sqlite3_value_int64(argv[0]), sqlite3_value_int64(argv[1])));
+}
+
+void ecs::seed(uint64_t seed)
+{
+  _seed   = seed;
+  _random = rng::stream(seed, "");
+  for (auto &sys : _systems) {
+    sys._random = rng::stream(seed, sys._name);
+  }
+}
+
+sqlite3_int64 ecs::count(const std::string &component) const
+{
+  if (auto store = getColumnStore(component)) {
+    return store->size();
+  }
+  if (auto set = getTagSet(component)) {
+    return set->size();
+  }
+  if (auto set = getSparseSet(component)) {
+    return set->size();
+  }
+  auto found = _rowCounts.find(component);
+  if (found == _rowCounts.end()) {
+    throw nebulaException("Component '" + component + "' is not counted");
+  }
+  return found->second;
+}
+
+double ecs::aggregate(const std::string &name) const
+{
+  auto found = _aggregates.find(name);
+  if (found == _aggregates.end()) {
+    throw nebulaException("Aggregate '" + name + "' has not been loaded");
+  }
+  if (found->second._column.empty()) {
+    return static_cast<double>(count(found->second._component));
+  }
+  return found->second._sum;
+}
+
+// Packed, sparse and tag components know their size already; SQLite tables
+// get triggers feeding the native count.
+void ecs::trackCount(const std::string &component)
+{
+  if (getColumnStore(component) || getTagSet(component)
+      || getSparseSet(component) || _rowCounts.count(component) > 0)
+  {
+    return;
+  }
+  _rowCounts[component] = 0;
+  std::string prefix
+      = "CREATE TRIGGER IF NOT EXISTS " + component + "_count_";
+  execute(prefix + "insert AFTER INSERT ON " + component
+          + " BEGIN SELECT _ecs_count('" + component + "', 1); END;");
+  execute(prefix + "delete AFTER DELETE ON " + component
+          + " BEGIN SELECT _ecs_count('" + component + "', -1); END;");
+  recount();
+}
+
+void ecs::createAggregate(
+    const std::string &name, const module::aggregateInfo &info)
+{
+  _aggregates[name] = {info._component, info._column, 0.0};
+  if (info._column.empty()) {
+    return;
+  }
+  if (getColumnStore(info._component) || getTagSet(info._component)
+      || getSparseSet(info._component))
+  {
+    throw nebulaException("Aggregate '" + name
+                          + "' sums a native component, which is unsupported");
+  }
+  std::string prefix
+      = "CREATE TRIGGER IF NOT EXISTS " + name + "_aggregate_";
+  std::string newValue = "coalesce(NEW." + info._column + ", 0)";
+  std::string oldValue = "coalesce(OLD." + info._column + ", 0)";
+  std::string call     = " BEGIN SELECT _ecs_sum('" + name + "', ";
+  execute(prefix + "insert AFTER INSERT ON " + info._component + call
+          + newValue + "); END;");
+  execute(prefix + "delete AFTER DELETE ON " + info._component + call + "-"
+          + oldValue + "); END;");
+  execute(prefix + "update AFTER UPDATE OF " + info._column + " ON "
+          + info._component + call + newValue + " - " + oldValue + "); END;");
+  recount();
+}
+
+// Trigger side effects are not undone when SQLite rolls a statement or
+// transaction back, so every failure path re-derives the counts here. This
+// also clears any rounding drift in the running sums.
+void ecs::recount()
+{
+  for (auto &[component, count] : _rowCounts) {
+    count = static_cast<sqlite3_int64>(
+        queryScalar("SELECT count(*) FROM " + component + ";"));
+  }
+  for (auto &[name, aggregate] : _aggregates) {
+    if (!aggregate._column.empty()) {
+      aggregate._sum = queryScalar("SELECT total(" + aggregate._column
+                                 + ") FROM " + aggregate._component + ";");
+    }
+  }
+}
+
+// SQLite orders joins by estimated table sizes, and without statistics it
+// guesses the same size for every component. Once a component has grown or
+// shrunk twofold since the last plan, the plain component row counts are
+// written to sqlite_stat1 and reloaded; that expires every statement, so
+// each is planned again on its next step, native stores reporting their
+// current sizes as they are.
+void ecs::replan()
+{
+  std::map<std::string, sqlite3_int64> sizes;
+  for (const auto &[name, count] : _rowCounts) {
+    sizes[name] = std::max<sqlite3_int64>(count, 1);
+  }
+  for (const auto &[name, store] : _columnStores) {
+    sizes[name] = std::max<sqlite3_int64>(store->size(), 1);
+  }
+  for (const auto &[name, set] : _tagSets) {
+    sizes[name] = std::max<sqlite3_int64>(set->size(), 1);
+  }
+  for (const auto &[name, set] : _sparseSets) {
+    sizes[name] = std::max<sqlite3_int64>(set->size(), 1);
+  }
+  bool stale = sizes.size() != _plannedSizes.size();
+  for (const auto &[name, size] : sizes) {
+    auto planned = _plannedSizes.find(name);
+    stale        = stale || planned == _plannedSizes.end()
+            || size > 2 * planned->second || planned->second > 2 * size;
+  }
+  if (!stale) {
+    return;
+  }
+  std::string sql = "ANALYZE sqlite_schema; DELETE FROM sqlite_stat1;";
+  for (const auto &[name, count] : _rowCounts) {
+    sql += " INSERT INTO sqlite_stat1 VALUES ('" + name + "', NULL, '"
+         + std::to_string(sizes[name]) + "');";
+  }
+  sql += " ANALYZE sqlite_schema;";
+  if (sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+    throw sqliteException(_db);
+  }
+  _plannedSizes = std::move(sizes);
+}
+
+double ecs::queryScalar(const std::string &sql)
+{
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+    throw sqliteException(_db);
+  }
+  if (sqlite3_step(stmt) != SQLITE_ROW) {
+    sqliteException error(_db);
+    sqlite3_finalize(stmt);
+    throw error;
+  }
+  double value = sqlite3_column_double(stmt, 0);
+  sqlite3_finalize(stmt);
+  return value;
+}
+
+const ecs::variable &ecs::var(const std::string &name) const
+{
+  static const variable unset;
+  auto found = _vars.find(name);
+  return found == _vars.end() ? unset : found->second;
+}
+
+void ecs::setVar(const std::string &name, variable value)
+{
+  _vars[name] = std::move(value);
+}
+
+double ecs::param(const std::string &name) const
+{
+  auto found = _params.find(name);
+  if (found == _params.end()) {
+    throw nebulaException("Param '" + name + "' has not been declared");
+  }
+  return found->second;
+}
+
+void ecs::setParam(const std::string &name, double value)
+{
+  auto found = _params.find(name);
+  if (found == _params.end()) {
+    throw nebulaException("Param '" + name + "' has not been declared");
+  }
+  found->second   = value;
+  std::string key = "$" + name;
+  for (auto &sys : _systems) {
+    if (sys._kernel) {
+      sys._kernel->bindParameter(name, value);
+      continue;
+    }
+    auto stmts = sys._stmt ? std::vector<sqlite3_stmt *> {sys._stmt}
+                           : sys._program;
+    for (auto stmt : stmts) {
+      int index = sqlite3_bind_parameter_index(stmt, key.c_str());
+      if (index > 0) {
+        sqlite3_bind_double(stmt, index, value);
+      }
+    }
+  }
+  for (auto &[renderName, render] : _renders) {
+    int index = sqlite3_bind_parameter_index(render._stmt, key.c_str());
+    if (index > 0) {
+      sqlite3_bind_double(render._stmt, index, value);
+      // Never matches PRAGMA data_version, so the next getRender() re-runs
+      render._dataVersion = -1;
+    }
+  }
+}
+
+const columnStore *ecs::getColumnStore(const std::string &component) const
+{
+  auto store = _columnStores.find(component);
+  if (store == _columnStores.end()) {
+    return nullptr;
+  }
+  return store->second.get();
+}
+
+const tagSet *ecs::getTagSet(const std::string &component) const
+{
+  auto set = _tagSets.find(component);
+  if (set == _tagSets.end()) {
+    return nullptr;
+  }
+  return set->second.get();
+}
+
+const sparseSet *ecs::getSparseSet(const std::string &component) const
+{
+  auto set = _sparseSets.find(component);
+  if (set == _sparseSets.end()) {
+    return nullptr;
+  }
+  return set->second.get();
+}
+
+eventChannel *ecs::getEventChannel(const std::string &name)
+{
+  auto channel = _eventChannels.find(name);
+  if (channel == _eventChannels.end()) {
+    return nullptr;
+  }
+  return channel->second.get();
+}
+
+uint64_t ecs::changeCount(const std::string &component) const
+{
+  if (auto store = getColumnStore(component)) {
+    return store->version();
+  }
+  if (auto set = getTagSet(component)) {
+    return set->version();
+  }
+  if (auto set = getSparseSet(component)) {
+    return set->version();
+  }
+  auto count = _changeCounts.find(component);
+  return count == _changeCounts.end() ? 0 : count->second;
+}
+
+const ecs::renderData &ecs::getRender(const std::string &name)
+{
+  auto found = _renders.find(name);
+  if (found == _renders.end()) {
+    throw nebulaException("Render '" + name + "' has not been loaded");
+  }
+  auto &render = found->second;
+  if (sqlite3_step(_dataVersion) != SQLITE_ROW) {
+    sqlite3_reset(_dataVersion);
+    throw sqliteException(_db);
+  }
+  sqlite3_int64 dataVersion = sqlite3_column_int64(_dataVersion, 0);
+  sqlite3_reset(_dataVersion);
+  bool stale = render._data._version == 0
+            || dataVersion != render._dataVersion;
+  for (size_t i = 0; i < render._inputs.size(); ++i) {
+    uint64_t count  = changeCount(render._inputs[i]);
+    stale           = stale || count != render._seen[i];
+    render._seen[i] = count;
+  }
+  if (!stale) {
+    return render._data;
+  }
+  render._dataVersion = dataVersion;
+  render._data._values.clear();
+  int res;
+  while ((res = sqlite3_step(render._stmt)) == SQLITE_ROW) {
+    for (size_t c = 0; c < render._data._stride; ++c) {
+      render._data._values.push_back(
+          static_cast<float>(sqlite3_column_double(render._stmt, c)));
+    }
+  }
+  sqlite3_reset(render._stmt);
+  if (res != SQLITE_DONE) {
+    throw sqliteException(_db);
+  }
+  ++render._data._version;
+  return render._data;
+}
+
+sqlite3_stmt *ecs::prepareQuery(std::type_index type, std::string (*sql)())
+{
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v3(
+          _db, sql().c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  _queries[type] = stmt;
+  return stmt;
+}
+
+void ecs::bulkWrite(const std::string &sql,
+    const sqlite3_int64 *entities,
+    size_t count,
+    const std::vector<std::pair<std::string, const double *>> &columns)
+{
+  auto &stmt = _bulkWrites[sql];
+  if (!stmt
+      && sqlite3_prepare_v3(
+             _db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr)
+             != SQLITE_OK)
+  {
+    _bulkWrites.erase(sql);
+    throw sqliteException(_db);
+  }
+  bulkArray array(entities, count);
+  for (const auto &[column, values] : columns) {
+    array.addColumn(values);
+  }
+  array.bind(stmt, 1);
+  int res = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  if (res != SQLITE_DONE) {
+    sqliteException error(_db);
+    recount();
+    throw error;
+  }
+  refreshViews();
+}
+
+void ecs::bulkInsert(const std::string &component,
+    const sqlite3_int64 *entities,
+    size_t count,
+    const std::vector<std::pair<std::string, const double *>> &columns)
+{
+  std::string names  = "entity";
+  std::string values = "bulk.entity";
+  for (size_t c = 0; c < columns.size(); ++c) {
+    names += ", " + columns[c].first;
+    values += ", bulk.c" + std::to_string(c);
+  }
+  bulkWrite("INSERT INTO " + component + " (" + names + ") SELECT " + values
+                + " FROM bulk_array(?1) AS bulk;",
+      entities,
+      count,
+      columns);
+}
+
+void ecs::bulkUpdate(const std::string &component,
+    const sqlite3_int64 *entities,
+    size_t count,
+    const std::vector<std::pair<std::string, const double *>> &columns)
+{
+  std::string sql = "UPDATE " + component + " SET ";
+  for (size_t c = 0; c < columns.size(); ++c) {
+    if (c > 0) {
+      sql += ", ";
+    }
+    sql += columns[c].first + " = bulk.c" + std::to_string(c);
+  }
+  sql += " FROM bulk_array(?1) AS bulk WHERE " + component
+       + ".entity = bulk.entity;";
+  bulkWrite(sql, entities, count, columns);
+}
+
+// Statements run one at a time, so a failing one takes back the timer and
+// pool changes its triggers and functions made, while those of the
+// statements before it stand.
+void ecs::execute(const std::string &sql)
+{
+  const char *tail = sql.c_str();
+  while (*tail) {
+    // Outside a transaction, everything logged so far has been committed
+    if (sqlite3_get_autocommit(_db)) {
+      _timerChanges.clear();
+      _poolChanges.clear();
+    }
+    // Variables live outside SQLite, as in tick(), so a copy is restored
+    // when the statement fails.
+    auto vars     = _vars;
+    size_t timers = _timerChanges.size();
+    size_t pools  = _poolChanges.size();
+    sqlite3_stmt *stmt;
+    int res = sqlite3_prepare_v2(_db, tail, -1, &stmt, &tail);
+    if (res == SQLITE_OK && stmt) {
+      while ((res = sqlite3_step(stmt)) == SQLITE_ROW) { }
+    }
+    if (res != SQLITE_OK && res != SQLITE_DONE) {
+      sqliteException error(_db);
+      sqlite3_finalize(stmt);
+      // An error that ended the transaction took all of its changes with it
+      bool ended = sqlite3_get_autocommit(_db);
+      _vars      = std::move(vars);
+      undoTimers(ended ? 0 : timers);
+      undoPools(ended ? 0 : pools);
+      recount();
+      throw error;
+    }
+    sqlite3_finalize(stmt);
+  }
+  refreshViews();
+}
+
+void ecs::bindParameters(sqlite3_stmt *stmt, const std::string &owner)
+{
+  for (int i = 1; i <= sqlite3_bind_parameter_count(stmt); ++i) {
+    const char *name = sqlite3_bind_parameter_name(stmt, i);
+    if (!name || name[0] != '$') {
+      continue;
+    }
+    auto found = _params.find(name + 1);
+    if (found == _params.end()) {
+      throw nebulaException(
+          "Unknown param " + std::string(name) + " in " + owner);
+    }
+    sqlite3_bind_double(stmt, i, found->second);
+  }
+}
+
+// Whether a table is already in a world database reopened from its file
+bool ecs::reuseTable(const std::string &name)
+{
+  return queryScalar("SELECT count(*) FROM sqlite_master WHERE type = "
+                     "'table' AND name = '"
+                     + name + "';")
+      != 0.0;
+}
+
+// Native components live in memory only, so a world kept in a file would
+// lose them when it is closed.
+void ecs::refuseNative(const std::string &name, const std::string &sql)
+{
+  if (_checkpointer && sql.rfind("CREATE VIRTUAL TABLE ", 0) == 0) {
+    throw nebulaException("Native component '" + name
+                          + "' cannot be kept in a world database");
+  }
+}
+
+// A world file keeps the clock, variables and timer armings of its last
+// tick in tables of its own. Timers are restored as createTimer() declares
+// them.
+void ecs::resume()
+{
+  if (sqlite3_exec(_db,
+          "CREATE TABLE IF NOT EXISTS world_clock (id INTEGER PRIMARY KEY "
+          "CHECK (id = 0), ticks INTEGER NOT NULL, sim_time REAL NOT NULL); "
+          "CREATE TABLE IF NOT EXISTS world_vars (name TEXT PRIMARY KEY, "
+          "value); CREATE TABLE IF NOT EXISTS world_timers (timer TEXT NOT "
+          "NULL, entity INTEGER NOT NULL, due INTEGER NOT NULL, PRIMARY KEY "
+          "(timer, entity)) WITHOUT ROWID;",
+          nullptr,
+          nullptr,
+          nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  const char *save[] = {
+      "INSERT OR REPLACE INTO world_clock VALUES (0, ?1, ?2);",
+      "INSERT OR REPLACE INTO world_vars VALUES (?1, ?2);",
+      "INSERT OR REPLACE INTO world_timers VALUES (?1, ?2, ?3);",
+      "DELETE FROM world_timers WHERE timer = ?1 AND entity = ?2;",
+  };
+  sqlite3_stmt **stmts[]
+      = {&_saveClock, &_saveVar, &_saveArmed, &_saveDisarmed};
+  for (size_t i = 0; i < 4; ++i) {
+    if (sqlite3_prepare_v2(_db, save[i], -1, stmts[i], nullptr) != SQLITE_OK) {
+      throw sqliteException(_db);
+    }
+  }
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(_db,
+          "SELECT ticks, sim_time FROM world_clock;",
+          -1,
+          &stmt,
+          nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    _ticks   = static_cast<uint64_t>(sqlite3_column_int64(stmt, 0));
+    _simTime = sqlite3_column_double(stmt, 1);
+    _resumed = true;
+  }
+  sqlite3_finalize(stmt);
+  // The wheel is empty, so it moves straight to the restored time
+  _wheel.advance(
+      static_cast<uint64_t>(std::floor(_simTime / timerResolution)), _expired);
+  if (sqlite3_prepare_v2(
+          _db, "SELECT name, value FROM world_vars;", -1, &stmt, nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  int res;
+  while ((res = sqlite3_step(stmt)) == SQLITE_ROW) {
+    std::string name
+        = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+    switch (sqlite3_column_type(stmt, 1)) {
+    case SQLITE_INTEGER:
+      _vars[name] = sqlite3_column_int64(stmt, 1);
+      break;
+    case SQLITE_FLOAT:
+      _vars[name] = sqlite3_column_double(stmt, 1);
+      break;
+    case SQLITE_TEXT:
+      _vars[name] = std::string(
+          reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)));
+      break;
+    default:
+      _vars[name] = variable();
+    }
+  }
+  sqlite3_finalize(stmt);
+  if (res != SQLITE_DONE) {
+    throw sqliteException(_db);
+  }
+}
+
+static void _stepSave(sqlite3 *db, sqlite3_stmt *stmt)
+{
+  int res = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
+  if (res != SQLITE_DONE) {
+    throw sqliteException(db);
+  }
+}
+
+// Runs inside a transaction, so the file holds the clock, variables and
+// timers of the world as of its commit. Every variable is written, but only
+// the timer armings changed since the last save.
+void ecs::saveWorld(uint64_t ticks)
+{
+  sqlite3_bind_int64(_saveClock, 1, static_cast<sqlite3_int64>(ticks));
+  sqlite3_bind_double(_saveClock, 2, _simTime);
+  _stepSave(_db, _saveClock);
+  for (const auto &[name, value] : _vars) {
+    sqlite3_bind_text(
+        _saveVar, 1, name.c_str(), name.size(), SQLITE_TRANSIENT);
+    std::visit(
+        [this](const auto &value) {
+          using T = std::decay_t<decltype(value)>;
+          if constexpr (std::is_same_v<T, sqlite3_int64>) {
+            sqlite3_bind_int64(_saveVar, 2, value);
+          } else if constexpr (std::is_same_v<T, double>) {
+            sqlite3_bind_double(_saveVar, 2, value);
+          } else if constexpr (std::is_same_v<T, std::string>) {
+            sqlite3_bind_text(
+                _saveVar, 2, value.c_str(), value.size(), SQLITE_TRANSIENT);
+          } else {
+            sqlite3_bind_null(_saveVar, 2);
+          }
+        },
+        value);
+    _stepSave(_db, _saveVar);
+  }
+  for (const auto &[id, entity] : _unsavedTimers) {
+    const auto &timer = _timers[id];
+    auto armed        = timer._armed.find(entity);
+    auto stmt = armed == timer._armed.end() ? _saveDisarmed : _saveArmed;
+    sqlite3_bind_text(
+        stmt, 1, timer._name.c_str(), timer._name.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, entity);
+    if (armed != timer._armed.end()) {
+      sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(armed->second));
+    }
+    _stepSave(_db, stmt);
+  }
+}
+
+void ecs::createBuffer(const std::string &component, const std::string &sql)
+{
+  if (!reuseTable(component + "_prev")) {
+    execute(sql);
+  }
+  buffer buf = {nullptr, nullptr, nullptr, nullptr, nullptr};
+  auto store = _columnStores.find(component);
+  if (store != _columnStores.end()) {
+    buf._current  = store->second.get();
+    buf._previous = _columnStores[component + "_prev"].get();
+    _buffers.emplace_back(buf);
+    return;
+  }
+  std::string prefix
+      = "CREATE TRIGGER IF NOT EXISTS " + component + "_buffer_";
+  std::string written = component + "_written";
+  std::string log     = " BEGIN INSERT OR IGNORE INTO " + written + " VALUES ";
+  execute("CREATE TABLE IF NOT EXISTS " + written
+          + " (entity INTEGER PRIMARY KEY);");
+  execute(prefix + "insert AFTER INSERT ON " + component + log
+          + "(NEW.entity); END;");
+  execute(prefix + "update AFTER UPDATE ON " + component + log
+          + "(OLD.entity), (NEW.entity); END;");
+  execute(prefix + "delete AFTER DELETE ON " + component + log
+          + "(OLD.entity); END;");
+  // Rows already present count as written, so the first tick copies them
+  execute("INSERT OR IGNORE INTO " + written + " SELECT entity FROM "
+          + component + ";");
+  std::string clear  = "DELETE FROM " + component
+                     + "_prev WHERE entity IN (SELECT entity FROM "
+                     + written + ");";
+  std::string copy   = "INSERT INTO " + component + "_prev SELECT "
+                     + component + ".* FROM " + written + " JOIN "
+                     + component + " USING (entity);";
+  std::string forget = "DELETE FROM " + written + ";";
+  if (sqlite3_prepare_v2(_db, clear.c_str(), -1, &buf._clear, nullptr)
+          != SQLITE_OK
+      || sqlite3_prepare_v2(_db, copy.c_str(), -1, &buf._copy, nullptr)
+             != SQLITE_OK
+      || sqlite3_prepare_v2(_db, forget.c_str(), -1, &buf._forget, nullptr)
+             != SQLITE_OK)
+  {
+    sqlite3_finalize(buf._clear);
+    sqlite3_finalize(buf._copy);
+    throw sqliteException(_db);
+  }
+  _buffers.emplace_back(buf);
+}
+
+// Systems only write some of a component's rows, so the previous copy is
+// brought up to date instead of exchanging the two buffers: packed stores
+// wholesale, tables for the rows written since the last tick. The packed
+// copy is logged so that a rolled back tick can undo it.
+void ecs::advanceBuffers()
+{
+  for (auto &buf : _buffers) {
+    if (buf._previous) {
+      buf._previous->begin();
+      buf._previous->copyFrom(*buf._current);
+      continue;
+    }
+    int res = sqlite3_step(buf._clear);
+    sqlite3_reset(buf._clear);
+    if (res == SQLITE_DONE) {
+      res = sqlite3_step(buf._copy);
+      sqlite3_reset(buf._copy);
+    }
+    if (res == SQLITE_DONE) {
+      res = sqlite3_step(buf._forget);
+      sqlite3_reset(buf._forget);
+    }
+    if (res != SQLITE_DONE) {
+      throw sqliteException(_db);
+    }
+  }
+}
+
+// Writes to a watched component wake the entity at once; whether it stays
+// awake is decided by the condition when the tick ends.
+void ecs::watchActivity(const std::string &component, const std::string &awake)
+{
+  if (getColumnStore(component) || getTagSet(component)
+      || getSparseSet(component))
+  {
+    throw nebulaException("Activity of native component '" + component
+                          + "' cannot be watched");
+  }
+  if (_activity.count(component) == 0) {
+    // Systems rewrite rows with the values they already hold; only an
+    // update that changes a column wakes the entity.
+    std::string changed;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(_db,
+            "SELECT name FROM pragma_table_info(?1);",
+            -1,
+            &stmt,
+            nullptr)
+        != SQLITE_OK)
+    {
+      throw sqliteException(_db);
+    }
+    sqlite3_bind_text(stmt, 1, component.c_str(), -1, SQLITE_TRANSIENT);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      std::string column
+          = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+      changed += (changed.empty() ? " WHEN " : " OR ") + ("NEW." + column)
+               + " IS NOT OLD." + column;
+    }
+    sqlite3_finalize(stmt);
+    std::string prefix
+        = "CREATE TRIGGER IF NOT EXISTS " + component + "_wake_";
+    std::string wake = " BEGIN INSERT INTO active (entity) VALUES "
+                       "(NEW.entity) ON CONFLICT (entity) DO UPDATE SET "
+                       "idle = 0; END;";
+    execute(prefix + "insert AFTER INSERT ON " + component + wake);
+    execute(prefix + "update AFTER UPDATE ON " + component + changed + wake);
+    execute("INSERT OR IGNORE INTO active (entity) SELECT entity FROM "
+            + component + ";");
+  }
+  _activity[component] = awake;
+}
+
+void ecs::prepareSweep()
+{
+  sqlite3_finalize(_sweep);
+  sqlite3_finalize(_sleep);
+  _sweep = nullptr;
+  _sleep = nullptr;
+  if (_activity.empty()) {
+    return;
+  }
+  // Only the active set is visited, each entity looked up by key in the
+  // watched components.
+  std::string sql = "UPDATE active SET idle = CASE WHEN ";
+  for (auto watch = _activity.begin(); watch != _activity.end(); ++watch) {
+    if (watch != _activity.begin()) {
+      sql += " OR ";
+    }
+    sql += "EXISTS (SELECT 1 FROM " + watch->first + " WHERE "
+         + watch->first + ".entity = active.entity AND (" + watch->second
+         + "))";
+  }
+  sql += " THEN 0 ELSE idle + 1 END;";
+  if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &_sweep, nullptr) != SQLITE_OK
+      || sqlite3_prepare_v2(_db,
+             "DELETE FROM active WHERE idle >= ?1;",
+             -1,
+             &_sleep,
+             nullptr)
+             != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+}
+
+// Entities idle for _sleepAfter ticks leave the active set until one of
+// their watched components is written again.
+void ecs::sweepActivity()
+{
+  if (!_sweep) {
+    return;
+  }
+  int res = sqlite3_step(_sweep);
+  sqlite3_reset(_sweep);
+  if (res == SQLITE_DONE) {
+    sqlite3_bind_int64(_sleep, 1, static_cast<sqlite3_int64>(_sleepAfter));
+    res = sqlite3_step(_sleep);
+    sqlite3_reset(_sleep);
+  }
+  if (res != SQLITE_DONE) {
+    throw sqliteException(_db);
+  }
+}
+
+size_t ecs::timerId(const std::string &name) const
+{
+  auto found = _timerIds.find(name);
+  if (found == _timerIds.end()) {
+    throw nebulaException("Timer '" + name + "' has not been loaded");
+  }
+  return found->second;
+}
+
+// World transforms are computed after the systems of every tick. Attached
+// entities are deleted along with their parent, and recursive triggers carry
+// that down the subtree.
+void ecs::createHierarchy(const std::string &world, trig::precision math)
+{
+  if (_hierarchy) {
+    throw nebulaException("A hierarchy has already been placed");
+  }
+  execute("CREATE TRIGGER IF NOT EXISTS hierarchy_parent_delete AFTER DELETE "
+          "ON entity BEGIN DELETE FROM entity WHERE entity IN (SELECT entity "
+          "FROM hierarchy WHERE parent = old.entity); END;");
+  _hierarchy = std::make_unique<transformHierarchy>(
+      _db, _sparseSets.at("hierarchy").get(), world, math);
+}
+
+// Component rows arm and disarm the timer through triggers, so a component
+// without a B-tree cannot drive one.
+void ecs::createTimer(const std::string &name, const module::timerInfo &info)
+{
+  if (!info._component.empty()
+      && (getColumnStore(info._component) || getTagSet(info._component)
+          || getSparseSet(info._component)))
+  {
+    throw nebulaException("Timer '" + name + "' cannot be armed by native "
+                          + "component '" + info._component + "'");
+  }
+  moduleTimer timer = {name, info._after, nullptr, 0, {}};
+  if (sqlite3_prepare_v2(_db, info._sql.c_str(), -1, &timer._fire, nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  try {
+    bindParameters(timer._fire, name);
+  } catch (...) {
+    sqlite3_finalize(timer._fire);
+    throw;
+  }
+  timer._entityParam = sqlite3_bind_parameter_index(timer._fire, ":entity");
+  _timerIds[name]    = _timers.size();
+  _timers.emplace_back(std::move(timer));
+  if (!info._component.empty()) {
+    std::string prefix = "CREATE TRIGGER IF NOT EXISTS " + name + "_timer_";
+    execute(prefix + "arm AFTER INSERT ON " + info._component
+            + " BEGIN SELECT schedule_timer('" + name
+            + "', NEW.entity); END;");
+    execute(prefix + "disarm AFTER DELETE ON " + info._component
+            + " BEGIN SELECT cancel_timer('" + name + "', OLD.entity); END;");
+  }
+  if (_resumed) {
+    // Rows already in the file keep the arming they had, not a fresh one
+    restoreTimer(_timerIds[name]);
+  } else if (!info._component.empty()) {
+    execute("SELECT schedule_timer('" + name + "', entity) FROM "
+            + info._component + ";");
+  }
+}
+
+void ecs::restoreTimer(size_t id)
+{
+  auto &timer = _timers[id];
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(_db,
+          "SELECT entity, due FROM world_timers WHERE timer = ?1;",
+          -1,
+          &stmt,
+          nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  sqlite3_bind_text(stmt, 1, timer._name.c_str(), -1, SQLITE_TRANSIENT);
+  int res;
+  while ((res = sqlite3_step(stmt)) == SQLITE_ROW) {
+    sqlite3_int64 entity = sqlite3_column_int64(stmt, 0);
+    uint64_t due         = sqlite3_column_int64(stmt, 1);
+    timer._armed[entity] = due;
+    _wheel.schedule({due, id, entity});
+  }
+  sqlite3_finalize(stmt);
+  if (res != SQLITE_DONE) {
+    throw sqliteException(_db);
+  }
+}
+
+void ecs::scheduleTimer(
+    const std::string &name, sqlite3_int64 entity, double seconds)
+{
+  size_t id    = timerId(name);
+  auto &armed  = _timers[id]._armed;
+  auto found   = armed.find(entity);
+  double ticks = std::ceil((_simTime + seconds) / timerResolution);
+  uint64_t due = ticks > 0.0 ? static_cast<uint64_t>(ticks) : 0;
+  logTimer({id,
+      entity,
+      found != armed.end(),
+      found != armed.end() ? found->second : 0});
+  armed[entity] = due;
+  _wheel.schedule({due, id, entity});
+}
+
+// The wheel entry is left in place and skipped when it falls due.
+void ecs::cancelTimer(const std::string &name, sqlite3_int64 entity)
+{
+  size_t id   = timerId(name);
+  auto &armed = _timers[id]._armed;
+  auto found  = armed.find(entity);
+  if (found != armed.end()) {
+    logTimer({id, entity, true, found->second});
+    armed.erase(found);
+  }
+}
+
+// Only the timers falling due are visited. Each wheel entry is checked
+// against the timer's current arming, since re-arming or disarming an entity
+// leaves its earlier entry behind.
+void ecs::fireTimers()
+{
+  _wheel.advance(
+      static_cast<uint64_t>(std::floor(_simTime / timerResolution)), _expired);
+  for (const auto &entry : _expired) {
+    auto &timer = _timers[entry._id];
+    auto armed  = timer._armed.find(entry._entity);
+    if (armed == timer._armed.end() || armed->second != entry._due) {
+      continue;
+    }
+    logTimer({entry._id, entry._entity, true, entry._due});
+    timer._armed.erase(armed);
+    sqlite3_bind_int64(timer._fire, timer._entityParam, entry._entity);
+    int res;
+    while ((res = sqlite3_step(timer._fire)) == SQLITE_ROW) { }
+    sqlite3_reset(timer._fire);
+    if (res != SQLITE_DONE) {
+      throw sqliteException(_db);
+    }
+  }
+}
+
+void ecs::logTimer(const timerChange &change)
+{
+  _timerChanges.push_back(change);
+  if (_checkpointer) {
+    _unsavedTimers.emplace(change._id, change._entity);
+  }
+}
+
+// Restores every arming changed after the first mark changes logged
+void ecs::undoTimers(size_t mark)
+{
+  while (_timerChanges.size() > mark) {
+    const auto &change = _timerChanges.back();
+    auto &armed        = _timers[change._id]._armed;
+    if (change._wasArmed) {
+      armed[change._entity] = change._due;
+    } else {
+      armed.erase(change._entity);
+    }
+    _timerChanges.pop_back();
+  }
+}
+
+// Restores every arming changed during the tick and puts the entries taken
+// off the wheel back on it, where they fall due again on the next tick.
+void ecs::rollbackTimers()
+{
+  undoTimers(0);
+  for (const auto &entry : _expired) {
+    _wheel.schedule(entry);
+  }
+  _expired.clear();
+}
+
+// The block starts after the highest entity so far, and is inserted with
+// one statement per table, inside or outside a tick. A spawn() from SQL
+// fills the pool in the middle of the caller's statement, where SQLite
+// refuses to open a savepoint, so a failed fill deletes its entities and
+// with them their components.
+void ecs::fillPool(entityPool &pool)
+{
+  auto first = static_cast<sqlite3_int64>(
+      queryScalar("SELECT coalesce(max(entity), 0) + 1 FROM entity;"));
+  sqlite3_int64 last = first + pool._size - 1;
+  for (const auto &sql : pool._populate) {
+    sqlite3_stmt *stmt;
+    int res = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    if (res == SQLITE_OK) {
+      sqlite3_bind_int64(
+          stmt, sqlite3_bind_parameter_index(stmt, ":first"), first);
+      sqlite3_bind_int64(
+          stmt, sqlite3_bind_parameter_index(stmt, ":last"), last);
+      res = sqlite3_step(stmt);
+      sqlite3_finalize(stmt);
+    }
+    if (res != SQLITE_DONE && res != SQLITE_OK) {
+      sqliteException error(_db);
+      sqlite3_exec(_db,
+          ("DELETE FROM entity WHERE entity BETWEEN " + std::to_string(first)
+              + " AND " + std::to_string(last) + ";")
+              .c_str(),
+          nullptr,
+          nullptr,
+          nullptr);
+      throw error;
+    }
+  }
+  refreshViews();
+  pool._first = first;
+  pool._hint  = first;
+  _poolChanges.push_back({&pool, 0, false});
+}
+
+// A pooled entity spawned again gets the component values the pool
+// declares, through the pool's own insert statements over that one entity.
+void ecs::resetPooled(entityPool &pool, sqlite3_int64 entity)
+{
+  if (pool._reset.empty()) {
+    for (size_t i = 1; i < pool._populate.size(); ++i) {
+      sqlite3_stmt *stmt;
+      if (sqlite3_prepare_v2(
+              _db, pool._populate[i].c_str(), -1, &stmt, nullptr)
+          != SQLITE_OK)
+      {
+        throw sqliteException(_db);
+      }
+      pool._reset.emplace_back(stmt);
+    }
+  }
+  for (auto stmt : pool._reset) {
+    sqlite3_bind_int64(
+        stmt, sqlite3_bind_parameter_index(stmt, ":first"), entity);
+    sqlite3_bind_int64(
+        stmt, sqlite3_bind_parameter_index(stmt, ":last"), entity);
+    int res = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (res != SQLITE_DONE) {
+      throw sqliteException(_db);
+    }
+  }
+}
+
+// Restores the live bits changed after the first mark changes logged, and
+// forgets fills, whose rows the rollback took with it.
+void ecs::undoPools(size_t mark)
+{
+  while (_poolChanges.size() > mark) {
+    const auto &change = _poolChanges.back();
+    if (change._entity == 0) {
+      change._pool->_first = 0;
+      change._pool->_hint  = 0;
+    } else if (change._wasLive) {
+      change._pool->_live->insert(change._entity);
+    } else {
+      change._pool->_live->remove(change._entity);
+    }
+    _poolChanges.pop_back();
+  }
+}
+
+// The search for an unused entity resumes after the last one handed out,
+// so spawning through a pool costs a few bitset words at a time. The
+// entity's components are reset to the declared values, unless this spawn
+// has just created them.
+sqlite3_int64 ecs::spawn(const std::string &name)
+{
+  auto found = _pools.find(name);
+  if (found == _pools.end()) {
+    throw nebulaException("Pool '" + name + "' has not been loaded");
+  }
+  auto &pool  = found->second;
+  bool filled = pool._first == 0;
+  if (filled) {
+    fillPool(pool);
+  }
+  sqlite3_int64 end    = pool._first + pool._size;
+  sqlite3_int64 entity = pool._live->nextAbsent(pool._hint, end);
+  if (entity == tagSet::npos) {
+    entity = pool._live->nextAbsent(pool._first, pool._hint);
+  }
+  if (entity == tagSet::npos) {
+    return -1;
+  }
+  if (!filled) {
+    resetPooled(pool, entity);
+  }
+  pool._live->insert(entity);
+  pool._hint = entity + 1;
+  _poolChanges.push_back({&pool, entity, false});
+  return entity;
+}
+
+void ecs::despawn(const std::string &name, sqlite3_int64 entity)
+{
+  auto found = _pools.find(name);
+  if (found == _pools.end()) {
+    throw nebulaException("Pool '" + name + "' has not been loaded");
+  }
+  auto &pool = found->second;
+  if (pool._live->has(entity)) {
+    pool._live->remove(entity);
+    _poolChanges.push_back({&pool, entity, true});
+  }
+}
+
+// Views are stored as tables holding one row per entity. Inputs that are
+// SQLite tables keep them current through triggers; packed and sparse inputs
+// cannot carry triggers, so the entities they report as written are
+// re-derived in refreshViews() after every statement the ecs runs.
+void ecs::createView(const std::string &name, const module::viewInfo &info)
+{
+  LOG_SCOPE_FUNCTION(INFO);
+  if (reuseTable(name)) {
+    execute("DELETE FROM " + name + ";");
+  } else {
+    execute(info._create);
+  }
+  std::string derived = "SELECT * FROM (" + info._select + ") WHERE entity = ";
+  materializedView view;
+  view._name = name;
+  for (const auto &input : info._inputs) {
+    if (getTagSet(input)) {
+      throw nebulaException("View '" + name + "' reads tag '" + input
+                            + "'; test it with has_tag() instead");
+    }
+    if (getColumnStore(input) || getSparseSet(input)) {
+      if (std::find(view._packedInputs.begin(), view._packedInputs.end(), input)
+          == view._packedInputs.end())
+      {
+        view._packedInputs.emplace_back(input);
+        if (getColumnStore(input)) {
+          _columnStores[input]->track();
+        } else {
+          _sparseSets[input]->track();
+        }
+      }
+      continue;
+    }
+    // Only updates to columns the view mentions can change its rows.
+    std::string columns = "entity";
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(_db,
+            "SELECT name FROM pragma_table_info(?1);",
+            -1,
+            &stmt,
+            nullptr)
+        != SQLITE_OK)
+    {
+      throw sqliteException(_db);
+    }
+    sqlite3_bind_text(stmt, 1, input.c_str(), -1, SQLITE_TRANSIENT);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      std::string column
+          = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+      size_t pos = 0;
+      while ((pos = info._select.find(column, pos)) != std::string::npos) {
+        size_t end = pos + column.size();
+        bool start = pos == 0
+                  || !(std::isalnum(info._select[pos - 1])
+                       || info._select[pos - 1] == '_');
+        bool stop = end == info._select.size()
+                 || !(std::isalnum(info._select[end])
+                      || info._select[end] == '_');
+        if (start && stop && column != "entity") {
+          columns += ", " + column;
+          break;
+        }
+        pos = end;
+      }
+    }
+    sqlite3_finalize(stmt);
+    std::string prefix
+        = "CREATE TRIGGER IF NOT EXISTS " + name + "_" + input + "_";
+    execute(prefix + "insert AFTER INSERT ON " + input
+            + " BEGIN INSERT OR REPLACE INTO " + name + " " + derived
+            + "NEW.entity; END;");
+    execute(prefix + "update AFTER UPDATE OF " + columns + " ON " + input
+            + " BEGIN DELETE FROM " + name + " WHERE entity = OLD.entity; "
+            + "INSERT OR REPLACE INTO " + name + " " + derived
+            + "NEW.entity; END;");
+    execute(prefix + "delete AFTER DELETE ON " + input + " BEGIN DELETE FROM "
+            + name + " WHERE entity = OLD.entity; END;");
+  }
+  execute("INSERT INTO " + name + " " + info._select + ";");
+  std::string sql = "DELETE FROM " + name + " WHERE entity = ?1;";
+  if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &view._delete, nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  sql = "INSERT OR REPLACE INTO " + name + " " + derived + "?1;";
+  if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &view._insert, nullptr)
+      != SQLITE_OK)
+  {
+    sqlite3_finalize(view._delete);
+    throw sqliteException(_db);
+  }
+  _views.emplace_back(std::move(view));
+}
+
+void ecs::refreshViews()
+{
+  std::map<std::string, std::vector<sqlite3_int64>> dirty;
+  for (auto &view : _views) {
+    for (const auto &input : view._packedInputs) {
+      if (dirty.count(input) == 0) {
+        dirty[input] = getColumnStore(input)
+                         ? _columnStores[input]->takeDirty()
+                         : _sparseSets[input]->takeDirty();
+      }
+      for (auto entity : dirty[input]) {
+        sqlite3_bind_int64(view._delete, 1, entity);
+        sqlite3_bind_int64(view._insert, 1, entity);
+        int res = sqlite3_step(view._delete);
+        sqlite3_reset(view._delete);
+        if (res == SQLITE_DONE) {
+          res = sqlite3_step(view._insert);
+          sqlite3_reset(view._insert);
+        }
+        if (res != SQLITE_DONE) {
+          throw sqliteException(_db);
+        }
+      }
+    }
+  }
+}
+
+void ecs::loadModule(module &mod)
+{
+  LOG_SCOPE_FUNCTION(INFO);
+  for (const auto &[name, value] : mod.params()) {
+    _params[name] = value;
+  }
+  for (const auto &component : mod.components()) {
+    refuseNative(component, mod.getComponentSQL(component));
+  }
+  for (const auto &name : mod.events()) {
+    refuseNative(name, mod.getEventSQL(name));
+  }
+  // Initial values are typed the way SQLite would type the literal, unless
+  // the world file kept the value of an earlier run.
+  for (const auto &[name, text] : mod.vars()) {
+    if (_resumed && _vars.count(name) > 0) {
+      continue;
+    }
+    char *end;
+    long long integer = std::strtoll(text.c_str(), &end, 10);
+    if (!text.empty() && *end == '\0') {
+      setVar(name, static_cast<sqlite3_int64>(integer));
+      continue;
+    }
+    double real = std::strtod(text.c_str(), &end);
+    if (!text.empty() && *end == '\0') {
+      setVar(name, real);
+    } else {
+      setVar(name, text);
+    }
+  }
+  for (const auto &component : mod.components()) {
+    if (reuseTable(component)) {
+      LOG_S(INFO) << "SQL: Component table reused: " << component;
+    } else {
+      execute(mod.getComponentSQL(component));
+      LOG_S(INFO) << "SQL: Component table created: " << component;
+    }
+    trackCount(component);
+  }
+  for (const auto &[component, awake] : mod.activity()) {
+    watchActivity(component, awake);
+  }
+  if (mod.sleepAfter() > 0) {
+    _sleepAfter = mod.sleepAfter();
+  }
+  prepareSweep();
+  for (const auto &component : mod.buffers()) {
+    createBuffer(component, mod.getBufferSQL(component));
+    LOG_S(INFO) << "SQL: Component double-buffered: " << component;
+  }
+  for (const auto &name : mod.aggregates()) {
+    createAggregate(name, mod.getAggregateInfo(name));
+    LOG_S(INFO) << "SQL: Aggregate maintained: " << name;
+  }
+  for (const auto &name : mod.views()) {
+    createView(name, mod.getViewInfo(name));
+    LOG_S(INFO) << "SQL: Materialized view created: " << name;
+  }
+  for (const auto &name : mod.timers()) {
+    createTimer(name, mod.getTimerInfo(name));
+    LOG_S(INFO) << "SQL: Timer scheduled: " << name;
+  }
+  if (!mod.hierarchy().empty()) {
+    createHierarchy(mod.hierarchy(), mod.math());
+    LOG_S(INFO) << "SQL: Hierarchy placed in " << mod.hierarchy();
+  }
+  for (const auto &name : mod.events()) {
+    execute(mod.getEventSQL(name));
+    LOG_S(INFO) << "SQL: Event channel created: " << name;
+  }
+  for (const auto &name : mod.pools()) {
+    auto &info = mod.getPoolInfo(name);
+    for (auto stmt : _pools[name]._reset) {
+      sqlite3_finalize(stmt);
+    }
+    _pools[name]
+        = {_tagSets.at(name).get(), info._size, 0, 0, info._populate, {}};
+    LOG_S(INFO) << "SQL: Entity pool declared: " << name;
+  }
+  for (const auto &name : mod.systems()) {
+    system sys;
+    sys._name   = name;
+    sys._stmt   = nullptr;
+    sys._math   = mod.math();
+    sys._random   = rng::stream(_seed, name);
+    sys._cursor   = std::numeric_limits<sqlite3_int64>::min();
+    sys._sliceEnd = nullptr;
+    auto &info    = mod.getSystemInfo(name);
+    sys._slice    = info._slice;
+    // Systems of the same period take successive phases, spreading them
+    // over the ticks of the period instead of all running together.
+    sys._period  = info._period;
+    sys._phase   = _phases[info._period]++ % info._period;
+    sys._elapsed = 0.0;
+    if (!info._triggerComponent.empty()) {
+      std::vector<std::string> columns;
+      sys._triggerComponent = info._triggerComponent;
+      sys._trigger = std::make_unique<expression>(info._triggerCount, columns);
+      if (columns != std::vector<std::string> {"count"}) {
+        throw nebulaException("Invalid trigger in system " + name);
+      }
+    }
+    if (info._native) {
+      try {
+        sys._kernel = std::make_unique<kernel>(_db, info);
+        LOG_S(INFO) << "System compiled to native kernel: " << name;
+      } catch (std::exception &e) {
+        // Including statements SQLite cannot prepare for the kernel
+        LOG_S(WARNING) << "System " << name
+                       << " falls back to SQL: " << e.what();
+      }
+    }
+    if (info._component.empty()) {
+      // The program's schema exists before its statements are prepared
+      for (const auto &sql : info._setup) {
+        execute(sql);
+      }
+      for (const auto &sql : info._program) {
+        sys._program.emplace_back(nullptr);
+        if (sqlite3_prepare_v2(
+                _db, sql.c_str(), -1, &sys._program.back(), nullptr)
+            != SQLITE_OK)
+        {
+          throw sqliteException(_db);
+        }
+        bindParameters(sys._program.back(), name);
+      }
+      LOG_S(INFO) << "SQL: System program prepared: " << name;
+    } else if (!sys._kernel) {
+      auto sql = mod.getSystemSQL(name);
+      if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &sys._stmt, nullptr)
+          != SQLITE_OK)
+      {
+        throw sqliteException(_db);
+      }
+      bindParameters(sys._stmt, name);
+    } else {
+      for (const auto &param : sys._kernel->parameters()) {
+        if (_params.count(param) == 0) {
+          throw nebulaException("Unknown param $" + param + " in " + name);
+        }
+        sys._kernel->bindParameter(param, _params[param]);
+      }
+    }
+    if (sys._slice > 0) {
+      // Finds the last entity of the slice starting after ?1
+      auto sql = "SELECT entity FROM " + info._component
+               + " WHERE entity > ?1 ORDER BY entity LIMIT 1 OFFSET "
+               + std::to_string(sys._slice - 1) + ";";
+      if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &sys._sliceEnd, nullptr)
+          != SQLITE_OK)
+      {
+        sqlite3_finalize(sys._stmt);
+        throw sqliteException(_db);
+      }
+    }
+    _systems.emplace_back(std::move(sys));
+  }
+  for (const auto &name : mod.renders()) {
+    renderQuery render;
+    auto sql = mod.getRenderSQL(name);
+    if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &render._stmt, nullptr)
+        != SQLITE_OK)
+    {
+      throw sqliteException(_db);
+    }
+    bindParameters(render._stmt, name);
+    render._inputs        = mod.getRenderInputs(name);
+    render._seen          = std::vector<uint64_t>(render._inputs.size(), 0);
+    render._dataVersion   = 0;
+    render._data._stride  = sqlite3_column_count(render._stmt);
+    render._data._version = 0;
+    _renders[name]        = std::move(render);
+  }
+}
+
+void ecs::runSystem(system &sys, sqlite3_int64 after, sqlite3_int64 until)
+{
+  if (sys._kernel) {
+    sys._kernel->run(_deltaT, after, until);
+    return;
+  }
+  if (!sys._stmt) {
+    runProgram(sys);
+    return;
+  }
+  int index = sqlite3_bind_parameter_index(sys._stmt, ":slice_after");
+  if (index > 0) {
+    sqlite3_bind_int64(sys._stmt, index, after);
+    sqlite3_bind_int64(sys._stmt,
+        sqlite3_bind_parameter_index(sys._stmt, ":slice_until"),
+        until);
+  }
+  int res = sqlite3_step(sys._stmt);
+  sqlite3_reset(sys._stmt);
+  if (res != SQLITE_DONE) {
+    throw sqliteException(_db);
+  }
+}
+
+// Each statement is stepped to completion, so rows a SELECT returns are
+// discarded and only its side effects, such as set_var(), remain. The first
+// failure fails the tick; a statement ending the transaction itself, e.g.
+// through INSERT OR ROLLBACK, rolls back the whole tick, not just its block.
+void ecs::runProgram(system &sys)
+{
+  for (auto stmt : sys._program) {
+    int res;
+    while ((res = sqlite3_step(stmt)) == SQLITE_ROW) { }
+    sqlite3_reset(stmt);
+    if (res != SQLITE_DONE) {
+      throw sqliteException(_db);
+    }
+  }
+}
+
+// Runs slices of the system until it has covered every entity or the tick
+// is over budget. At least one slice runs each tick, so a pass always makes
+// progress; without a budget the whole pass runs as a single slice.
+void ecs::runSliced(system &sys, std::chrono::steady_clock::time_point start)
+{
+  const auto first = std::numeric_limits<sqlite3_int64>::min();
+  const auto last  = std::numeric_limits<sqlite3_int64>::max();
+  for (;;) {
+    sqlite3_int64 until = last;
+    if (_budget > 0.0) {
+      sqlite3_bind_int64(sys._sliceEnd, 1, sys._cursor);
+      int res = sqlite3_step(sys._sliceEnd);
+      if (res == SQLITE_ROW) {
+        until = sqlite3_column_int64(sys._sliceEnd, 0);
+      }
+      sqlite3_reset(sys._sliceEnd);
+      if (res != SQLITE_ROW && res != SQLITE_DONE) {
+        throw sqliteException(_db);
+      }
+    }
+    runSystem(sys, sys._cursor, until);
+    sys._cursor = until == last ? first : until;
+    std::chrono::duration<double, std::milli> elapsed
+        = std::chrono::steady_clock::now() - start;
+    if (sys._cursor == first || elapsed.count() > _budget) {
+      return;
+    }
+  }
+}
+
+void ecs::tick(double deltaT)
+{
+  auto start     = std::chrono::steady_clock::now();
+  double simTime = _simTime;
+  _deltaT        = deltaT;
+  _simTime += deltaT;
+  // Sim time, variables, random streams, slice cursors and elapsed times
+  // live outside SQLite, so a rolled back tick restores copies of them.
+  auto vars   = _vars;
+  auto random = _random;
+  std::vector<std::pair<sqlite3_int64, double>> schedule;
+  std::vector<rng> streams;
+  for (auto &sys : _systems) {
+    schedule.emplace_back(sys._cursor, sys._elapsed);
+    streams.push_back(sys._random);
+    sys._elapsed += deltaT;
+  }
+  replan();
+  _timerChanges.clear();
+  _poolChanges.clear();
+  _expired.clear();
+  execute("BEGIN TRANSACTION;");
+  try {
+    advanceBuffers();
+    fireTimers();
+    refreshViews();
+    for (auto &sys : _systems) {
+      // A pass resumed from an earlier tick was already scheduled
+      bool resuming = sys._cursor != std::numeric_limits<sqlite3_int64>::min();
+      if (!resuming && _ticks % sys._period != sys._phase) {
+        continue;
+      }
+      _deltaT = sys._elapsed;
+      _math   = sys._math;
+      _stream = &sys._random;
+      if (sys._trigger && !resuming) {
+        double count = static_cast<double>(this->count(sys._triggerComponent));
+        double fire;
+        const double *columns[] = {&count};
+        sys._trigger->evaluate(columns, 1, _deltaT, &fire);
+        if (fire == 0.0 || std::isnan(fire)) {
+          // The slot passed, so the next run's deltaT() starts from here
+          sys._elapsed = 0.0;
+          continue;
+        }
+      }
+      if (sys._slice > 0) {
+        runSliced(sys, start);
+      } else {
+        runSystem(sys,
+            std::numeric_limits<sqlite3_int64>::min(),
+            std::numeric_limits<sqlite3_int64>::max());
+      }
+      sys._elapsed = 0.0;
+      refreshViews();
+    }
+    if (_hierarchy) {
+      _hierarchy->update();
+      refreshViews();
+    }
+    sweepActivity();
+    if (_checkpointer) {
+      saveWorld(_ticks + 1);
+    }
+  } catch (...) {
+    _deltaT  = deltaT;
+    _simTime = simTime;
+    _math    = trig::precision::precise;
+    _stream  = &_random;
+    _random  = random;
+    _vars    = std::move(vars);
+    rollbackTimers();
+    undoPools(0);
+    if (_hierarchy) {
+      _hierarchy->invalidate();
+    }
+    for (size_t i = 0; i < _systems.size(); ++i) {
+      _systems[i]._cursor  = schedule[i].first;
+      _systems[i]._elapsed = schedule[i].second;
+      _systems[i]._random  = streams[i];
+    }
+    for (auto &buf : _buffers) {
+      if (buf._previous) {
+        buf._previous->rollback();
+      }
+    }
+    sqlite3_exec(_db, "ROLLBACK TRANSACTION;", nullptr, nullptr, nullptr);
+    recount();
+    throw;
+  }
+  _deltaT = deltaT;
+  _math   = trig::precision::precise;
+  _stream = &_random;
+  execute("COMMIT TRANSACTION;");
+  _unsavedTimers.clear();
+  for (auto &buf : _buffers) {
+    if (buf._previous) {
+      buf._previous->commit();
+    }
+  }
+  for (auto &[name, channel] : _eventChannels) {
+    channel->clear();
+  }
+  ++_ticks;
+}
+
 } // namespace nebula
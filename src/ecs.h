@@ -4,6 +4,29 @@
 #ifndef NEBULA_ECS_H
 #define NEBULA_ECS_H
 
+#include <chrono>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "bulk_array.h"
+#include "checkpointer.h"
+#include "column_store.h"
+#include "event_channel.h"
+#include "kernel.h"
+#include "module.h"
+#include "query.h"
+#include "rng.h"
+#include "sparse_set.h"
+#include "tag_set.h"
+#include "timer_wheel.h"
+#include "transform_hierarchy.h"
+
 extern "C" {
 #include "sqlite3.h"
 }
@@ -11,12 +34,355 @@ extern "C" {
 namespace nebula {
 
 class ecs {
+public:
+  // A global variable: unset, INTEGER, REAL or TEXT
+  using variable
+      = std::variant<std::monostate, sqlite3_int64, double, std::string>;
+
+  struct renderData {
+    size_t _stride;
+    std::vector<float> _values;
+    uint64_t _version;
+  };
+
 private:
+  struct system {
+    std::string _name;
+    sqlite3_stmt *_stmt;
+    std::unique_ptr<kernel> _kernel;
+    // Systems from .sql includes run these in place of _stmt
+    std::vector<sqlite3_stmt *> _program;
+    trig::precision _math;
+    rng _random;
+    std::string _triggerComponent;
+    std::unique_ptr<expression> _trigger;
+    // Sliced systems resume after _cursor, the last entity they reached
+    size_t _slice;
+    sqlite3_int64 _cursor;
+    sqlite3_stmt *_sliceEnd;
+    // Runs on the ticks where _ticks % _period == _phase, seeing the time
+    // elapsed since its last run as deltaT()
+    size_t _period;
+    size_t _phase;
+    double _elapsed;
+  };
+
+  struct renderQuery {
+    sqlite3_stmt *_stmt;
+    std::vector<std::string> _inputs;
+    std::vector<uint64_t> _seen;
+    sqlite3_int64 _dataVersion;
+    renderData _data;
+  };
+
+  struct aggregate {
+    std::string _component;
+    std::string _column;
+    double _sum;
+  };
+
+  // A double-buffered component and its previous-tick copy. Packed stores are
+  // copied natively; tables copy only the rows their triggers logged to
+  // <component>_written, with the three statements.
+  struct buffer {
+    columnStore *_current;
+    columnStore *_previous;
+    sqlite3_stmt *_clear;
+    sqlite3_stmt *_copy;
+    sqlite3_stmt *_forget;
+  };
+
+  // A module timer: the due time, in wheel units, of every entity it is
+  // armed for, and the statement run for an entity when it falls due.
+  struct moduleTimer {
+    std::string _name;
+    double _after;
+    sqlite3_stmt *_fire;
+    int _entityParam;
+    std::unordered_map<sqlite3_int64, uint64_t> _armed;
+  };
+
+  // A timer armed or disarmed since the last commit, with its state
+  // beforehand
+  struct timerChange {
+    size_t _id;
+    sqlite3_int64 _entity;
+    bool _wasArmed;
+    uint64_t _due;
+  };
+
+  // Entities kept for reuse, _live tagging those in use. They are created
+  // as one block from _first the first time the pool is spawned from.
+  struct entityPool {
+    tagSet *_live;
+    size_t _size;
+    sqlite3_int64 _first;
+    sqlite3_int64 _hint;
+    std::vector<std::string> _populate;
+    // The component statements of _populate, bound to one entity at a time
+    std::vector<sqlite3_stmt *> _reset;
+  };
+
+  // An entity spawned or despawned since the last commit, with whether it
+  // was live beforehand; entity 0 records the pool being filled.
+  struct poolChange {
+    entityPool *_pool;
+    sqlite3_int64 _entity;
+    bool _wasLive;
+  };
+
+  struct materializedView {
+    std::string _name;
+    std::vector<std::string> _packedInputs;
+    sqlite3_stmt *_delete;
+    sqlite3_stmt *_insert;
+  };
+
   sqlite3 *_db;
+  std::map<std::string, std::unique_ptr<columnStore>> _columnStores;
+  std::map<std::string, std::unique_ptr<tagSet>> _tagSets;
+  std::map<std::string, std::unique_ptr<sparseSet>> _sparseSets;
+  std::map<std::string, std::unique_ptr<eventChannel>> _eventChannels;
+  std::map<std::string, uint64_t, std::less<>> _changeCounts;
+  std::vector<system> _systems;
+  std::map<std::string, renderQuery> _renders;
+  std::vector<materializedView> _views;
+  std::vector<buffer> _buffers;
+  std::map<std::string, sqlite3_int64, std::less<>> _rowCounts;
+  std::map<std::string, sqlite3_int64> _plannedSizes;
+  std::map<std::string, aggregate, std::less<>> _aggregates;
+  std::vector<moduleTimer> _timers;
+  std::map<std::string, size_t, std::less<>> _timerIds;
+  timerWheel _wheel;
+  std::vector<timerWheel::timer> _expired;
+  std::vector<timerChange> _timerChanges;
+  // Timer armings changed since they were last saved to a world file
+  std::set<std::pair<size_t, sqlite3_int64>> _unsavedTimers;
+  std::map<std::string, entityPool, std::less<>> _pools;
+  std::vector<poolChange> _poolChanges;
+  std::unique_ptr<transformHierarchy> _hierarchy;
+  std::unique_ptr<checkpointer> _checkpointer;
+  std::map<std::type_index, sqlite3_stmt *> _queries;
+  std::map<std::string, sqlite3_stmt *> _bulkWrites;
+  std::map<std::string, double> _params;
+  std::map<std::string, variable, std::less<>> _vars;
+  std::map<std::string, std::string> _activity;
+  sqlite3_stmt *_dataVersion;
+  sqlite3_stmt *_sweep;
+  sqlite3_stmt *_sleep;
+  // Statements saving the clock, variables and timers to a world file
+  sqlite3_stmt *_saveClock;
+  sqlite3_stmt *_saveVar;
+  sqlite3_stmt *_saveArmed;
+  sqlite3_stmt *_saveDisarmed;
+  double _deltaT;
+  double _simTime;
+  double _budget;
+  uint64_t _ticks;
+  size_t _sleepAfter;
+  std::map<size_t, size_t> _phases;
+  trig::precision _math;
+  uint64_t _seed;
+  rng _random;
+  rng *_stream;
+  // Set while the authorizer is asked about a DROP statement
+  bool _dropping;
+  // Set when a world file held the clock of an earlier run
+  bool _resumed;
+
+  static void _updateHook(void *self,
+      int op,
+      const char *database,
+      const char *table,
+      sqlite3_int64 rowid);
+  static int _walHook(
+      void *self, sqlite3 *db, const char *database, int frames);
+  static int _authorizer(void *self,
+      int action,
+      const char *arg1,
+      const char *arg2,
+      const char *database,
+      const char *trigger);
+
+  static void _sqlDeltaT(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlSimTime(
+      sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlClamp(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlSin(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlCos(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlSqrt(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlCountDelta(
+      sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlSumDelta(
+      sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlComponentCount(
+      sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlAggregate(
+      sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlHasTag(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlScheduleTimer(
+      sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlCancelTimer(
+      sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlSpawn(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlVar(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlSetVar(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlRandUniform(
+      sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static void _sqlRandInt(
+      sqlite3_context *ctx, int argc, sqlite3_value **argv);
+
+  void bindParameters(sqlite3_stmt *stmt, const std::string &owner);
+  void trackCount(const std::string &component);
+  void createAggregate(
+      const std::string &name, const module::aggregateInfo &info);
+  void recount();
+  void replan();
+  double queryScalar(const std::string &sql);
+  bool reuseTable(const std::string &name);
+  void refuseNative(const std::string &name, const std::string &sql);
+  void resume();
+  void saveWorld(uint64_t ticks);
+  void createBuffer(const std::string &component, const std::string &sql);
+  void advanceBuffers();
+  void watchActivity(const std::string &component, const std::string &awake);
+  void prepareSweep();
+  void sweepActivity();
+  void createView(const std::string &name, const module::viewInfo &info);
+  void createTimer(const std::string &name, const module::timerInfo &info);
+  void restoreTimer(size_t id);
+  void createHierarchy(const std::string &world, trig::precision math);
+  size_t timerId(const std::string &name) const;
+  void fireTimers();
+  void logTimer(const timerChange &change);
+  void undoTimers(size_t mark);
+  void rollbackTimers();
+  void fillPool(entityPool &pool);
+  void resetPooled(entityPool &pool, sqlite3_int64 entity);
+  void undoPools(size_t mark);
+  void runSystem(system &sys, sqlite3_int64 after, sqlite3_int64 until);
+  void runProgram(system &sys);
+  void runSliced(system &sys, std::chrono::steady_clock::time_point start);
+  void refreshViews();
+  sqlite3_stmt *prepareQuery(std::type_index type, std::string (*sql)());
+  void bulkWrite(const std::string &sql,
+      const sqlite3_int64 *entities,
+      size_t count,
+      const std::vector<std::pair<std::string, const double *>> &columns);
 
 public:
   ecs();
+  // A world kept in a database file, which is created if missing and
+  // picked up where it was left otherwise. Commits go to a write-ahead log
+  // without waiting on the disk, reads go through memory-mapped I/O of up
+  // to mmapSize bytes, and a background thread checkpoints the log once it
+  // holds checkpointFrames pages. Loading modules reuses the tables already
+  // in the file. Sim time, variables and timers are saved with every tick
+  // and when the world is destroyed; native components live in memory
+  // only, so neither a module nor the file may declare any. Program setup
+  // statements run again, so should say IF NOT EXISTS.
+  explicit ecs(const std::string &path,
+      sqlite3_int64 mmapSize = sqlite3_int64(1) << 28,
+      int checkpointFrames = 1000);
   ~ecs();
+
+  operator sqlite3 *()
+  {
+    return _db;
+  }
+
+  // Reseeds the world stream and every system's stream. Each system draws
+  // from its own stream while it runs, so results do not depend on what
+  // other systems consumed.
+  void seed(uint64_t seed);
+
+  // The stream rand_uniform() and rand_int() draw from at this moment: the
+  // running system's during a tick, the world stream otherwise.
+  rng &random()
+  {
+    return *_stream;
+  }
+
+  // Milliseconds a tick may take before sliced systems stop for the tick
+  // and resume where they left off on the next; 0 for no budget.
+  double budget() const
+  {
+    return _budget;
+  }
+
+  void setBudget(double milliseconds)
+  {
+    _budget = milliseconds;
+  }
+
+  // Seconds of simulation time per timer wheel slot. Timers fire on the
+  // first tick at or after their due time, never before it.
+  static constexpr double timerResolution = 1.0 / 64;
+
+  // Arm a module timer for an entity, replacing any earlier arming, to fire
+  // seconds from now; schedule_timer() and cancel_timer() in SQL.
+  void scheduleTimer(
+      const std::string &name, sqlite3_int64 entity, double seconds);
+  void cancelTimer(const std::string &name, sqlite3_int64 entity);
+
+  // Take an unused entity from a pool, tagging it as in use, or return -1
+  // when every one is in use; spawn(name) in SQL. Its components keep the
+  // values they had when it was last released. Releasing it only clears
+  // the tag, which SQL can also do by deleting it from the pool's table.
+  sqlite3_int64 spawn(const std::string &pool);
+  void despawn(const std::string &pool, sqlite3_int64 entity);
+
+  // Module params are bound into system and render statements as $name.
+  // Changing one rebinds it in place; nothing is prepared again.
+  double param(const std::string &name) const;
+  void setParam(const std::string &name, double value);
+
+  // Global variables, read in SQL with var('name') and written with
+  // set_var('name', value), replacing lookups in a key/value table.
+  const variable &var(const std::string &name) const;
+  void setVar(const std::string &name, variable value);
+
+  // Row counts and declared aggregates, kept current on every write so that
+  // reading them never scans a table.
+  sqlite3_int64 count(const std::string &component) const;
+  double aggregate(const std::string &name) const;
+
+  const columnStore *getColumnStore(const std::string &component) const;
+  const tagSet *getTagSet(const std::string &component) const;
+  const sparseSet *getSparseSet(const std::string &component) const;
+  // The events appended to a channel this tick, which are cleared when the
+  // tick commits; events appended between ticks go to the next one.
+  eventChannel *getEventChannel(const std::string &name);
+  uint64_t changeCount(const std::string &component) const;
+  const renderData &getRender(const std::string &render);
+
+  // Typed rows for every entity having all of Ts, e.g.
+  //   for (auto &[entity, loc, mob] : state.query<location, mobile>())
+  template <typename... Ts>
+  typedQuery<Ts...> query()
+  {
+    auto found = _queries.find(typeid(typedQuery<Ts...>));
+    if (found != _queries.end()) {
+      return typedQuery<Ts...>(found->second);
+    }
+    return typedQuery<Ts...>(
+        prepareQuery(typeid(typedQuery<Ts...>), &typedQuery<Ts...>::sql));
+  }
+
+  // Write count rows held in contiguous arrays, one per named column, with
+  // a single statement. NaN values are written as NULL.
+  void bulkInsert(const std::string &component,
+      const sqlite3_int64 *entities,
+      size_t count,
+      const std::vector<std::pair<std::string, const double *>> &columns);
+  void bulkUpdate(const std::string &component,
+      const sqlite3_int64 *entities,
+      size_t count,
+      const std::vector<std::pair<std::string, const double *>> &columns);
+
+  void execute(const std::string &sql);
+  void loadModule(module &mod);
+  void tick(double deltaT);
 };
 
 } // namespace nebula
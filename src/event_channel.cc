@@ -0,0 +1,559 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "event_channel.h"
+
+// Exception includes
+#include "exceptions.h"
+
+#include <algorithm>
+
+// Unit Testing includes
+#include "doctest.h"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+SCENARIO("class eventChannel")
+{
+  GIVEN("a database with an event_channel virtual table")
+  {
+    sqlite3 *db;
+    sqlite3_open(":memory:", &db);
+    std::map<std::string, std::unique_ptr<nebula::eventChannel>> channels;
+    nebula::eventChannel::registerModule(db, channels);
+    REQUIRE(sqlite3_exec(db,
+                "CREATE VIRTUAL TABLE hit USING event_channel(4, entity "
+                "INTEGER, damage REAL);"
+                "INSERT INTO hit VALUES (1, 0.5), ('2', 1);",
+                nullptr,
+                nullptr,
+                nullptr)
+            == SQLITE_OK);
+    REQUIRE(channels.count("hit") == 1);
+    auto &channel = *channels["hit"];
+    WHEN("events are appended through SQL")
+    {
+      THEN("C++ reads them as typed arrays")
+      {
+        REQUIRE(channel.size() == 2);
+        REQUIRE(channel.integer("entity")[1] == 2);
+        REQUIRE(channel.real("damage")[0] == 0.5);
+        REQUIRE(channel.real("damage")[1] == 1.0);
+      }
+      THEN("they cannot be changed, removed or given mistyped values")
+      {
+        for (auto sql : {"DELETE FROM hit;",
+                 "UPDATE hit SET damage = 0;",
+                 "INSERT INTO hit VALUES (1.5, 0);",
+                 "INSERT INTO hit VALUES (1, 'x');",
+                 "INSERT INTO hit (entity) VALUES (1);"})
+        {
+          REQUIRE(sqlite3_exec(db, sql, nullptr, nullptr, nullptr)
+                  != SQLITE_OK);
+        }
+        REQUIRE(channel.size() == 2);
+      }
+    }
+    WHEN("more events are appended than the channel holds")
+    {
+      REQUIRE(sqlite3_exec(db,
+                  "INSERT INTO hit VALUES (3, 0), (4, 0), (5, 0);",
+                  nullptr,
+                  nullptr,
+                  nullptr)
+              == SQLITE_OK);
+      THEN("the oldest are overwritten and the rest read in order")
+      {
+        REQUIRE(channel.size() == 4);
+        REQUIRE(channel.dropped() == 1);
+        const sqlite3_int64 *entity = channel.integer("entity");
+        REQUIRE(entity[0] == 2);
+        REQUIRE(entity[3] == 5);
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db,
+            "SELECT group_concat(entity) FROM hit();",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(std::string(reinterpret_cast<const char *>(
+                    sqlite3_column_text(stmt, 0)))
+                == "2,3,4,5");
+        sqlite3_finalize(stmt);
+      }
+    }
+    WHEN("a transaction appending events rolls back")
+    {
+      REQUIRE(sqlite3_exec(db,
+                  "BEGIN; INSERT INTO hit VALUES (3, 0); SAVEPOINT a; "
+                  "INSERT INTO hit VALUES (4, 0); ROLLBACK TO a;",
+                  nullptr,
+                  nullptr,
+                  nullptr)
+              == SQLITE_OK);
+      REQUIRE(channel.size() == 3);
+      sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+      THEN("the channel is back to its events before the transaction")
+      {
+        REQUIRE(channel.size() == 2);
+        REQUIRE(channel.integer("entity")[1] == 2);
+      }
+    }
+    WHEN("the channel is cleared")
+    {
+      channel.clear();
+      channel.set(channel.emit(), 0, sqlite3_int64(9));
+      THEN("only events appended since remain")
+      {
+        REQUIRE(channel.size() == 1);
+        REQUIRE(channel.integer("entity")[0] == 9);
+        REQUIRE(channel.real("damage")[0] == 0.0);
+      }
+    }
+    sqlite3_close(db);
+  }
+}
+#endif
+
+namespace nebula {
+
+namespace {
+
+struct channelTable {
+  sqlite3_vtab _base;
+  eventChannel *_channel;
+  std::map<std::string, std::unique_ptr<eventChannel>> *_channels;
+  std::string _name;
+  // Positions to return to when the transaction or a savepoint rolls back
+  eventChannel::mark _begin;
+  std::vector<eventChannel::mark> _savepoints;
+};
+
+struct channelCursor {
+  sqlite3_vtab_cursor _base;
+  size_t _index;
+};
+
+std::string declaration(const eventChannel &channel)
+{
+  std::string sql;
+  for (const auto &col : channel.columns()) {
+    sql += sql.empty() ? "CREATE TABLE x(" : ", ";
+    sql += col._name;
+    sql += col._type == columnStore::type::integer ? " INTEGER" : " REAL";
+  }
+  return sql + ");";
+}
+
+int channelConnect(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err,
+    bool create)
+{
+  auto channels = static_cast<
+      std::map<std::string, std::unique_ptr<eventChannel>> *>(aux);
+  std::string name = argv[2];
+  try {
+    if (create) {
+      if (argc < 5) {
+        throw nebulaException("event_channel needs a capacity and columns");
+      }
+      long long capacity = std::stoll(argv[3]);
+      if (capacity < 1) {
+        throw nebulaException("event_channel capacity must be positive");
+      }
+      std::vector<std::pair<std::string, columnStore::type>> columns;
+      for (int i = 4; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto split      = arg.find_first_of(" \t");
+        if (split == std::string::npos) {
+          throw nebulaException("Column without a type: " + arg);
+        }
+        auto start = arg.find_first_not_of(" \t", split);
+        auto dtype = columnStore::parseType(arg.substr(start));
+        if (dtype != columnStore::type::integer
+            && dtype != columnStore::type::real)
+        {
+          throw nebulaException(
+              "event_channel columns are INTEGER or REAL: " + arg);
+        }
+        columns.emplace_back(arg.substr(0, split), dtype);
+      }
+      (*channels)[name] = std::make_unique<eventChannel>(
+          columns, static_cast<size_t>(capacity));
+    } else if (channels->count(name) == 0) {
+      *err = sqlite3_mprintf("no event channel named %s", name.c_str());
+      return SQLITE_ERROR;
+    }
+    auto table       = new channelTable();
+    table->_channel  = (*channels)[name].get();
+    table->_channels = channels;
+    table->_name     = name;
+    table->_begin    = table->_channel->position();
+    int res = sqlite3_declare_vtab(db, declaration(*table->_channel).c_str());
+    if (res != SQLITE_OK) {
+      delete table;
+      return res;
+    }
+    *vtab = &table->_base;
+  } catch (std::exception &e) {
+    *err = sqlite3_mprintf("%s", e.what());
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+int channelCreate(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err)
+{
+  return channelConnect(db, aux, argc, argv, vtab, err, true);
+}
+
+int channelReconnect(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err)
+{
+  return channelConnect(db, aux, argc, argv, vtab, err, false);
+}
+
+int channelDisconnect(sqlite3_vtab *vtab)
+{
+  delete reinterpret_cast<channelTable *>(vtab);
+  return SQLITE_OK;
+}
+
+int channelDestroy(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<channelTable *>(vtab);
+  table->_channels->erase(table->_name);
+  delete table;
+  return SQLITE_OK;
+}
+
+// Events are only ever read in full, oldest first
+int channelBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+  auto table          = reinterpret_cast<channelTable *>(vtab);
+  double rows         = table->_channel->size() + 1;
+  info->estimatedRows = static_cast<sqlite3_int64>(rows);
+  info->estimatedCost = rows;
+  return SQLITE_OK;
+}
+
+int channelOpen(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+  auto cur = new channelCursor();
+  *cursor  = &cur->_base;
+  return SQLITE_OK;
+}
+
+int channelClose(sqlite3_vtab_cursor *cursor)
+{
+  delete reinterpret_cast<channelCursor *>(cursor);
+  return SQLITE_OK;
+}
+
+int channelFilter(sqlite3_vtab_cursor *cursor,
+    int plan,
+    const char *idxStr,
+    int argc,
+    sqlite3_value **argv)
+{
+  reinterpret_cast<channelCursor *>(cursor)->_index = 0;
+  return SQLITE_OK;
+}
+
+int channelNext(sqlite3_vtab_cursor *cursor)
+{
+  reinterpret_cast<channelCursor *>(cursor)->_index++;
+  return SQLITE_OK;
+}
+
+int channelEof(sqlite3_vtab_cursor *cursor)
+{
+  auto cur = reinterpret_cast<channelCursor *>(cursor);
+  return cur->_index
+      >= reinterpret_cast<channelTable *>(cursor->pVtab)->_channel->size();
+}
+
+int channelColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int col)
+{
+  auto cur     = reinterpret_cast<channelCursor *>(cursor);
+  auto channel = reinterpret_cast<channelTable *>(cursor->pVtab)->_channel;
+  channel->result(channel->slot(cur->_index), col, ctx);
+  return SQLITE_OK;
+}
+
+int channelRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+  *rowid = reinterpret_cast<channelCursor *>(cursor)->_index;
+  return SQLITE_OK;
+}
+
+// Only inserts are accepted. Values are converted the way a STRICT table
+// would, and the event is appended once all of them are known to fit.
+int channelUpdate(
+    sqlite3_vtab *vtab, int argc, sqlite3_value **argv, sqlite3_int64 *rowid)
+{
+  auto table   = reinterpret_cast<channelTable *>(vtab);
+  auto channel = table->_channel;
+  sqlite3_free(vtab->zErrMsg);
+  vtab->zErrMsg = nullptr;
+  if (argc == 1 || sqlite3_value_type(argv[0]) != SQLITE_NULL) {
+    vtab->zErrMsg = sqlite3_mprintf(
+        "event channel %s is append-only", table->_name.c_str());
+    return SQLITE_READONLY;
+  }
+  const auto &columns = channel->columns();
+  for (size_t c = 0; c < columns.size(); ++c) {
+    sqlite3_value *value = argv[2 + c];
+    int type             = sqlite3_value_numeric_type(value);
+    if (type == SQLITE_NULL) {
+      vtab->zErrMsg = sqlite3_mprintf("NOT NULL constraint failed: %s.%s",
+          table->_name.c_str(),
+          columns[c]._name.c_str());
+      return SQLITE_CONSTRAINT;
+    }
+    bool integral = type == SQLITE_INTEGER
+                 || (type == SQLITE_FLOAT
+                     && sqlite3_value_double(value)
+                            == sqlite3_value_int64(value));
+    if ((type != SQLITE_INTEGER && type != SQLITE_FLOAT)
+        || (columns[c]._type == columnStore::type::integer && !integral))
+    {
+      vtab->zErrMsg = sqlite3_mprintf("cannot store %s value in %s.%s",
+          type == SQLITE_FLOAT ? "REAL" : "TEXT",
+          table->_name.c_str(),
+          columns[c]._name.c_str());
+      return SQLITE_MISMATCH;
+    }
+  }
+  size_t slot = channel->emit();
+  for (size_t c = 0; c < columns.size(); ++c) {
+    if (columns[c]._type == columnStore::type::integer) {
+      channel->set(slot, c, sqlite3_value_int64(argv[2 + c]));
+    } else {
+      channel->set(slot, c, sqlite3_value_double(argv[2 + c]));
+    }
+  }
+  *rowid = static_cast<sqlite3_int64>(channel->size() - 1);
+  return SQLITE_OK;
+}
+
+// SQLite calls xBegin when a transaction first writes to the channel, then
+// xSavepoint for the innermost savepoint open at the time. Outer ones are
+// older than any event the transaction appended, so they share that state.
+int channelBegin(sqlite3_vtab *vtab)
+{
+  auto table    = reinterpret_cast<channelTable *>(vtab);
+  table->_begin = table->_channel->position();
+  table->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int channelCommit(sqlite3_vtab *vtab)
+{
+  reinterpret_cast<channelTable *>(vtab)->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int channelRollback(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<channelTable *>(vtab);
+  table->_channel->restore(table->_begin);
+  table->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int channelSavepoint(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<channelTable *>(vtab);
+  auto here  = table->_channel->position();
+  table->_savepoints.resize(savepoint + 1, here);
+  table->_savepoints[savepoint] = here;
+  return SQLITE_OK;
+}
+
+int channelRelease(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<channelTable *>(vtab);
+  if (static_cast<size_t>(savepoint) < table->_savepoints.size()) {
+    table->_savepoints.resize(savepoint);
+  }
+  return SQLITE_OK;
+}
+
+int channelRollbackTo(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<channelTable *>(vtab);
+  if (static_cast<size_t>(savepoint) < table->_savepoints.size()) {
+    table->_channel->restore(table->_savepoints[savepoint]);
+    table->_savepoints.resize(savepoint + 1);
+  }
+  return SQLITE_OK;
+}
+
+sqlite3_module channelModule = {
+    2,                 // iVersion
+    channelCreate,     // xCreate
+    channelReconnect,  // xConnect
+    channelBestIndex,  // xBestIndex
+    channelDisconnect, // xDisconnect
+    channelDestroy,    // xDestroy
+    channelOpen,       // xOpen
+    channelClose,      // xClose
+    channelFilter,     // xFilter
+    channelNext,       // xNext
+    channelEof,        // xEof
+    channelColumn,     // xColumn
+    channelRowid,      // xRowid
+    channelUpdate,     // xUpdate
+    channelBegin,      // xBegin
+    nullptr,           // xSync
+    channelCommit,     // xCommit
+    channelRollback,   // xRollback
+    nullptr,           // xFindFunction
+    nullptr,           // xRename
+    channelSavepoint,  // xSavepoint
+    channelRelease,    // xRelease
+    channelRollbackTo, // xRollbackTo
+};
+
+} // namespace
+
+eventChannel::eventChannel(
+    const std::vector<std::pair<std::string, columnStore::type>> &columns,
+    size_t capacity)
+    : _capacity(capacity), _first(0), _next(0), _start(0), _high(0),
+      _dropped(0)
+{
+  for (const auto &[name, dtype] : columns) {
+    column col;
+    col._name = name;
+    col._type = dtype;
+    if (dtype == columnStore::type::integer) {
+      col._integer.resize(capacity);
+    } else {
+      col._real.resize(capacity);
+    }
+    _columns.emplace_back(std::move(col));
+  }
+}
+
+void eventChannel::registerModule(
+    sqlite3 *db, std::map<std::string, std::unique_ptr<eventChannel>> &channels)
+{
+  if (sqlite3_create_module_v2(
+          db, "event_channel", &channelModule, &channels, nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(db);
+  }
+}
+
+size_t eventChannel::emit()
+{
+  if (size() == _capacity) {
+    ++_first;
+    ++_dropped;
+  }
+  size_t slot = this->slot(size());
+  _high        = std::max(_high, ++_next);
+  for (auto &col : _columns) {
+    if (col._type == columnStore::type::integer) {
+      col._integer[slot] = 0;
+    } else {
+      col._real[slot] = 0.0;
+    }
+  }
+  return slot;
+}
+
+void eventChannel::set(size_t slot, size_t col, double value)
+{
+  _columns[col]._real[slot] = value;
+}
+
+void eventChannel::set(size_t slot, size_t col, sqlite3_int64 value)
+{
+  _columns[col]._integer[slot] = value;
+}
+
+// Clearing starts the ring over at slot 0, so the events stay contiguous
+// and this only has work to do after the channel overflowed.
+void eventChannel::linearize()
+{
+  size_t head = slot(0);
+  if (head + size() <= _capacity) {
+    return;
+  }
+  for (auto &col : _columns) {
+    if (col._type == columnStore::type::integer) {
+      std::rotate(col._integer.begin(),
+          col._integer.begin() + head,
+          col._integer.end());
+    } else {
+      std::rotate(
+          col._real.begin(), col._real.begin() + head, col._real.end());
+    }
+  }
+  _start += head;
+}
+
+const double *eventChannel::real(const std::string &name)
+{
+  linearize();
+  for (const auto &col : _columns) {
+    if (col._name == name && col._type == columnStore::type::real) {
+      return col._real.data() + slot(0);
+    }
+  }
+  throw nebulaException("No REAL event column " + name);
+}
+
+const sqlite3_int64 *eventChannel::integer(const std::string &name)
+{
+  linearize();
+  for (const auto &col : _columns) {
+    if (col._name == name && col._type == columnStore::type::integer) {
+      return col._integer.data() + slot(0);
+    }
+  }
+  throw nebulaException("No INTEGER event column " + name);
+}
+
+void eventChannel::result(size_t slot, size_t col, sqlite3_context *ctx) const
+{
+  const auto &column = _columns[col];
+  if (column._type == columnStore::type::integer) {
+    sqlite3_result_int64(ctx, column._integer[slot]);
+  } else {
+    sqlite3_result_double(ctx, column._real[slot]);
+  }
+}
+
+void eventChannel::clear()
+{
+  _first = _next;
+  _start = _next;
+}
+
+// Slots of events from before m were reused once the channel wrapped past
+// them, and those events are gone.
+void eventChannel::restore(const mark &m)
+{
+  uint64_t kept = _high > _capacity ? _high - _capacity : 0;
+  _first        = std::min(std::max(m._first, kept), m._next);
+  _next         = m._next;
+}
+
+} // namespace nebula
@@ -0,0 +1,117 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_EVENT_CHANNEL_H
+#define NEBULA_EVENT_CHANNEL_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "column_store.h"
+
+extern "C" {
+#include "sqlite3.h"
+}
+
+namespace nebula {
+
+// A fixed-capacity ring of typed events, exposed to SQL through the
+// event_channel virtual table module. Events are only appended, and the
+// owner clears the channel once per tick, so passing them between systems
+// costs a store per column instead of B-tree inserts and deletes. A full
+// channel overwrites its oldest event.
+class eventChannel {
+public:
+  struct column {
+    std::string _name;
+    columnStore::type _type;
+    std::vector<double> _real;
+    std::vector<sqlite3_int64> _integer;
+  };
+
+  // The events present at some point, as sequence numbers of every event
+  // ever appended; see restore().
+  struct mark {
+    uint64_t _first;
+    uint64_t _next;
+  };
+
+private:
+  std::vector<column> _columns;
+  size_t _capacity;
+  // Sequence numbers of the oldest event, of the next one appended and of
+  // the one stored in slot 0 of the ring, modulo the capacity. _high is the
+  // highest _next has been, which tells restore() whose slots were reused.
+  uint64_t _first;
+  uint64_t _next;
+  uint64_t _start;
+  uint64_t _high;
+  uint64_t _dropped;
+
+  // Rotates the columns so the oldest event is in slot 0.
+  void linearize();
+
+public:
+  eventChannel(
+      const std::vector<std::pair<std::string, columnStore::type>> &columns,
+      size_t capacity);
+
+  static void registerModule(sqlite3 *db,
+      std::map<std::string, std::unique_ptr<eventChannel>> &channels);
+
+  size_t size() const
+  {
+    return static_cast<size_t>(_next - _first);
+  }
+
+  size_t capacity() const
+  {
+    return _capacity;
+  }
+
+  // Events overwritten before they were cleared
+  uint64_t dropped() const
+  {
+    return _dropped;
+  }
+
+  const std::vector<column> &columns() const
+  {
+    return _columns;
+  }
+
+  // The slot holding the index-th oldest event
+  size_t slot(size_t index) const
+  {
+    return static_cast<size_t>(
+        ((_first + index) % _capacity + _capacity - _start % _capacity)
+        % _capacity);
+  }
+
+  // Appends an event with every column zero and returns its slot.
+  size_t emit();
+  void set(size_t slot, size_t col, double value);
+  void set(size_t slot, size_t col, sqlite3_int64 value);
+  // A column's events as one contiguous array of size() values, oldest
+  // first; the pointers stay valid until the next emit() or clear().
+  const double *real(const std::string &name);
+  const sqlite3_int64 *integer(const std::string &name);
+  void result(size_t slot, size_t col, sqlite3_context *ctx) const;
+  void clear();
+
+  mark position() const
+  {
+    return {_first, _next};
+  }
+
+  // Goes back to the events present at m, such as when a transaction that
+  // appended to the channel rolls back. Events overwritten since are lost.
+  void restore(const mark &m);
+};
+
+} // namespace nebula
+
+#endif // NEBULA_EVENT_CHANNEL_H
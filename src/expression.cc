@@ -0,0 +1,660 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "expression.h"
+
+// Exception includes
+#include "exceptions.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <limits>
+
+// Unit Testing includes
+#include "doctest.h"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+extern "C" {
+#include "sqlite3.h"
+}
+
+SCENARIO("class expression")
+{
+  GIVEN("the set expression of an update system")
+  {
+    std::vector<std::string> columns;
+    nebula::expression expr(
+        "old.x - sin(old.theta) * mobile.vel * deltaT()", columns);
+    THEN("its column references are collected in order of appearance")
+    {
+      REQUIRE(columns.size() == 3);
+      REQUIRE(columns[0] == "old.x");
+      REQUIRE(columns[1] == "old.theta");
+      REQUIRE(columns[2] == "mobile.vel");
+    }
+    WHEN("it is evaluated over a batch")
+    {
+      std::vector<double> x(nebula::expression::batchSize);
+      std::vector<double> theta(nebula::expression::batchSize);
+      std::vector<double> vel(nebula::expression::batchSize);
+      std::vector<double> out(nebula::expression::batchSize);
+      for (size_t i = 0; i < x.size(); ++i) {
+        x[i]     = i;
+        theta[i] = i * 0.01;
+        vel[i]   = 2.0;
+      }
+      const double *inputs[] = {x.data(), theta.data(), vel.data()};
+      expr.evaluate(inputs, x.size(), 0.5, out.data());
+      THEN("every value matches the scalar computation")
+      {
+        for (size_t i = 0; i < x.size(); ++i) {
+          REQUIRE(out[i] == x[i] - std::sin(theta[i]) * vel[i] * 0.5);
+        }
+      }
+    }
+  }
+  GIVEN("a require clause")
+  {
+    std::vector<std::string> columns;
+    nebula::expression expr("accel != 0.0 AND vel IS NOT NULL", columns);
+    std::vector<double> accel = {0.0, 1.0, 1.0};
+    std::vector<double> vel
+        = {1.0, 1.0, std::numeric_limits<double>::quiet_NaN()};
+    std::vector<double> out(3);
+    const double *inputs[] = {accel.data(), vel.data()};
+    expr.evaluate(inputs, 3, 0.0, out.data());
+    THEN("it evaluates to a 0/1 mask")
+    {
+      REQUIRE(out[0] == 0.0);
+      REQUIRE(out[1] == 1.0);
+      REQUIRE(out[2] == 0.0);
+    }
+  }
+  GIVEN("clamp with operator precedence")
+  {
+    std::vector<std::string> columns;
+    nebula::expression expr("clamp(vel + accel * 2, 0.0, max_vel)", columns);
+    std::vector<double> vel = {1.0, 1.0, 1.0}, accel = {-1.0, 1.0, 10.0},
+                        maxVel = {5.0, 5.0, 5.0}, out(3);
+    const double *inputs[] = {vel.data(), accel.data(), maxVel.data()};
+    expr.evaluate(inputs, 3, 0.0, out.data());
+    THEN("the result is clamped")
+    {
+      REQUIRE(out[0] == 0.0);
+      REQUIRE(out[1] == 3.0);
+      REQUIRE(out[2] == 5.0);
+    }
+  }
+  GIVEN("unsupported syntax")
+  {
+    std::vector<std::string> columns;
+    THEN("compiling it throws")
+    {
+      REQUIRE_THROWS(nebula::expression("random()", columns));
+      REQUIRE_THROWS(nebula::expression("x IN (SELECT 1)", columns));
+      REQUIRE_THROWS(nebula::expression("(x + 1", columns));
+    }
+    THEN("dividing values that may both be INTEGER throws")
+    {
+      REQUIRE_THROWS(nebula::expression("x / 2", columns));
+      REQUIRE_THROWS(nebula::expression("7 / 2", columns));
+      REQUIRE_NOTHROW(nebula::expression("x / 2.0", columns));
+      REQUIRE_NOTHROW(nebula::expression("x * deltaT() / y", columns));
+      REQUIRE_NOTHROW(nebula::expression("x / $scale", columns));
+    }
+  }
+  GIVEN("expressions over NULL")
+  {
+    std::vector<std::string> columns;
+    nebula::expression negated("NOT (x > 1)", columns);
+    nebula::expression either("x > 1 OR y > 1", columns);
+    nebula::expression both("x > 1 AND y > 1", columns);
+    nebula::expression smaller("min(x, y)", columns);
+    nebula::expression inverse("1.0 / y", columns);
+    double nan             = std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> x  = {nan, nan, nan};
+    std::vector<double> y  = {0.0, 2.0, nan};
+    const double *inputs[] = {x.data(), y.data()};
+    std::vector<double> out(3);
+    THEN("they follow SQL's three-valued logic")
+    {
+      negated.evaluate(inputs, 3, 0.0, out.data());
+      REQUIRE(std::isnan(out[0]));
+      either.evaluate(inputs, 3, 0.0, out.data());
+      REQUIRE(std::isnan(out[0]));
+      REQUIRE(out[1] == 1.0);
+      REQUIRE(std::isnan(out[2]));
+      both.evaluate(inputs, 3, 0.0, out.data());
+      REQUIRE(out[0] == 0.0);
+      REQUIRE(std::isnan(out[1]));
+      smaller.evaluate(inputs, 3, 0.0, out.data());
+      REQUIRE(std::isnan(out[0]));
+    }
+    THEN("dividing by zero gives NULL, as SQLite does")
+    {
+      sqlite3 *db;
+      sqlite3_stmt *stmt;
+      sqlite3_open(":memory:", &db);
+      sqlite3_prepare_v2(db, "SELECT 1.0 / 0;", -1, &stmt, nullptr);
+      REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+      REQUIRE(sqlite3_column_type(stmt, 0) == SQLITE_NULL);
+      sqlite3_finalize(stmt);
+      sqlite3_close(db);
+      inverse.evaluate(inputs, 3, 0.0, out.data());
+      REQUIRE(std::isnan(out[0]));
+      REQUIRE(out[1] == 0.5);
+      REQUIRE(std::isnan(out[2]));
+    }
+  }
+}
+#endif
+
+namespace nebula {
+
+// Recursive descent parser producing postfix bytecode. Precedence follows
+// SQL: OR, AND, NOT, comparison, additive, multiplicative, unary.
+class expressionParser {
+private:
+  const std::string &_source;
+  size_t _pos;
+  std::vector<std::string> &_columns;
+  expression &_expr;
+  size_t _depth;
+  // Whether each stack value is known to be REAL, and each constant; SQL
+  // divides two INTEGER values as integers, which doubles cannot mirror.
+  // Column values may be either, so their type is not known.
+  std::vector<bool> _real;
+  std::vector<bool> _realConstants;
+
+  void fail(const std::string &reason)
+  {
+    throw nebulaException(
+        "Cannot compile expression '" + _source + "': " + reason);
+  }
+
+  void skipSpace()
+  {
+    while (_pos < _source.size() && std::isspace(_source[_pos])) {
+      ++_pos;
+    }
+  }
+
+  bool matchSymbol(const std::string &symbol)
+  {
+    skipSpace();
+    if (_source.compare(_pos, symbol.size(), symbol) == 0) {
+      _pos += symbol.size();
+      return true;
+    }
+    return false;
+  }
+
+  bool matchKeyword(const std::string &keyword)
+  {
+    skipSpace();
+    size_t end = _pos + keyword.size();
+    if (end > _source.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < keyword.size(); ++i) {
+      if (std::toupper(_source[_pos + i]) != keyword[i]) {
+        return false;
+      }
+    }
+    if (end < _source.size()
+        && (std::isalnum(_source[end]) || _source[end] == '_'))
+    {
+      return false;
+    }
+    _pos = end;
+    return true;
+  }
+
+  void expect(const std::string &symbol)
+  {
+    if (!matchSymbol(symbol)) {
+      fail("expected '" + symbol + "'");
+    }
+  }
+
+  void emit(expression::opcode op, size_t operand, int stackChange)
+  {
+    using opcode = expression::opcode;
+    bool real    = false;
+    switch (op) {
+    case opcode::column:
+      // Parameters are always bound as REAL
+      real = _columns[operand][0] == '$';
+      break;
+    case opcode::constant:
+      real = _realConstants[operand];
+      break;
+    case opcode::deltaT:
+    case opcode::sin:
+    case opcode::cos:
+    case opcode::sqrt:
+    case opcode::clamp:
+      real = true;
+      break;
+    case opcode::negate:
+    case opcode::abs:
+      real = _real.back();
+      break;
+    case opcode::add:
+    case opcode::subtract:
+    case opcode::multiply:
+      real = _real[_real.size() - 2] || _real.back();
+      break;
+    case opcode::divide:
+      if (!_real[_real.size() - 2] && !_real.back()) {
+        fail("division needs a REAL operand, such as 2.0");
+      }
+      real = true;
+      break;
+    case opcode::min:
+    case opcode::max:
+      real = _real[_real.size() - 2] && _real.back();
+      break;
+    default:
+      break;
+    }
+    _real.resize(_real.size() + stackChange);
+    _real.back() = real;
+    _expr._code.push_back({op, operand});
+    _depth += stackChange;
+    _expr._stackDepth = std::max(_expr._stackDepth, _depth);
+  }
+
+  void parseOr()
+  {
+    parseAnd();
+    while (matchKeyword("OR")) {
+      parseAnd();
+      emit(expression::opcode::logicalOr, 0, -1);
+    }
+  }
+
+  void parseAnd()
+  {
+    parseNot();
+    while (matchKeyword("AND")) {
+      parseNot();
+      emit(expression::opcode::logicalAnd, 0, -1);
+    }
+  }
+
+  void parseNot()
+  {
+    if (matchKeyword("NOT")) {
+      parseNot();
+      emit(expression::opcode::logicalNot, 0, 0);
+      return;
+    }
+    parseComparison();
+  }
+
+  void parseComparison()
+  {
+    parseAdditive();
+    if (matchKeyword("IS")) {
+      bool negated = matchKeyword("NOT");
+      if (!matchKeyword("NULL")) {
+        fail("only IS [NOT] NULL is supported");
+      }
+      emit(negated ? expression::opcode::notNull : expression::opcode::isNull,
+          0,
+          0);
+      return;
+    }
+    expression::opcode op;
+    if (matchSymbol("<=")) {
+      op = expression::opcode::lessEqual;
+    } else if (matchSymbol(">=")) {
+      op = expression::opcode::greaterEqual;
+    } else if (matchSymbol("!=") || matchSymbol("<>")) {
+      op = expression::opcode::notEqual;
+    } else if (matchSymbol("==") || matchSymbol("=")) {
+      op = expression::opcode::equal;
+    } else if (matchSymbol("<")) {
+      op = expression::opcode::less;
+    } else if (matchSymbol(">")) {
+      op = expression::opcode::greater;
+    } else {
+      return;
+    }
+    parseAdditive();
+    emit(op, 0, -1);
+  }
+
+  void parseAdditive()
+  {
+    parseMultiplicative();
+    for (;;) {
+      if (matchSymbol("+")) {
+        parseMultiplicative();
+        emit(expression::opcode::add, 0, -1);
+      } else if (matchSymbol("-")) {
+        parseMultiplicative();
+        emit(expression::opcode::subtract, 0, -1);
+      } else {
+        return;
+      }
+    }
+  }
+
+  void parseMultiplicative()
+  {
+    parseUnary();
+    for (;;) {
+      if (matchSymbol("*")) {
+        parseUnary();
+        emit(expression::opcode::multiply, 0, -1);
+      } else if (matchSymbol("/")) {
+        parseUnary();
+        emit(expression::opcode::divide, 0, -1);
+      } else {
+        return;
+      }
+    }
+  }
+
+  void parseUnary()
+  {
+    if (matchSymbol("-")) {
+      parseUnary();
+      emit(expression::opcode::negate, 0, 0);
+      return;
+    }
+    if (matchSymbol("+")) {
+      parseUnary();
+      return;
+    }
+    parsePrimary();
+  }
+
+  void parseArguments(size_t count)
+  {
+    expect("(");
+    for (size_t i = 0; i < count; ++i) {
+      if (i > 0) {
+        expect(",");
+      }
+      parseOr();
+    }
+    expect(")");
+  }
+
+  void parseFunction(const std::string &name)
+  {
+    std::string lower;
+    for (auto c : name) {
+      lower += std::tolower(c);
+    }
+    if (lower == "deltat") {
+      parseArguments(0);
+      emit(expression::opcode::deltaT, 0, 1);
+    } else if (lower == "sin" || lower == "cos" || lower == "abs"
+               || lower == "sqrt")
+    {
+      parseArguments(1);
+      emit(lower == "sin"   ? expression::opcode::sin
+           : lower == "cos" ? expression::opcode::cos
+           : lower == "abs" ? expression::opcode::abs
+                            : expression::opcode::sqrt,
+          0,
+          0);
+    } else if (lower == "min" || lower == "max") {
+      parseArguments(2);
+      emit(lower == "min" ? expression::opcode::min : expression::opcode::max,
+          0,
+          -1);
+    } else if (lower == "clamp") {
+      parseArguments(3);
+      emit(expression::opcode::clamp, 0, -2);
+    } else {
+      fail("unsupported function " + name + "()");
+    }
+  }
+
+  void parsePrimary()
+  {
+    skipSpace();
+    if (_pos >= _source.size()) {
+      fail("unexpected end of expression");
+    }
+    char c = _source[_pos];
+    if (matchSymbol("(")) {
+      parseOr();
+      expect(")");
+      return;
+    }
+    if (std::isdigit(c) || c == '.') {
+      size_t length;
+      double value = std::stod(_source.substr(_pos), &length);
+      _realConstants.push_back(
+          _source.substr(_pos, length).find_first_of(".eE")
+          != std::string::npos);
+      _pos += length;
+      _expr._constants.push_back(value);
+      emit(expression::opcode::constant, _expr._constants.size() - 1, 1);
+      return;
+    }
+    // $name parameters are bound by the caller, so they read like columns.
+    if (std::isalpha(c) || c == '_' || c == '$') {
+      size_t start = _pos++;
+      while (_pos < _source.size()
+             && (std::isalnum(_source[_pos]) || _source[_pos] == '_'
+                 || _source[_pos] == '.'))
+      {
+        ++_pos;
+      }
+      std::string name = _source.substr(start, _pos - start);
+      skipSpace();
+      if (_pos < _source.size() && _source[_pos] == '(') {
+        parseFunction(name);
+        return;
+      }
+      std::string upper;
+      for (auto ch : name) {
+        upper += std::toupper(ch);
+      }
+      if (upper == "NULL") {
+        // Any division by or of NULL is NULL
+        _realConstants.push_back(true);
+        _expr._constants.push_back(std::numeric_limits<double>::quiet_NaN());
+        emit(expression::opcode::constant, _expr._constants.size() - 1, 1);
+        return;
+      }
+      if (upper == "SELECT" || upper == "IN" || upper == "EXISTS") {
+        fail("subqueries are not supported");
+      }
+      auto slot = std::find(_columns.begin(), _columns.end(), name);
+      if (slot == _columns.end()) {
+        slot = _columns.insert(_columns.end(), name);
+      }
+      emit(expression::opcode::column, slot - _columns.begin(), 1);
+      return;
+    }
+    fail(std::string("unexpected character '") + c + "'");
+  }
+
+public:
+  expressionParser(const std::string &source,
+      std::vector<std::string> &columns,
+      expression &expr)
+      : _source(source), _pos(0), _columns(columns), _expr(expr), _depth(0)
+  {
+  }
+
+  void parse()
+  {
+    parseOr();
+    skipSpace();
+    if (_pos != _source.size()) {
+      fail("trailing input at '" + _source.substr(_pos) + "'");
+    }
+  }
+};
+
+expression::expression(const std::string &source,
+    std::vector<std::string> &columns,
+    trig::precision precision)
+    : _stackDepth(0), _precision(precision)
+{
+  expressionParser(source, columns, *this).parse();
+  _stack.resize(_stackDepth * batchSize);
+}
+
+// Each opcode is a tight loop over the batch so that the compiler can
+// vectorize it. NaN stands in for SQL NULL and follows SQL's three-valued
+// logic: comparing it gives NULL, and AND, OR and NOT only turn it into a
+// truth value when the other operand decides the result.
+void expression::evaluate(
+    const double *const *columns, size_t count, double deltaT, double *out)
+{
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  double *top      = _stack.data() - batchSize;
+  for (const auto &ins : _code) {
+    double *a = top - batchSize;
+    switch (ins._op) {
+    case opcode::column:
+      top += batchSize;
+      std::copy(columns[ins._operand], columns[ins._operand] + count, top);
+      break;
+    case opcode::constant:
+      top += batchSize;
+      std::fill(top, top + count, _constants[ins._operand]);
+      break;
+    case opcode::deltaT:
+      top += batchSize;
+      std::fill(top, top + count, deltaT);
+      break;
+    case opcode::negate:
+      for (size_t i = 0; i < count; ++i)
+        top[i] = -top[i];
+      break;
+    case opcode::add:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] + top[i];
+      top = a;
+      break;
+    case opcode::subtract:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] - top[i];
+      top = a;
+      break;
+    case opcode::multiply:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] * top[i];
+      top = a;
+      break;
+    case opcode::divide:
+      // SQLite divides by zero to NULL rather than to an infinity
+      for (size_t i = 0; i < count; ++i)
+        a[i] = top[i] == 0.0 ? nan : a[i] / top[i];
+      top = a;
+      break;
+    case opcode::sin:
+      trig::sin(top, count, _precision);
+      break;
+    case opcode::cos:
+      trig::cos(top, count, _precision);
+      break;
+    case opcode::abs:
+      for (size_t i = 0; i < count; ++i)
+        top[i] = std::fabs(top[i]);
+      break;
+    case opcode::sqrt:
+      for (size_t i = 0; i < count; ++i)
+        top[i] = std::sqrt(top[i]);
+      break;
+    // Like SQLite's multi-argument min() and max(), NULL if either is
+    case opcode::min:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] != a[i] || top[i] != top[i] ? nan
+             : top[i] < a[i]                    ? top[i]
+                                                : a[i];
+      top = a;
+      break;
+    case opcode::max:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] != a[i] || top[i] != top[i] ? nan
+             : top[i] > a[i]                    ? top[i]
+                                                : a[i];
+      top = a;
+      break;
+    case opcode::clamp: {
+      double *x = a - batchSize;
+      for (size_t i = 0; i < count; ++i) {
+        double v = x[i] < a[i] ? a[i] : x[i];
+        v        = v > top[i] ? top[i] : v;
+        x[i]     = x[i] != x[i] || a[i] != a[i] || top[i] != top[i] ? nan : v;
+      }
+      top = x;
+      break;
+    }
+    case opcode::less:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] != a[i] || top[i] != top[i] ? nan : a[i] < top[i];
+      top = a;
+      break;
+    case opcode::lessEqual:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] != a[i] || top[i] != top[i] ? nan : a[i] <= top[i];
+      top = a;
+      break;
+    case opcode::greater:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] != a[i] || top[i] != top[i] ? nan : a[i] > top[i];
+      top = a;
+      break;
+    case opcode::greaterEqual:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] != a[i] || top[i] != top[i] ? nan : a[i] >= top[i];
+      top = a;
+      break;
+    case opcode::equal:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] != a[i] || top[i] != top[i] ? nan : a[i] == top[i];
+      top = a;
+      break;
+    case opcode::notEqual:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] != a[i] || top[i] != top[i] ? nan : a[i] != top[i];
+      top = a;
+      break;
+    case opcode::logicalAnd:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = a[i] == 0.0 || top[i] == 0.0         ? 0.0
+             : a[i] != a[i] || top[i] != top[i] ? nan
+                                                : 1.0;
+      top = a;
+      break;
+    case opcode::logicalOr:
+      for (size_t i = 0; i < count; ++i)
+        a[i] = (a[i] != 0.0 && a[i] == a[i])
+                    || (top[i] != 0.0 && top[i] == top[i])
+                 ? 1.0
+             : a[i] != a[i] || top[i] != top[i] ? nan
+                                                : 0.0;
+      top = a;
+      break;
+    case opcode::logicalNot:
+      for (size_t i = 0; i < count; ++i)
+        top[i] = top[i] != top[i] ? nan : top[i] == 0.0;
+      break;
+    case opcode::isNull:
+      for (size_t i = 0; i < count; ++i)
+        top[i] = top[i] != top[i];
+      break;
+    case opcode::notNull:
+      for (size_t i = 0; i < count; ++i)
+        top[i] = top[i] == top[i];
+      break;
+    }
+  }
+  std::copy(top, top + count, out);
+}
+
+} // namespace nebula
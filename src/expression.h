@@ -0,0 +1,85 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_EXPRESSION_H
+#define NEBULA_EXPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "trig.h"
+
+namespace nebula {
+
+// Compiles the SQL-like expressions used by system set and require fields
+// into a small stack bytecode which is evaluated over batches of column
+// values rather than one row at a time.
+class expression {
+public:
+  static constexpr size_t batchSize = 256;
+
+  enum class opcode : uint8_t {
+    column,
+    constant,
+    deltaT,
+    negate,
+    add,
+    subtract,
+    multiply,
+    divide,
+    sin,
+    cos,
+    abs,
+    sqrt,
+    min,
+    max,
+    clamp,
+    less,
+    lessEqual,
+    greater,
+    greaterEqual,
+    equal,
+    notEqual,
+    logicalAnd,
+    logicalOr,
+    logicalNot,
+    isNull,
+    notNull
+  };
+
+  struct instruction {
+    opcode _op;
+    size_t _operand;
+  };
+
+private:
+  std::vector<instruction> _code;
+  std::vector<double> _constants;
+  std::vector<double> _stack;
+  size_t _stackDepth;
+  trig::precision _precision;
+
+  friend class expressionParser;
+
+public:
+  expression(const std::string &source,
+      std::vector<std::string> &columns,
+      trig::precision precision = trig::precision::precise);
+
+  const std::vector<instruction> &code() const
+  {
+    return _code;
+  }
+
+  // columns holds one pointer per entry of the column list passed to the
+  // constructor, each pointing to at least count values. NULL is NaN.
+  void evaluate(const double *const *columns,
+      size_t count,
+      double deltaT,
+      double *out);
+};
+
+} // namespace nebula
+
+#endif // NEBULA_EXPRESSION_H
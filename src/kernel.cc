@@ -0,0 +1,513 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "kernel.h"
+#include "bulk_array.h"
+
+// Exception includes
+#include "exceptions.h"
+
+#include <algorithm>
+#include <limits>
+
+// Unit Testing includes
+#include "doctest.h"
+
+// Logging system includes
+#include "loguru.hpp"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+SCENARIO("class kernel")
+{
+  GIVEN("a database with location and mobile components")
+  {
+    sqlite3 *db;
+    sqlite3_open(":memory:", &db);
+    nebula::bulkArray::registerModule(db);
+    sqlite3_exec(db,
+        "CREATE TABLE location (entity INTEGER PRIMARY KEY, x REAL, y REAL);"
+        "CREATE TABLE mobile (entity INTEGER PRIMARY KEY, vel REAL);"
+        "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n "
+        "WHERE i < 1000) INSERT INTO location SELECT i, i, 0.0 FROM n;"
+        "INSERT INTO mobile SELECT entity, entity % 3 FROM location;",
+        nullptr,
+        nullptr,
+        nullptr);
+    nebula::module::systemInfo info;
+    info._component = "location";
+    info._join      = {{"old", "location"}, {"mobile", "mobile"}};
+    info._set       = {{"x", "old.x + vel * deltaT()"}, {"y", "y - 1"}};
+    info._require   = {"vel > 0.0"};
+    info._native    = true;
+    WHEN("a kernel runs the system")
+    {
+      nebula::kernel k(db, info);
+      k.run(0.5);
+      THEN("only rows passing the require clause are updated")
+      {
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db,
+            "SELECT count(*) FROM location JOIN mobile USING (entity) WHERE "
+            "(vel > 0 AND x = entity + vel * 0.5 AND y = -1) OR (vel = 0 AND "
+            "x = entity AND y = 0)",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_int(stmt, 0) == 1000);
+        sqlite3_finalize(stmt);
+      }
+    }
+    WHEN("the system reads a bound parameter")
+    {
+      info._set = {{"x", "x + $step"}};
+      nebula::kernel k(db, info);
+      REQUIRE(k.parameters() == std::vector<std::string> {"step"});
+      k.bindParameter("step", 2.0);
+      k.run(0.5);
+      k.bindParameter("step", 1.0);
+      k.run(0.5);
+      THEN("each run uses the value bound at the time")
+      {
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db,
+            "SELECT count(*) FROM location JOIN mobile USING (entity) WHERE "
+            "(vel > 0 AND x = entity + 3) OR (vel = 0 AND x = entity)",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_int(stmt, 0) == 1000);
+        sqlite3_finalize(stmt);
+      }
+    }
+    WHEN("the system requires another component")
+    {
+      sqlite3_exec(db,
+          "CREATE TABLE marked (entity INTEGER PRIMARY KEY);"
+          "INSERT INTO marked VALUES (3), (4), (5);",
+          nullptr,
+          nullptr,
+          nullptr);
+      info._set = {{"y", "y + 1"}};
+      info._has = {"marked"};
+      nebula::kernel k(db, info);
+      k.run(0.5);
+      THEN("only entities having it are updated")
+      {
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db,
+            "SELECT group_concat(entity) FROM location WHERE y = 1",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(std::string(reinterpret_cast<const char *>(
+                    sqlite3_column_text(stmt, 0)))
+                == "4,5");
+        sqlite3_finalize(stmt);
+      }
+    }
+    WHEN("the rows are split over several workers")
+    {
+      info._workers = 3;
+      nebula::kernel k(db, info);
+      k.run(0.5);
+      k.run(0.5);
+      THEN("every row is updated exactly as by a single worker")
+      {
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db,
+            "SELECT count(*) FROM location JOIN mobile USING (entity) WHERE "
+            "(vel > 0 AND x = entity + vel AND y = -2) OR (vel = 0 AND x = "
+            "entity AND y = 0)",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_int(stmt, 0) == 1000);
+        sqlite3_finalize(stmt);
+      }
+    }
+    WHEN("the kernel runs over a range of entities")
+    {
+      info._set = {{"y", "y + 1"}};
+      info._require.clear();
+      nebula::kernel k(db, info);
+      k.run(0.5, 10, 20);
+      THEN("only the entities in the range are updated")
+      {
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db,
+            "SELECT count(*), min(entity), max(entity) FROM location WHERE y "
+            "= 1",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_int(stmt, 0) == 10);
+        REQUIRE(sqlite3_column_int(stmt, 1) == 11);
+        REQUIRE(sqlite3_column_int(stmt, 2) == 20);
+        sqlite3_finalize(stmt);
+      }
+    }
+    WHEN("the target component is double-buffered")
+    {
+      sqlite3_exec(db,
+          "CREATE TABLE location_prev (entity INTEGER PRIMARY KEY, x REAL, y "
+          "REAL); INSERT INTO location_prev SELECT entity, x + 100, y FROM "
+          "location;",
+          nullptr,
+          nullptr,
+          nullptr);
+      info._join     = {{"mobile", "mobile"}};
+      info._set      = {{"x", "x + 1"}};
+      info._buffered = {"location"};
+      nebula::kernel k(db, info);
+      k.run(0.5);
+      THEN("the system reads the previous copy and writes the current rows")
+      {
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db,
+            "SELECT count(*) FROM location JOIN mobile USING (entity) WHERE "
+            "(vel > 0 AND x = entity + 101) OR (vel = 0 AND x = entity)",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_int(stmt, 0) == 1000);
+        sqlite3_finalize(stmt);
+      }
+    }
+    WHEN("the system uses syntax the kernel cannot compile")
+    {
+      info._require = {"entity IN (SELECT entity FROM mobile)"};
+      THEN("constructing the kernel throws")
+      {
+        REQUIRE_THROWS(nebula::kernel(db, info));
+      }
+    }
+    WHEN("the system sets more columns than a bulk_array holds")
+    {
+      info._set.clear();
+      for (size_t i = 0; i <= nebula::bulkArray::maxColumns; ++i) {
+        info._set.emplace_back("x", "x + 1");
+      }
+      THEN("constructing the kernel throws")
+      {
+        REQUIRE_THROWS(nebula::kernel(db, info));
+      }
+    }
+    sqlite3_close(db);
+  }
+}
+#endif
+
+namespace nebula {
+
+kernel::kernel(sqlite3 *db, const module::systemInfo &system)
+    : _db(db), _select(nullptr), _update(nullptr), _count(0), _deltaT(0.0),
+      _generation(0), _pending(0), _active(0), _stop(false)
+{
+  LOG_SCOPE_FUNCTION(INFO);
+  // Checked up front, before the first batch would fail inside bulkArray
+  if (system._set.size() > bulkArray::maxColumns) {
+    throw nebulaException("A kernel sets at most "
+                          + std::to_string(bulkArray::maxColumns)
+                          + " columns");
+  }
+  _partitions.resize(std::max<size_t>(system._workers, 1));
+  _chunk = _partitions.size() * expression::batchSize;
+  for (const auto &[column, expr] : system._set) {
+    _partitions[0]._set.emplace_back(expr, _columns, system._math);
+  }
+  for (const auto &clause : system._require) {
+    _partitions[0]._require.emplace_back(clause, _columns, system._math);
+  }
+  const std::string &target = system._component;
+  std::string sql           = "SELECT " + target + ".entity";
+  for (const auto &column : _columns) {
+    sql += ", " + qualifyColumn(column, system);
+  }
+  // Double-buffered components are read from their previous-tick copy under
+  // the component's own name, while writes below go to the current rows.
+  sql += " FROM " + module::readTable(system, target);
+  if (module::readTable(system, target) != target) {
+    sql += " AS " + target;
+  }
+  for (const auto &[alias, component] : system._join) {
+    if (alias == target) {
+      continue;
+    }
+    std::string table = module::readTable(system, component);
+    sql += " JOIN " + table;
+    if (alias != table) {
+      sql += " AS " + alias;
+    }
+    sql += " ON " + alias + ".entity = " + target + ".entity";
+  }
+  for (const auto &component : system._has) {
+    sql += " JOIN " + component + " AS has_" + component + " ON has_"
+         + component + ".entity = " + target + ".entity";
+  }
+  if (system._activeOnly) {
+    sql += " JOIN active ON active.entity = " + target + ".entity";
+  }
+  // Named, since $name parameters in the column list come first and would
+  // otherwise take index 1.
+  sql += " WHERE " + target + ".entity > :after AND " + target
+       + ".entity <= :until ORDER BY " + target + ".entity LIMIT "
+       + std::to_string(_chunk) + ";";
+  if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &_select, nullptr) != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  // Each batch is written back with one statement over the bulk_array
+  // function rather than one UPDATE per row.
+  sql = "UPDATE " + target + " SET ";
+  for (size_t i = 0; i < system._set.size(); ++i) {
+    if (i > 0) {
+      sql += ", ";
+    }
+    sql += system._set[i].first + " = bulk.c" + std::to_string(i);
+  }
+  sql += " FROM bulk_array(?1) AS bulk WHERE " + target
+       + ".entity = bulk.entity;";
+  if (sqlite3_prepare_v2(_db, sql.c_str(), -1, &_update, nullptr) != SQLITE_OK)
+  {
+    sqlite3_finalize(_select);
+    throw sqliteException(_db);
+  }
+  const size_t batch = expression::batchSize;
+  _inputs.resize(_columns.size() * _chunk);
+  _outputs.resize(system._set.size() * _chunk);
+  _results.resize(system._set.size() * _chunk);
+  _mask.resize(_chunk);
+  _scratch.resize(_chunk);
+  _entities.resize(_chunk);
+  for (size_t p = 0; p < _partitions.size(); ++p) {
+    auto &part = _partitions[p];
+    if (p > 0) {
+      part._set     = _partitions[0]._set;
+      part._require = _partitions[0]._require;
+    }
+    for (size_t c = 0; c < _columns.size(); ++c) {
+      part._columns.push_back(
+          _inputs.data() + (p * _columns.size() + c) * batch);
+    }
+  }
+  for (size_t p = 1; p < _partitions.size(); ++p) {
+    _threads.emplace_back(&kernel::work, this, p);
+  }
+}
+
+kernel::~kernel()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _start.notify_all();
+  for (auto &thread : _threads) {
+    thread.join();
+  }
+  sqlite3_finalize(_select);
+  sqlite3_finalize(_update);
+}
+
+// Unqualified column names are resolved the way the generated UPDATE would
+// see them: the target component first, then each joined component.
+std::string kernel::qualifyColumn(
+    const std::string &column, const module::systemInfo &system)
+{
+  if (column.find('.') != std::string::npos || column[0] == '$') {
+    return column;
+  }
+  std::vector<std::pair<std::string, std::string>> candidates
+      = {{system._component, system._component}};
+  candidates.insert(
+      candidates.end(), system._join.begin(), system._join.end());
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(_db,
+          "SELECT 1 FROM pragma_table_info(?1) WHERE name = ?2;",
+          -1,
+          &stmt,
+          nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(_db);
+  }
+  for (const auto &[alias, component] : candidates) {
+    sqlite3_bind_text(stmt, 1, component.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, column.c_str(), -1, SQLITE_TRANSIENT);
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_reset(stmt);
+    if (found) {
+      sqlite3_finalize(stmt);
+      return alias + "." + column;
+    }
+  }
+  sqlite3_finalize(stmt);
+  throw nebulaException("No such column in system: " + column);
+}
+
+std::vector<std::string> kernel::parameters() const
+{
+  std::vector<std::string> names;
+  for (const auto &column : _columns) {
+    if (column[0] == '$') {
+      names.emplace_back(column.substr(1));
+    }
+  }
+  return names;
+}
+
+// Parameters are selected alongside the columns, so rebinding takes effect
+// on the next run without preparing the statement again.
+void kernel::bindParameter(const std::string &name, double value)
+{
+  int index = sqlite3_bind_parameter_index(_select, ("$" + name).c_str());
+  if (index > 0) {
+    sqlite3_bind_double(_select, index, value);
+  }
+}
+
+// Evaluates the require and set expressions over one partition's rows of
+// the current chunk, leaving its mask and outputs in place.
+void kernel::evaluate(size_t index)
+{
+  const size_t batch = expression::batchSize;
+  const size_t first = index * batch;
+  const size_t count = std::min(batch, _count - first);
+  auto &part         = _partitions[index];
+  double *mask       = _mask.data() + first;
+  double *scratch    = _scratch.data() + first;
+  std::fill(mask, mask + count, 1.0);
+  for (auto &require : part._require) {
+    require.evaluate(part._columns.data(), count, _deltaT, scratch);
+    for (size_t i = 0; i < count; ++i) {
+      // NULL, as in a WHERE clause, rejects the row
+      mask[i] = mask[i] != 0.0 && scratch[i] != 0.0
+             && scratch[i] == scratch[i];
+    }
+  }
+  for (size_t s = 0; s < part._set.size(); ++s) {
+    part._set[s].evaluate(part._columns.data(),
+        count,
+        _deltaT,
+        _outputs.data() + (index * part._set.size() + s) * batch);
+  }
+}
+
+// Evaluates the first active partitions, the first on this thread and the
+// rest on the workers, and waits for all of them.
+void kernel::dispatch(size_t active)
+{
+  if (active == 1) {
+    evaluate(0);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _active  = active;
+    _pending = _threads.size();
+    ++_generation;
+  }
+  _start.notify_all();
+  evaluate(0);
+  std::unique_lock<std::mutex> lock(_mutex);
+  _done.wait(lock, [this] { return _pending == 0; });
+}
+
+void kernel::work(size_t index)
+{
+  uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _start.wait(lock, [&] { return _stop || _generation != seen; });
+      if (_stop) {
+        return;
+      }
+      seen = _generation;
+    }
+    if (index < _active) {
+      evaluate(index);
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (--_pending == 0) {
+      _done.notify_one();
+    }
+  }
+}
+
+void kernel::run(double deltaT, sqlite3_int64 after, sqlite3_int64 until)
+{
+  const size_t batch       = expression::batchSize;
+  const size_t columnCount = _columns.size();
+  const size_t setCount    = _partitions[0]._set.size();
+  sqlite3_int64 cursor     = after;
+  int afterIndex           = sqlite3_bind_parameter_index(_select, ":after");
+  sqlite3_bind_int64(
+      _select, sqlite3_bind_parameter_index(_select, ":until"), until);
+  _deltaT = deltaT;
+  for (;;) {
+    sqlite3_bind_int64(_select, afterIndex, cursor);
+    _count = 0;
+    int res;
+    while ((res = sqlite3_step(_select)) == SQLITE_ROW) {
+      const size_t p    = _count / batch;
+      const size_t i    = _count % batch;
+      _entities[_count] = sqlite3_column_int64(_select, 0);
+      for (size_t c = 0; c < columnCount; ++c) {
+        _inputs[(p * columnCount + c) * batch + i]
+            = sqlite3_column_type(_select, c + 1) == SQLITE_NULL
+                ? std::numeric_limits<double>::quiet_NaN()
+                : sqlite3_column_double(_select, c + 1);
+      }
+      ++_count;
+    }
+    sqlite3_reset(_select);
+    if (res != SQLITE_DONE) {
+      throw sqliteException(_db);
+    }
+    if (_count == 0) {
+      return;
+    }
+    dispatch((_count + batch - 1) / batch);
+    cursor = _entities[_count - 1];
+    // Gather the rows passing every require clause into contiguous columns.
+    size_t written = 0;
+    for (size_t r = 0; r < _count; ++r) {
+      if (_mask[r] == 0.0) {
+        continue;
+      }
+      const size_t p     = r / batch;
+      const size_t i     = r % batch;
+      _entities[written] = _entities[r];
+      for (size_t s = 0; s < setCount; ++s) {
+        _results[s * _chunk + written]
+            = _outputs[(p * setCount + s) * batch + i];
+      }
+      ++written;
+    }
+    if (written > 0) {
+      bulkArray array(_entities.data(), written);
+      for (size_t s = 0; s < setCount; ++s) {
+        array.addColumn(_results.data() + s * _chunk);
+      }
+      array.bind(_update, 1);
+      int res = sqlite3_step(_update);
+      sqlite3_reset(_update);
+      sqlite3_clear_bindings(_update);
+      if (res != SQLITE_DONE) {
+        throw sqliteException(_db);
+      }
+    }
+    if (_count < _chunk) {
+      return;
+    }
+  }
+}
+
+} // namespace nebula
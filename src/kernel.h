@@ -0,0 +1,88 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_KERNEL_H
+#define NEBULA_KERNEL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "expression.h"
+#include "module.h"
+
+extern "C" {
+#include "sqlite3.h"
+}
+
+namespace nebula {
+
+// Runs an update system natively: rows are fetched from SQLite in batches,
+// the set and require expressions are evaluated as bytecode over whole
+// columns, and the results are written back to the target component.
+//
+// With several workers, each fetch takes one batch per worker and the
+// batches, contiguous entity ranges, are evaluated concurrently; kernel
+// expressions only read the row being computed, so they cannot conflict.
+// Fetching and writing back stay on the calling thread's connection.
+class kernel {
+private:
+  // Each partition has its own expressions, as they evaluate on a stack
+  // they own, and pointers to its range of the input columns.
+  struct partition {
+    std::vector<expression> _set;
+    std::vector<expression> _require;
+    std::vector<const double *> _columns;
+  };
+
+  sqlite3 *_db;
+  sqlite3_stmt *_select;
+  sqlite3_stmt *_update;
+  std::vector<std::string> _columns;
+  std::vector<partition> _partitions;
+  size_t _chunk;
+  size_t _count;
+  double _deltaT;
+  std::vector<double> _inputs;
+  std::vector<double> _outputs;
+  std::vector<double> _results;
+  std::vector<double> _mask;
+  std::vector<double> _scratch;
+  std::vector<sqlite3_int64> _entities;
+
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _start;
+  std::condition_variable _done;
+  uint64_t _generation;
+  size_t _pending;
+  size_t _active;
+  bool _stop;
+
+  void evaluate(size_t index);
+  void dispatch(size_t active);
+  void work(size_t index);
+  std::string qualifyColumn(
+      const std::string &column, const module::systemInfo &system);
+
+public:
+  kernel(sqlite3 *db, const module::systemInfo &system);
+  kernel(const kernel &other) = delete;
+  ~kernel();
+
+  // The $name parameters the system's expressions use.
+  std::vector<std::string> parameters() const;
+  void bindParameter(const std::string &name, double value);
+
+  // Runs over the entities in (after, until], all of them by default.
+  void run(double deltaT,
+      sqlite3_int64 after = std::numeric_limits<sqlite3_int64>::min(),
+      sqlite3_int64 until = std::numeric_limits<sqlite3_int64>::max());
+};
+
+} // namespace nebula
+
+#endif // NEBULA_KERNEL_H
@@ -6,7 +6,14 @@
 #include "module.h"
 #include <stdexcept>
 #include <algorithm>
+#include <cctype>
 #include <cstring>
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include "sqlite3.h"
+}
 
 // Logging system includes
 #include "loguru.hpp"
@@ -50,6 +57,10 @@ SCENARIO("class module")
     {
       REQUIRE(mod.name() == mod.identifier());
     }
+    THEN("the math precision should default to precise")
+    {
+      REQUIRE(mod.math() == nebula::trig::precision::precise);
+    }
   }
   GIVEN("a valid module")
   {
@@ -64,12 +75,168 @@ SCENARIO("class module")
                 == "CREATE TABLE test (entity INTEGER PRIMARY KEY REFERENCES "
                    "entity(entity) ON DELETE CASCADE, test_int INTEGER, "
                    "test_num REAL, test_txt TEXT);");
+        REQUIRE(mod.getComponentSQL("packed")
+                == "CREATE VIRTUAL TABLE packed USING column_store(px F32, "
+                   "py F32, count INTEGER); CREATE TRIGGER "
+                   "packed_entity_delete AFTER DELETE ON entity BEGIN DELETE "
+                   "FROM packed WHERE entity = old.entity; END;");
+        REQUIRE(mod.getComponentSQL("marker")
+                == "CREATE VIRTUAL TABLE marker USING tag_set; CREATE TRIGGER "
+                   "marker_entity_delete AFTER DELETE ON entity BEGIN DELETE "
+                   "FROM marker WHERE entity = old.entity; END;");
+        REQUIRE(mod.getComponentSQL("rare")
+                == "CREATE VIRTUAL TABLE rare USING sparse_set(level INTEGER); "
+                   "CREATE TRIGGER rare_entity_delete AFTER DELETE ON entity "
+                   "BEGIN DELETE FROM rare WHERE entity = old.entity; END;");
         REQUIRE(mod.getSystemSQL("update_location")
                 == "UPDATE location SET theta = old.theta + mobile.rotation, x "
                    "= old.x - sin(old.theta) * mobile.vel * deltaT(), y = "
                    "old.y + cos(old.theta) * mobile.vel * deltaT() FROM "
-                   "location AS old JOIN mobile USING (entity) WHERE vel > "
-                   "0.0;");
+                   "location AS old JOIN mobile USING (entity) WHERE "
+                   "old.entity = location.entity AND vel > 0.0;");
+        REQUIRE(mod.getSystemSQL("boost_player")
+                == "UPDATE mobile SET accel = accel + 0.5 WHERE mobile.entity "
+                   "IN (SELECT entity FROM player_ship);");
+        REQUIRE(mod.getSystemInfo("boost_player")._has
+                == std::vector<std::string> {"player_ship"});
+      }
+      THEN("double-buffered components read their previous-tick copy")
+      {
+        REQUIRE(mod.buffers() == std::vector<std::string> {"test", "packed"});
+        REQUIRE(mod.getBufferSQL("test")
+                == "CREATE TABLE test_prev (entity INTEGER PRIMARY KEY, "
+                   "test_int INTEGER, test_num REAL, test_txt TEXT);");
+        REQUIRE(mod.getBufferSQL("packed")
+                == "CREATE VIRTUAL TABLE packed_prev USING column_store(px "
+                   "F32, py F32, count INTEGER);");
+        REQUIRE(mod.getSystemSQL("grow_test")
+                == "UPDATE test SET test_num = _next.test_num FROM (SELECT "
+                   "test.entity AS entity, test_num + px AS test_num FROM "
+                   "test_prev AS test JOIN packed_prev AS packed ON "
+                   "packed.entity = test.entity WHERE test_int > 0) AS _next "
+                   "WHERE test.entity = _next.entity;");
+        REQUIRE(mod.getSystemInfo("grow_test")._buffered
+                == std::vector<std::string> {"test", "packed"});
+        REQUIRE(mod.getSystemInfo("update_location")._buffered.empty());
+      }
+      THEN("sliced and low-rate systems are recorded for the scheduler")
+      {
+        REQUIRE(mod.getSystemInfo("plan_route")._slice == 64);
+        REQUIRE(mod.getSystemInfo("update_location")._slice == 0);
+        REQUIRE(mod.getSystemInfo("update_location")._workers == 1);
+        REQUIRE(mod.getSystemInfo("plan_route")._period == 4);
+        REQUIRE(mod.getSystemInfo("update_location")._period == 1);
+        REQUIRE(mod.getSystemSQL("plan_route")
+                == "UPDATE location SET x = x + 1 WHERE location.entity IN "
+                   "(SELECT entity FROM active) AND location.entity > "
+                   ":slice_after AND location.entity <= :slice_until;");
+        REQUIRE(mod.getSystemInfo("plan_route")._activeOnly);
+        REQUIRE(mod.getSystemInfo("plan_route")._require.empty());
+        REQUIRE(mod.sleepAfter() == 30);
+        REQUIRE(mod.activity().at("test") == "test_num != 0.0");
+      }
+      THEN("render SQL and inputs should be correct")
+      {
+        REQUIRE(mod.getRenderSQL("ship")
+                == "SELECT x, y, health FROM location JOIN player_ship AS "
+                   "ship USING (entity);");
+        REQUIRE(mod.getRenderInputs("ship")
+                == std::vector<std::string> {"location", "player_ship"});
+      }
+      THEN("materialized view SQL should be correct")
+      {
+        auto &info = mod.getViewInfo("ship_status");
+        REQUIRE(info._create
+                == "CREATE TABLE ship_status (entity INTEGER PRIMARY KEY, x, "
+                   "hp);");
+        REQUIRE(info._select
+                == "SELECT location.entity AS entity, location.x, health AS "
+                   "hp FROM location JOIN player_ship AS ship USING "
+                   "(entity)");
+        REQUIRE(info._columns == std::vector<std::string> {"x", "hp"});
+        REQUIRE(info._inputs
+                == std::vector<std::string> {"location", "player_ship"});
+      }
+      THEN("the generated component header should declare typed structs")
+      {
+        auto header = mod.componentHeader();
+        REQUIRE(header.find("#ifndef NEBULA_COMPONENTS_VALID_MODULE_H")
+                != std::string::npos);
+        REQUIRE(header.find("struct test {\n  sqlite3_int64 test_int;\n  "
+                            "double test_num;\n  std::string test_txt;\n};")
+                != std::string::npos);
+        REQUIRE(header.find("  float px;\n") != std::string::npos);
+        REQUIRE(header.find("makeField(\"py\", &components::packed::py)")
+                != std::string::npos);
+      }
+      THEN("system details should be recorded for the engine")
+      {
+        auto &info = mod.getSystemInfo("update_location");
+        REQUIRE(info._component == "location");
+        REQUIRE(info._join.size() == 2);
+        REQUIRE(info._set.size() == 3);
+        REQUIRE(info._require.size() == 1);
+        REQUIRE(info._require[0] == "vel > 0.0");
+        REQUIRE(info._native == false);
+        REQUIRE(info._math == nebula::trig::precision::fast);
+        REQUIRE(mod.params().at("speed_limit") == 5.5);
+        REQUIRE(mod.vars().at("score") == "0");
+        REQUIRE(mod.aggregates() == std::vector<std::string> {"total_num"});
+        REQUIRE(mod.getAggregateInfo("total_num")._column == "test_num");
+        REQUIRE(mod.getPoolInfo("ammo")._size == 8);
+        REQUIRE(mod.getPoolInfo("ammo")._populate.back()
+                == "WITH RECURSIVE pool(entity) AS (SELECT :first UNION ALL "
+                   "SELECT entity + 1 FROM pool WHERE entity < :last) INSERT "
+                   "OR REPLACE INTO test (entity, test_int) SELECT entity, 5 "
+                   "FROM pool;");
+        REQUIRE(mod.getComponentSQL("ammo").find("USING tag_set")
+                != std::string::npos);
+        REQUIRE(mod.getEventSQL("ping")
+                == "CREATE VIRTUAL TABLE ping USING event_channel(8, source "
+                   "INTEGER, strength REAL);");
+      }
+      THEN("a hierarchy needs a component with x, y and theta")
+      {
+        YAML::Node world = YAML::Load("test");
+        REQUIRE_THROWS(mod.loadHierarchy(world));
+        YAML::Node location = YAML::Load("{x: f32, y: f32, theta: real}");
+        mod.loadComponent("location", location);
+        world = YAML::Load("location");
+        mod.loadHierarchy(world);
+        REQUIRE(mod.hierarchy() == "location");
+        REQUIRE(mod.getComponentSQL("hierarchy").find(
+                    "USING sparse_set(parent INTEGER, x REAL, y REAL, theta "
+                    "REAL)")
+                != std::string::npos);
+      }
+    }
+    WHEN("a SQL system program is loaded")
+    {
+      mod.loadProgram("tally",
+          "-- Schema is created once\n"
+          "CREATE TABLE tally (n TEXT);\n"
+          "CREATE TRIGGER t AFTER INSERT ON tally BEGIN SELECT 1; END;\n"
+          "BEGIN TRANSACTION;\n"
+          "  INSERT INTO tally VALUES (';');\n"
+          "COMMIT;\n"
+          "DELETE FROM tally;\n");
+      THEN("setup, savepoints and per-tick statements are split apart")
+      {
+        auto &info = mod.getSystemInfo("tally");
+        REQUIRE(info._component.empty());
+        REQUIRE(info._setup.size() == 2);
+        REQUIRE(info._program
+                == std::vector<std::string> {"SAVEPOINT \"tally\";",
+                    "INSERT INTO tally VALUES (';');",
+                    "RELEASE \"tally\";",
+                    "DELETE FROM tally;"});
+        REQUIRE(mod.systems().back() == "tally");
+      }
+      THEN("unbalanced transactions and unterminated statements are rejected")
+      {
+        REQUIRE_THROWS(mod.loadProgram("bad", "BEGIN; SELECT 1;"));
+        REQUIRE_THROWS(mod.loadProgram("bad", "COMMIT;"));
+        REQUIRE_THROWS(mod.loadProgram("bad", "SELECT 1"));
       }
     }
   }
@@ -81,6 +248,126 @@ SCENARIO("class module")
 
 namespace nebula {
 
+// Builds "a JOIN b AS c USING (entity) ..." from an entity_join map and
+// records each (name, component) pair in declaration order.
+static std::string entityJoinSQL(
+    YAML::Node join, std::vector<std::pair<std::string, std::string>> &tables)
+{
+  std::string sql;
+  for (auto value = join.begin(); value != join.end(); ++value) {
+    if (value != join.begin()) {
+      sql += " JOIN ";
+    }
+    auto component = value->second.as<std::string>();
+    auto name      = value->first.as<std::string>();
+    tables.emplace_back(name, component);
+    if (component != name) {
+      sql += component + " AS ";
+    }
+    sql += name;
+    if (value != join.begin()) {
+      sql += " USING (entity)";
+    }
+  }
+  return sql;
+}
+
+// Component and active-set requirements are semi-joins on the entity key,
+// which the planner can drive from the smaller side when statistics say so.
+// Sliced systems also take the entity range to run over as parameters.
+static std::string requireSQL(
+    const module::systemInfo &info, std::vector<std::string> clauses = {})
+{
+  const std::string &target = info._component;
+  clauses.insert(clauses.end(), info._require.begin(), info._require.end());
+  for (const auto &component : info._has) {
+    clauses.emplace_back(
+        target + ".entity IN (SELECT entity FROM " + component + ")");
+  }
+  if (info._activeOnly) {
+    clauses.emplace_back(target + ".entity IN (SELECT entity FROM active)");
+  }
+  if (info._slice > 0) {
+    clauses.emplace_back(target + ".entity > :slice_after AND " + target
+                         + ".entity <= :slice_until");
+  }
+  std::string sql;
+  for (const auto &clause : clauses) {
+    sql += (sql.empty() ? " WHERE " : " AND ") + clause;
+  }
+  return sql;
+}
+
+// The joined components are chained on entity, and the first of them is
+// tied to the target row, so each target row meets only its own entity.
+static std::string updateSQL(const module::systemInfo &info)
+{
+  const std::string &target = info._component;
+  std::string sql           = "UPDATE " + target + " SET ";
+  for (size_t i = 0; i < info._set.size(); ++i) {
+    if (i > 0) {
+      sql += ", ";
+    }
+    sql += info._set[i].first + " = " + info._set[i].second;
+  }
+  std::string from;
+  std::vector<std::string> clauses;
+  for (const auto &[alias, component] : info._join) {
+    if (alias == target) {
+      continue;
+    }
+    std::string table
+        = alias == component ? alias : component + " AS " + alias;
+    if (from.empty()) {
+      from = table;
+      clauses.emplace_back(alias + ".entity = " + target + ".entity");
+    } else {
+      from += " JOIN " + table + " USING (entity)";
+    }
+  }
+  if (!from.empty()) {
+    sql += " FROM " + from;
+  }
+  return sql + requireSQL(info, clauses);
+}
+
+// A system over double-buffered components evaluates its expressions in a
+// subquery where each such component's name (or alias) is bound to its
+// previous-tick copy, so unqualified columns read last tick's values without
+// an "old" self-join. The results are then written to the current rows.
+static std::string bufferedUpdateSQL(const module::systemInfo &info)
+{
+  const std::string &target = info._component;
+  std::string update = "UPDATE " + target + " SET ";
+  std::string select = "SELECT " + target + ".entity AS entity";
+  for (size_t i = 0; i < info._set.size(); ++i) {
+    const auto &[column, expr] = info._set[i];
+    if (i > 0) {
+      update += ", ";
+    }
+    update += column + " = _next." + column;
+    select += ", " + expr + " AS " + column;
+  }
+  select += " FROM " + module::readTable(info, target);
+  if (module::readTable(info, target) != target) {
+    select += " AS " + target;
+  }
+  for (const auto &[alias, component] : info._join) {
+    if (alias == target) {
+      continue;
+    }
+    std::string table = module::readTable(info, component);
+    select += " JOIN " + table;
+    if (table != alias) {
+      select += " AS " + alias;
+    }
+    select += " ON " + alias + ".entity = " + target + ".entity";
+  }
+  select += requireSQL(info);
+  return update + " FROM (" + select + ") AS _next WHERE " + target
+       + ".entity = _next.entity";
+}
+
 module::module(const std::string &path, bool shouldLoad)
     : _rootPath(path), _load(shouldLoad)
 {
@@ -104,6 +391,8 @@ module::module(const std::string &path, bool shouldLoad)
   _name = manifest["module"]["name"].as<std::string, std::string>(_identifier);
   std::string _tags
       = manifest["module"]["tags"].as<std::string, std::string>("");
+  _math = trig::parsePrecision(
+      manifest["module"]["math"].as<std::string, std::string>("precise"));
   if (manifest["module"]["dependencies"]) {
     for (const auto &iterator : manifest["module"]["dependencies"]) {
       _dependencies.emplace_back(iterator.as<std::string>());
@@ -119,7 +408,22 @@ module::module(const std::string &path, bool shouldLoad)
 module::module(const module &other)
     : _rootPath(other._rootPath), _load(other._load),
       _identifier(other._identifier), _name(other._name), _tags(other._tags),
-      _dependencies(other._dependencies)
+      _math(other._math), _dependencies(other._dependencies),
+      _includes(other._includes), _params(other._params), _vars(other._vars),
+      _activity(other._activity), _sleepAfter(other._sleepAfter),
+      _hierarchy(other._hierarchy),
+      _componentSQL(other._componentSQL),
+      _componentColumns(other._componentColumns), _systemSQL(other._systemSQL),
+      _systemInfo(other._systemInfo), _renderSQL(other._renderSQL),
+      _renderInputs(other._renderInputs), _viewInfo(other._viewInfo),
+      _aggregateInfo(other._aggregateInfo), _bufferSQL(other._bufferSQL),
+      _timerInfo(other._timerInfo), _poolInfo(other._poolInfo),
+      _eventSQL(other._eventSQL),
+      _componentOrder(other._componentOrder), _systemOrder(other._systemOrder),
+      _renderOrder(other._renderOrder), _viewOrder(other._viewOrder),
+      _aggregateOrder(other._aggregateOrder), _bufferOrder(other._bufferOrder),
+      _timerOrder(other._timerOrder), _poolOrder(other._poolOrder),
+      _eventOrder(other._eventOrder)
 {
 }
 
@@ -131,12 +435,40 @@ void module::loadModule()
     YAML::Node include;
     auto filePath = _rootPath + "/" + fileName;
     LOG_S(INFO) << "Loading " << filePath;
+    if (fileName.size() > 4
+        && fileName.compare(fileName.size() - 4, 4, ".sql") == 0)
+    {
+      std::ifstream file(filePath);
+      if (!file) {
+        throw nebulaException("Included file is missing: " + filePath);
+      }
+      std::stringstream sql;
+      sql << file.rdbuf();
+      // The system is named after the file, e.g. systems/asteroid.sql
+      // becomes asteroid
+      auto start = fileName.find_last_of('/') + 1;
+      loadProgram(fileName.substr(start, fileName.size() - 4 - start),
+          sql.str());
+      continue;
+    }
     try {
       include = YAML::LoadFile(filePath);
     } catch (YAML::BadFile &e) {
       LOG_S(ERROR) << "Included file is missing or corrupt: " << filePath;
       throw;
     }
+    if (include["params"]) {
+      YAML::Node params = include["params"];
+      loadParams(params);
+    }
+    if (include["vars"]) {
+      YAML::Node vars = include["vars"];
+      loadVars(vars);
+    }
+    if (include["activity"]) {
+      YAML::Node activity = include["activity"];
+      loadActivity(activity);
+    }
     if (include["components"]) {
       if (!include["components"].IsMap()) {
         throw nebulaException("Invalid components section: not type Map");
@@ -149,6 +481,25 @@ void module::loadModule()
             componentNode->first.as<std::string>(), componentNode->second);
       }
     }
+    if (include["double_buffer"]) {
+      YAML::Node buffers = include["double_buffer"];
+      loadBuffers(buffers);
+    }
+    if (include["hierarchy"]) {
+      YAML::Node hierarchy = include["hierarchy"];
+      loadHierarchy(hierarchy);
+    }
+    if (include["events"]) {
+      if (!include["events"].IsMap()) {
+        throw nebulaException("Invalid events section: not type Map");
+      }
+      for (auto eventNode = include["events"].begin();
+           eventNode != include["events"].end();
+           ++eventNode)
+      {
+        loadEvent(eventNode->first.as<std::string>(), eventNode->second);
+      }
+    }
     if (include["systems"]) {
       if (!include["systems"].IsMap()) {
         throw nebulaException("Invalid systems section: not type Map");
@@ -160,25 +511,400 @@ void module::loadModule()
         loadSystem(systemNode->first.as<std::string>(), systemNode->second);
       }
     }
+    if (include["renders"]) {
+      if (!include["renders"].IsSequence()) {
+        throw nebulaException("Invalid renders section: not type Sequence");
+      }
+      for (auto renderList : include["renders"]) {
+        for (auto renderNode = renderList.begin();
+             renderNode != renderList.end();
+             ++renderNode)
+        {
+          loadRender(
+              renderNode->first.as<std::string>(), renderNode->second);
+        }
+      }
+    }
+    if (include["views"]) {
+      if (!include["views"].IsMap()) {
+        throw nebulaException("Invalid views section: not type Map");
+      }
+      for (auto viewNode = include["views"].begin();
+           viewNode != include["views"].end();
+           ++viewNode)
+      {
+        loadView(viewNode->first.as<std::string>(), viewNode->second);
+      }
+    }
+    if (include["aggregates"]) {
+      if (!include["aggregates"].IsMap()) {
+        throw nebulaException("Invalid aggregates section: not type Map");
+      }
+      for (auto aggregateNode = include["aggregates"].begin();
+           aggregateNode != include["aggregates"].end();
+           ++aggregateNode)
+      {
+        loadAggregate(
+            aggregateNode->first.as<std::string>(), aggregateNode->second);
+      }
+    }
+    if (include["timers"]) {
+      if (!include["timers"].IsMap()) {
+        throw nebulaException("Invalid timers section: not type Map");
+      }
+      for (auto timerNode = include["timers"].begin();
+           timerNode != include["timers"].end();
+           ++timerNode)
+      {
+        loadTimer(timerNode->first.as<std::string>(), timerNode->second);
+      }
+    }
+    if (include["pools"]) {
+      if (!include["pools"].IsMap()) {
+        throw nebulaException("Invalid pools section: not type Map");
+      }
+      for (auto poolNode = include["pools"].begin();
+           poolNode != include["pools"].end();
+           ++poolNode)
+      {
+        loadPool(poolNode->first.as<std::string>(), poolNode->second);
+      }
+    }
+  }
+}
+
+void module::loadParams(YAML::Node &params)
+{
+  if (!params.IsMap()) {
+    throw nebulaException("Invalid params section: not type Map");
+  }
+  for (auto value = params.begin(); value != params.end(); ++value) {
+    auto key = value->first.as<std::string>();
+    try {
+      _params[key] = value->second.as<double>();
+    } catch (YAML::BadConversion &e) {
+      throw nebulaException("Invalid param " + key + ": not a number");
+    }
+  }
+}
+
+void module::loadVars(YAML::Node &vars)
+{
+  if (!vars.IsMap()) {
+    throw nebulaException("Invalid vars section: not type Map");
+  }
+  for (auto value = vars.begin(); value != vars.end(); ++value) {
+    auto key = value->first.as<std::string>();
+    if (!value->second.IsScalar()) {
+      throw nebulaException("Invalid var " + key + ": not a scalar");
+    }
+    _vars[key] = value->second.as<std::string>();
+  }
+}
+
+void module::loadActivity(YAML::Node &activity)
+{
+  if (!activity.IsMap() || !activity["watch"] || !activity["watch"].IsMap()) {
+    throw nebulaException("Invalid activity section: no watch map");
+  }
+  if (activity["sleep_after"]) {
+    int ticks = activity["sleep_after"].as<int>();
+    if (ticks < 1) {
+      throw nebulaException("Invalid activity: sleep_after must be at least 1");
+    }
+    _sleepAfter = ticks;
+  }
+  YAML::Node watch = activity["watch"];
+  for (auto value = watch.begin(); value != watch.end(); ++value) {
+    _activity[value->first.as<std::string>()]
+        = value->second.as<std::string>();
+  }
+}
+
+// hierarchy: names the component that holds world transforms, which must
+// have x, y and theta columns. The built-in hierarchy component is declared
+// alongside it: an entity's parent and its transform relative to the parent.
+// Entities are attached rarely, so it is kept in a sparse set.
+void module::loadHierarchy(YAML::Node &hierarchy)
+{
+  auto world = hierarchy.as<std::string>();
+  if (!_hierarchy.empty() && _hierarchy != world) {
+    throw nebulaException("Invalid hierarchy: already placed in " + _hierarchy);
+  }
+  auto found = _componentColumns.find(world);
+  if (found == _componentColumns.end()) {
+    throw nebulaException(
+        "Invalid hierarchy: component " + world + " must be declared first");
+  }
+  for (auto column : {"x", "y", "theta"}) {
+    if (std::none_of(found->second.begin(),
+            found->second.end(),
+            [&](const auto &c) { return c.first == column; }))
+    {
+      throw nebulaException("Invalid hierarchy: component " + world
+                            + " has no column " + column);
+    }
+  }
+  YAML::Node component;
+  component["storage"] = "sparse";
+  component["parent"]  = "integer";
+  component["x"]       = "real";
+  component["y"]       = "real";
+  component["theta"]   = "real";
+  loadComponent("hierarchy", component);
+  _hierarchy = world;
+}
+
+void module::loadAggregate(std::string key, YAML::Node &aggregate)
+{
+  if (!aggregate.IsMap()) {
+    throw nebulaException("Invalid aggregate " + key + ": not type Map");
+  }
+  if (!aggregate["component"]) {
+    throw nebulaException("Invalid aggregate " + key + ": no component field");
+  }
+  aggregateInfo info;
+  info._component = aggregate["component"].as<std::string>();
+  info._column    = aggregate["sum"].as<std::string, std::string>("");
+  if (_aggregateInfo.count(key) == 0) {
+    _aggregateOrder.emplace_back(key);
+  }
+  _aggregateInfo[key] = info;
+}
+
+// expire: names the table the entity is deleted from, either entity itself
+// or one of its components; run: gives a statement of the module's own.
+void module::loadTimer(std::string key, YAML::Node &timer)
+{
+  if (!timer.IsMap()) {
+    throw nebulaException("Invalid timer " + key + ": not type Map");
+  }
+  if (!timer["after"]) {
+    throw nebulaException("Invalid timer " + key + ": no after field");
+  }
+  if (!timer["expire"] == !timer["run"]) {
+    throw nebulaException("Invalid timer " + key + ": needs expire or run");
+  }
+  timerInfo info;
+  info._component = timer["component"].as<std::string, std::string>("");
+  info._after     = timer["after"].as<double>();
+  if (timer["expire"]) {
+    info._sql = "DELETE FROM " + timer["expire"].as<std::string>()
+              + " WHERE entity = :entity;";
+  } else {
+    info._sql = timer["run"].as<std::string>();
+  }
+  if (_timerInfo.count(key) == 0) {
+    _timerOrder.emplace_back(key);
+  }
+  _timerInfo[key] = info;
+}
+
+// The pool's tag is declared here unless the module already has it.
+void module::loadPool(std::string key, YAML::Node &pool)
+{
+  if (!pool.IsMap()) {
+    throw nebulaException("Invalid pool " + key + ": not type Map");
+  }
+  if (!pool["size"] || pool["size"].as<long long>() <= 0) {
+    throw nebulaException("Invalid pool " + key + ": size must be positive");
+  }
+  if (_componentColumns.count(key) == 0) {
+    YAML::Node tag;
+    loadComponent(key, tag);
+  } else if (!_componentColumns[key].empty()) {
+    throw nebulaException(
+        "Invalid pool " + key + ": component " + key + " is not a tag");
+  }
+  poolInfo info;
+  info._size = pool["size"].as<size_t>();
+  std::string range
+      = "WITH RECURSIVE pool(entity) AS (SELECT :first UNION ALL SELECT "
+        "entity + 1 FROM pool WHERE entity < :last) ";
+  info._populate.emplace_back(
+      range + "INSERT INTO entity (entity) SELECT entity FROM pool;");
+  if (pool["components"]) {
+    if (!pool["components"].IsMap()) {
+      throw nebulaException("Invalid pool " + key + ": components not a Map");
+    }
+    for (auto component = pool["components"].begin();
+         component != pool["components"].end();
+         ++component)
+    {
+      auto name = component->first.as<std::string>();
+      if (_componentColumns.count(name) == 0) {
+        throw nebulaException("Invalid pool " + key + ": component " + name
+                              + " must be declared first");
+      }
+      std::string columns = "entity";
+      std::string values  = "entity";
+      if (component->second.IsMap()) {
+        for (auto value = component->second.begin();
+             value != component->second.end();
+             ++value)
+        {
+          columns += ", " + value->first.as<std::string>();
+          values += ", " + value->second.as<std::string>();
+        }
+      }
+      info._populate.emplace_back(range + "INSERT OR REPLACE INTO " + name
+                                  + " (" + columns + ") SELECT " + values
+                                  + " FROM pool;");
+    }
+  }
+  if (_poolInfo.count(key) == 0) {
+    _poolOrder.emplace_back(key);
+  }
+  _poolInfo[key] = info;
+}
+
+// An event channel is a map of typed columns like a component's, without
+// the entity key, and an optional capacity: the events it holds per tick
+// before the oldest are overwritten.
+void module::loadEvent(std::string key, YAML::Node &event)
+{
+  if (!event.IsMap() || event.size() == 0) {
+    throw nebulaException("Invalid event " + key + ": no columns");
+  }
+  if (_componentSQL.count(key) > 0) {
+    throw nebulaException(
+        "Invalid event " + key + ": name taken by a component");
+  }
+  long long capacity = 1024;
+  std::string columns;
+  for (auto value = event.begin(); value != event.end(); ++value) {
+    if (value->first.as<std::string>() == "capacity") {
+      capacity = value->second.as<long long>();
+      if (capacity < 1) {
+        throw nebulaException(
+            "Invalid event " + key + ": capacity must be positive");
+      }
+      continue;
+    }
+    std::string upper;
+    for (auto &c : value->second.as<std::string>())
+      upper += std::toupper(c);
+    if (upper != "INTEGER" && upper != "REAL") {
+      throw nebulaException("Invalid event " + key
+                            + ": columns must be integer or real");
+    }
+    columns += ", " + value->first.as<std::string>() + " " + upper;
+  }
+  if (columns.empty()) {
+    throw nebulaException("Invalid event " + key + ": no columns");
+  }
+  if (_eventSQL.count(key) == 0) {
+    _eventOrder.emplace_back(key);
   }
+  _eventSQL[key] = "CREATE VIRTUAL TABLE " + key + " USING event_channel("
+                 + std::to_string(capacity) + columns + ");";
 }
 
 void module::loadComponent(std::string key, YAML::Node &component)
 {
-  if (!component.IsMap()) {
+  bool tag
+      = component.IsNull() || (component.IsMap() && component.size() == 0);
+  if (!tag && !component.IsMap()) {
     throw nebulaException("Invalid component " + key + ": not type Map");
   }
-  std::string sql = "CREATE TABLE " + key
-                  + " (entity INTEGER PRIMARY KEY "
-                    "REFERENCES entity(entity) ON DELETE CASCADE";
-  for (auto value = component.begin(); value != component.end(); ++value) {
+  std::string columns;
+  bool packed = false;
+  bool sparse = false;
+  std::vector<std::pair<std::string, std::string>> columnTypes;
+  for (auto value = component.begin(); !tag && value != component.end();
+       ++value)
+  {
     const std::string &dtype = value->second.as<std::string>();
-    sql += ", " + value->first.as<std::string>() + " ";
+    if (value->first.as<std::string>() == "storage") {
+      if (dtype != "sparse" && dtype != "table") {
+        throw nebulaException("Invalid component " + key
+                              + ": storage must be sparse or table");
+      }
+      sparse = dtype == "sparse";
+      continue;
+    }
+    std::string upper;
     for (auto &c : dtype)
-      sql += std::toupper(c);
+      upper += std::toupper(c);
+    columns += ", " + value->first.as<std::string>() + " " + upper;
+    columnTypes.emplace_back(value->first.as<std::string>(), upper);
+    packed = packed || upper == "F32";
+  }
+  std::string sql;
+  if (tag) {
+    // A component without columns is a tag, held as a bitset over entities;
+    // like packed storage it needs a trigger to follow entity deletion.
+    sql = "CREATE VIRTUAL TABLE " + key + " USING tag_set; CREATE TRIGGER "
+        + key + "_entity_delete AFTER DELETE ON entity BEGIN DELETE FROM "
+        + key + " WHERE entity = old.entity; END;";
+  } else if (sparse) {
+    if (packed) {
+      throw nebulaException(
+          "Invalid component " + key + ": sparse storage cannot pack f32");
+    }
+    // Rare components skip the B-tree for a sparse set, which like packed
+    // storage cascades entity deletion with a trigger.
+    sql = "CREATE VIRTUAL TABLE " + key + " USING sparse_set("
+        + columns.substr(std::min<size_t>(2, columns.size()))
+        + "); CREATE TRIGGER " + key
+        + "_entity_delete AFTER DELETE ON entity BEGIN DELETE FROM " + key
+        + " WHERE entity = old.entity; END;";
+  } else if (packed) {
+    // f32 columns live in native packed storage, which cannot take part in
+    // foreign keys, so entity deletion is cascaded with a trigger instead.
+    sql = "CREATE VIRTUAL TABLE " + key + " USING column_store("
+        + columns.substr(2) + "); CREATE TRIGGER " + key
+        + "_entity_delete AFTER DELETE ON entity BEGIN DELETE FROM " + key
+        + " WHERE entity = old.entity; END;";
+  } else {
+    sql = "CREATE TABLE " + key
+        + " (entity INTEGER PRIMARY KEY "
+          "REFERENCES entity(entity) ON DELETE CASCADE"
+        + columns + ");";
+  }
+  if (_componentSQL.count(key) == 0) {
+    _componentOrder.emplace_back(key);
+  }
+  _componentSQL[key]     = sql;
+  _componentColumns[key] = columnTypes;
+}
+
+// The previous-tick copy has the component's columns but no foreign key or
+// triggers; the engine refreshes it wholesale at the start of every tick.
+void module::loadBuffers(YAML::Node &buffers)
+{
+  if (!buffers.IsSequence()) {
+    throw nebulaException("Invalid double_buffer section: not type Sequence");
+  }
+  for (auto value : buffers) {
+    auto key = value.as<std::string>();
+    if (_componentColumns.count(key) == 0) {
+      throw nebulaException("Invalid double_buffer " + key
+                            + ": component must be declared first");
+    }
+    if (_componentColumns[key].empty()) {
+      throw nebulaException(
+          "Invalid double_buffer " + key + ": a tag has no columns to buffer");
+    }
+    std::string columns;
+    bool packed = false;
+    for (const auto &[name, type] : _componentColumns[key]) {
+      columns += ", " + name + " " + type;
+      packed = packed || type == "F32";
+    }
+    std::string sql;
+    if (packed) {
+      sql = "CREATE VIRTUAL TABLE " + key + "_prev USING column_store("
+          + columns.substr(2) + ");";
+    } else {
+      sql = "CREATE TABLE " + key + "_prev (entity INTEGER PRIMARY KEY"
+          + columns + ");";
+    }
+    if (_bufferSQL.count(key) == 0) {
+      _bufferOrder.emplace_back(key);
+    }
+    _bufferSQL[key] = sql;
   }
-  sql += ");";
-  _componentSQL[key] = sql;
 }
 
 void module::loadSystem(std::string key, YAML::Node &system)
@@ -194,52 +920,295 @@ void module::loadSystem(std::string key, YAML::Node &system)
     if (!update["set"]) {
       throw nebulaException("Invalid system " + key + ": no set field");
     }
+    systemInfo info;
+    info._component = update["component"].as<std::string>();
+    info._native    = update["native"].as<bool, bool>(false);
+    info._math      = _math;
+    if (update["trigger"]) {
+      YAML::Node trigger = update["trigger"];
+      if (!trigger["component"] || !trigger["count"]) {
+        throw nebulaException(
+            "Invalid system " + key + ": trigger needs component and count");
+      }
+      info._triggerComponent = trigger["component"].as<std::string>();
+      info._triggerCount     = "count " + trigger["count"].as<std::string>();
+    }
+    if (update["slice"]) {
+      int slice = update["slice"].as<int>();
+      if (slice < 1) {
+        throw nebulaException(
+            "Invalid system " + key + ": slice must be at least 1");
+      }
+      info._slice = slice;
+    }
+    if (update["every_n_ticks"]) {
+      int period = update["every_n_ticks"].as<int>();
+      if (period < 1) {
+        throw nebulaException(
+            "Invalid system " + key + ": every_n_ticks must be at least 1");
+      }
+      info._period = period;
+    }
+    if (update["parallel"]) {
+      int workers = update["parallel"].as<int>();
+      if (workers < 1 || !info._native) {
+        throw nebulaException("Invalid system " + key
+                              + ": parallel needs native and at least 1");
+      }
+      info._workers = workers;
+    }
     YAML::Node set = update["set"];
-    std::string sql
-        = "UPDATE " + update["component"].as<std::string>() + " SET ";
     for (auto value = set.begin(); value != set.end(); ++value) {
-      if (value != set.begin()) {
-        sql += ", ";
-      }
-      sql += value->first.as<std::string>() + " = "
-           + value->second.as<std::string>();
+      info._set.emplace_back(
+          value->first.as<std::string>(), value->second.as<std::string>());
     }
     if (update["entity_join"]) {
-      YAML::Node join = update["entity_join"];
-      sql += " FROM ";
-      for (auto value = join.begin(); value != join.end(); ++value) {
-        if (value != join.begin()) {
-          sql += " JOIN ";
-        }
-        auto component = value->second.as<std::string>();
-        auto name      = value->first.as<std::string>();
-        if (component != name) {
-          sql += component + " AS ";
-        }
-        sql += name;
-        if (value != join.begin()) {
-          sql += " USING (entity)";
-        }
-      }
+      entityJoinSQL(update["entity_join"], info._join);
     }
     if (update["require"]) {
       YAML::Node require = update["require"];
-      sql += " WHERE ";
       for (auto value = require.begin(); value != require.end(); ++value) {
-        if (value != require.begin()) {
-          sql += ", ";
+        if (value->first.as<std::string>() == "active") {
+          info._activeOnly = value->second.as<bool>();
+          continue;
+        }
+        if (value->first.as<std::string>() == "entity_has") {
+          if (value->second.IsSequence()) {
+            for (auto component : value->second) {
+              info._has.emplace_back(component.as<std::string>());
+            }
+          } else {
+            info._has.emplace_back(value->second.as<std::string>());
+          }
+          continue;
+        }
+        std::string clause = value->first.as<std::string>() + " ";
+        if (value->second.IsNull()) {
+          clause += "IS NULL";
+        } else {
+          clause += value->second.as<std::string>();
         }
-        sql += value->first.as<std::string>() + " "
-             + value->second.as<std::string>();
+        info._require.emplace_back(clause);
       }
     }
+    if (_bufferSQL.count(info._component) > 0) {
+      info._buffered.emplace_back(info._component);
+    }
+    for (const auto &[alias, component] : info._join) {
+      if (_bufferSQL.count(component) > 0
+          && std::find(info._buffered.begin(), info._buffered.end(), component)
+                 == info._buffered.end())
+      {
+        info._buffered.emplace_back(component);
+      }
+    }
+    std::string sql = info._buffered.empty() ? updateSQL(info)
+                                             : bufferedUpdateSQL(info);
     sql += ";";
-    _systemSQL[key] = sql;
+    if (_systemSQL.count(key) == 0) {
+      _systemOrder.emplace_back(key);
+    }
+    _systemSQL[key]  = sql;
+    _systemInfo[key] = info;
     return;
   }
   throw nebulaException("No valid system configuration found for " + key);
 }
 
+// The offset of the first character after any whitespace and comments
+// starting at i.
+static size_t skipComments(const std::string &sql, size_t i)
+{
+  while (i < sql.size()) {
+    if (std::isspace(static_cast<unsigned char>(sql[i]))) {
+      ++i;
+    } else if (sql.compare(i, 2, "--") == 0) {
+      i = sql.find('\n', i);
+    } else if (sql.compare(i, 2, "/*") == 0) {
+      i = sql.find("*/", i + 2);
+      i = i == std::string::npos ? i : i + 2;
+    } else {
+      break;
+    }
+  }
+  return std::min(i, sql.size());
+}
+
+// Up to count leading keywords of a statement, in upper case.
+static std::vector<std::string> leadingWords(
+    const std::string &sql, size_t count)
+{
+  std::vector<std::string> words;
+  size_t i = skipComments(sql, 0);
+  while (words.size() < count && i < sql.size()
+         && std::isalpha(static_cast<unsigned char>(sql[i])))
+  {
+    std::string word;
+    while (i < sql.size()
+           && (std::isalnum(static_cast<unsigned char>(sql[i]))
+               || sql[i] == '_'))
+    {
+      word += std::toupper(static_cast<unsigned char>(sql[i++]));
+    }
+    words.emplace_back(word);
+    i = skipComments(sql, i);
+  }
+  return words;
+}
+
+// Statements are split where sqlite3_complete() sees one end, so semicolons
+// in strings, comments and trigger bodies are left alone. CREATE statements
+// are setup run once; the rest run every tick. A transaction in the file
+// cannot nest in the tick's, so BEGIN starts a savepoint named after the
+// system, COMMIT or END releases it and ROLLBACK undoes the work since.
+void module::loadProgram(std::string key, const std::string &sql)
+{
+  systemInfo info;
+  info._native          = false;
+  info._math            = _math;
+  std::string savepoint = "\"" + key + "\"";
+  bool open             = false;
+  std::string statement;
+  for (size_t i = 0; i <= sql.size(); ++i) {
+    if (i < sql.size()) {
+      statement += sql[i];
+      if (sql[i] != ';' || !sqlite3_complete(statement.c_str())) {
+        continue;
+      }
+    }
+    auto words = leadingWords(statement, 3);
+    statement  = statement.substr(skipComments(statement, 0));
+    if (words.empty()) {
+      if (statement.empty() || statement == ";") {
+        statement.clear();
+        continue;
+      }
+      throw nebulaException("Invalid statement in system " + key + ": "
+                            + statement);
+    }
+    if (i == sql.size()) {
+      throw nebulaException("Unterminated statement in system " + key + ": "
+                            + statement);
+    }
+    bool rollbackTo = std::find(words.begin() + 1, words.end(), "TO")
+                   != words.end();
+    if (words[0] == "BEGIN") {
+      if (open) {
+        throw nebulaException("Nested transaction in system " + key);
+      }
+      open = true;
+      info._program.emplace_back("SAVEPOINT " + savepoint + ";");
+    } else if (words[0] == "COMMIT" || words[0] == "END"
+               || (words[0] == "ROLLBACK" && !rollbackTo))
+    {
+      if (!open) {
+        throw nebulaException(
+            words[0] + " outside of a transaction in system " + key);
+      }
+      open = false;
+      if (words[0] == "ROLLBACK") {
+        info._program.emplace_back("ROLLBACK TO " + savepoint + ";");
+      }
+      info._program.emplace_back("RELEASE " + savepoint + ";");
+    } else if (words[0] == "CREATE") {
+      info._setup.emplace_back(statement);
+    } else {
+      info._program.emplace_back(statement);
+    }
+    statement.clear();
+  }
+  if (open) {
+    throw nebulaException("Unterminated transaction in system " + key);
+  }
+  std::string program;
+  for (const auto &line : info._program) {
+    program += (program.empty() ? "" : "\n") + line;
+  }
+  if (_systemSQL.count(key) == 0) {
+    _systemOrder.emplace_back(key);
+  }
+  _systemSQL[key]  = program;
+  _systemInfo[key] = info;
+}
+
+void module::loadRender(std::string key, YAML::Node &render)
+{
+  if (!render.IsMap()) {
+    throw nebulaException("Invalid render " + key + ": not type Map");
+  }
+  if (!render["entity_join"]) {
+    throw nebulaException("Invalid render " + key + ": no entity_join field");
+  }
+  if (!render["data"] || !render["data"].IsSequence()) {
+    throw nebulaException("Invalid render " + key + ": no data list");
+  }
+  std::string sql = "SELECT ";
+  YAML::Node data = render["data"];
+  for (auto value = data.begin(); value != data.end(); ++value) {
+    if (value != data.begin()) {
+      sql += ", ";
+    }
+    sql += value->as<std::string>();
+  }
+  std::vector<std::pair<std::string, std::string>> tables;
+  sql += " FROM " + entityJoinSQL(render["entity_join"], tables) + ";";
+  std::vector<std::string> inputs;
+  for (const auto &table : tables) {
+    inputs.emplace_back(table.second);
+  }
+  if (_renderSQL.count(key) == 0) {
+    _renderOrder.emplace_back(key);
+  }
+  _renderSQL[key]    = sql;
+  _renderInputs[key] = inputs;
+}
+
+void module::loadView(std::string key, YAML::Node &view)
+{
+  if (!view.IsMap()) {
+    throw nebulaException("Invalid view " + key + ": not type Map");
+  }
+  if (!view["entity_join"]) {
+    throw nebulaException("Invalid view " + key + ": no entity_join field");
+  }
+  if (!view["data"] || !view["data"].IsSequence()) {
+    throw nebulaException("Invalid view " + key + ": no data list");
+  }
+  viewInfo info;
+  std::vector<std::pair<std::string, std::string>> tables;
+  std::string from = entityJoinSQL(view["entity_join"], tables);
+  info._select     = "SELECT " + tables.front().first + ".entity AS entity";
+  info._create     = "CREATE TABLE " + key + " (entity INTEGER PRIMARY KEY";
+  for (auto value : view["data"]) {
+    auto data = value.as<std::string>();
+    // The stored column is named by an explicit alias, or else by the
+    // referenced column without its table qualifier.
+    std::string column = data;
+    std::string upper;
+    for (auto c : data) {
+      upper += std::toupper(c);
+    }
+    auto alias = upper.rfind(" AS ");
+    if (alias != std::string::npos) {
+      column = data.substr(alias + 4);
+    } else if (data.find('.') != std::string::npos) {
+      column = data.substr(data.rfind('.') + 1);
+    }
+    info._columns.emplace_back(column);
+    info._select += ", " + data;
+    info._create += ", " + column;
+  }
+  info._select += " FROM " + from;
+  info._create += ");";
+  for (const auto &table : tables) {
+    info._inputs.emplace_back(table.second);
+  }
+  if (_viewInfo.count(key) == 0) {
+    _viewOrder.emplace_back(key);
+  }
+  _viewInfo[key] = info;
+}
+
 const std::string module::getComponentSQL(const std::string &component)
 {
   if (_componentSQL.count(component) > 0)
@@ -248,6 +1217,25 @@ const std::string module::getComponentSQL(const std::string &component)
       "Component '" + component + "' does not exist in module '" + _name + "'");
 }
 
+std::string module::readTable(
+    const systemInfo &system, const std::string &component)
+{
+  bool buffered = std::find(system._buffered.begin(),
+                      system._buffered.end(),
+                      component)
+               != system._buffered.end();
+  return buffered ? component + "_prev" : component;
+}
+
+const std::string module::getBufferSQL(const std::string &component)
+{
+  if (_bufferSQL.count(component) > 0)
+    return _bufferSQL.at(component);
+  throw nebulaException("Component '" + component
+                        + "' is not double-buffered in module '" + _name
+                        + "'");
+}
+
 const std::string module::getSystemSQL(const std::string &system)
 {
   if (_systemSQL.count(system) > 0)
@@ -256,4 +1244,109 @@ const std::string module::getSystemSQL(const std::string &system)
       "System '" + system + "' does not exist in module '" + _name + "'");
 }
 
+// Emits C++ structs mirroring this module's components along with the
+// componentTraits specializations used by ecs::query<>().
+std::string module::componentHeader() const
+{
+  std::string guard = "NEBULA_COMPONENTS_";
+  for (auto c : _identifier) {
+    guard += std::isalnum(c) ? std::toupper(c) : '_';
+  }
+  guard += "_H";
+  std::string header
+      = "// Generated by componentgen from module '" + _identifier
+      + "'. Do not edit.\n\n#ifndef " + guard + "\n#define " + guard
+      + "\n\n#include <string>\n#include \"query.h\"\n\nnamespace "
+        "nebula::components {\n";
+  std::string traits = "namespace nebula {\n";
+  for (const auto &component : _componentOrder) {
+    header += "\nstruct " + component + " {\n";
+    traits += "\ntemplate <>\nstruct componentTraits<components::" + component
+            + "> {\n  static constexpr const char *name = \"" + component
+            + "\";\n  static constexpr auto fields = std::make_tuple(";
+    const auto &columns = _componentColumns.at(component);
+    for (size_t i = 0; i < columns.size(); ++i) {
+      const auto &[name, dtype] = columns[i];
+      std::string type          = dtype == "F32"       ? "float"
+                                : dtype == "INTEGER" ? "sqlite3_int64"
+                                : dtype == "TEXT"    ? "std::string"
+                                                     : "double";
+      header += "  " + type + " " + name + ";\n";
+      traits += std::string(i > 0 ? "," : "") + "\n      makeField(\"" + name
+              + "\", &components::" + component + "::" + name + ")";
+    }
+    header += "};\n";
+    traits += ");\n};\n";
+  }
+  header += "\n} // namespace nebula::components\n\n" + traits
+          + "\n} // namespace nebula\n\n#endif // " + guard + "\n";
+  return header;
+}
+
+const module::systemInfo &module::getSystemInfo(const std::string &system)
+{
+  if (_systemInfo.count(system) > 0)
+    return _systemInfo.at(system);
+  throw nebulaException(
+      "System '" + system + "' does not exist in module '" + _name + "'");
+}
+
+const std::string module::getRenderSQL(const std::string &render)
+{
+  if (_renderSQL.count(render) > 0)
+    return _renderSQL.at(render);
+  throw nebulaException(
+      "Render '" + render + "' does not exist in module '" + _name + "'");
+}
+
+const std::vector<std::string> &module::getRenderInputs(
+    const std::string &render)
+{
+  if (_renderInputs.count(render) > 0)
+    return _renderInputs.at(render);
+  throw nebulaException(
+      "Render '" + render + "' does not exist in module '" + _name + "'");
+}
+
+const module::timerInfo &module::getTimerInfo(const std::string &timer)
+{
+  if (_timerInfo.count(timer) > 0)
+    return _timerInfo.at(timer);
+  throw nebulaException(
+      "Timer '" + timer + "' does not exist in module '" + _name + "'");
+}
+
+const module::poolInfo &module::getPoolInfo(const std::string &pool)
+{
+  if (_poolInfo.count(pool) > 0)
+    return _poolInfo.at(pool);
+  throw nebulaException(
+      "Pool '" + pool + "' does not exist in module '" + _name + "'");
+}
+
+const std::string module::getEventSQL(const std::string &event)
+{
+  if (_eventSQL.count(event) > 0)
+    return _eventSQL.at(event);
+  throw nebulaException(
+      "Event '" + event + "' does not exist in module '" + _name + "'");
+}
+
+const module::aggregateInfo &module::getAggregateInfo(
+    const std::string &aggregate)
+{
+  if (_aggregateInfo.count(aggregate) > 0)
+    return _aggregateInfo.at(aggregate);
+  throw nebulaException("Aggregate '" + aggregate
+                        + "' does not exist in module '" + _name + "'");
+}
+
+const module::viewInfo &module::getViewInfo(const std::string &view)
+{
+  if (_viewInfo.count(view) > 0)
+    return _viewInfo.at(view);
+  throw nebulaException(
+      "View '" + view + "' does not exist in module '" + _name + "'");
+}
+
 } // namespace nebula
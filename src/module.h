@@ -6,21 +6,116 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <utility>
+#include "trig.h"
 #include "yaml-cpp/yaml.h"
 
 namespace nebula {
 
 class module {
+public:
+  struct systemInfo {
+    std::string _component;
+    std::vector<std::pair<std::string, std::string>> _join;
+    std::vector<std::pair<std::string, std::string>> _set;
+    std::vector<std::string> _require;
+    bool _native;
+    trig::precision _math = trig::precision::precise;
+    // Run only while the trigger component's row count satisfies the
+    // condition, e.g. "count < 1"; empty when the system always runs.
+    std::string _triggerComponent;
+    std::string _triggerCount;
+    // Double-buffered components among the target and joins; the system
+    // reads their previous-tick copy, <component>_prev.
+    std::vector<std::string> _buffered;
+    // Entities per slice when the system may be spread over several ticks
+    // to stay within the tick budget; 0 when it always runs whole.
+    size_t _slice = 0;
+    // Entity ranges a native kernel evaluates concurrently
+    size_t _workers = 1;
+    // Run once every _period ticks rather than on every tick
+    size_t _period = 1;
+    // Restrict the system to entities in the active set
+    bool _activeOnly = false;
+    // Components the entity must have, from require: entity_has
+    std::vector<std::string> _has;
+    // Systems loaded from a .sql include have no component. Their _setup
+    // statements create schema once at load, and _program is prepared after
+    // them and run in order on every tick.
+    std::vector<std::string> _setup;
+    std::vector<std::string> _program;
+  };
+
+  struct viewInfo {
+    std::string _create;
+    std::string _select;
+    std::vector<std::string> _inputs;
+    std::vector<std::string> _columns;
+  };
+
+  // A sum over a component column, or a row count when _column is empty.
+  struct aggregateInfo {
+    std::string _component;
+    std::string _column;
+  };
+
+  // A statement run for an entity _after seconds of simulation time after
+  // the timer is armed for it, with the entity bound to :entity. Rows added
+  // to _component arm it and removing them disarms it; without a component
+  // it is only armed through schedule_timer().
+  struct timerInfo {
+    std::string _component;
+    double _after = 0.0;
+    std::string _sql;
+  };
+
+  // _size entities created together the first time the pool is spawned
+  // from. _populate inserts them, then their components, over the entities
+  // :first to :last; the tag named after the pool marks those in use. The
+  // components are inserted OR REPLACE, so that the same statements over a
+  // single entity reset it when it is spawned again.
+  struct poolInfo {
+    size_t _size = 0;
+    std::vector<std::string> _populate;
+  };
+
 private:
   std::string _rootPath;
   bool _load;
   std::string _identifier;
   std::string _name;
   std::string _tags;
+  trig::precision _math = trig::precision::precise;
   std::vector<std::string> _dependencies;
   std::vector<std::string> _includes;
+  std::map<std::string, double> _params;
+  std::map<std::string, std::string> _vars;
+  std::map<std::string, std::string> _activity;
+  size_t _sleepAfter = 0;
+  std::string _hierarchy;
   std::map<std::string, std::string> _componentSQL;
+  std::map<std::string, std::vector<std::pair<std::string, std::string>>>
+      _componentColumns;
   std::map<std::string, std::string> _systemSQL;
+  std::map<std::string, systemInfo> _systemInfo;
+  std::map<std::string, std::string> _renderSQL;
+  std::map<std::string, std::vector<std::string>> _renderInputs;
+  std::map<std::string, viewInfo> _viewInfo;
+  std::map<std::string, aggregateInfo> _aggregateInfo;
+  std::map<std::string, std::string> _bufferSQL;
+  std::map<std::string, timerInfo> _timerInfo;
+  std::map<std::string, poolInfo> _poolInfo;
+  std::map<std::string, std::string> _eventSQL;
+  std::vector<std::string> _componentOrder;
+  std::vector<std::string> _systemOrder;
+  std::vector<std::string> _renderOrder;
+  std::vector<std::string> _viewOrder;
+  std::vector<std::string> _aggregateOrder;
+  std::vector<std::string> _bufferOrder;
+  std::vector<std::string> _timerOrder;
+  std::vector<std::string> _poolOrder;
+  std::vector<std::string> _eventOrder;
 
 public:
   module(const std::string &path, bool shouldLoad = false);
@@ -38,6 +133,13 @@ public:
     return _name;
   }
 
+  // Precision of sin() and cos() in this module's systems, from the
+  // manifest's math field: fast, deterministic or precise (the default).
+  trig::precision math() const
+  {
+    return _math;
+  }
+
   const std::vector<std::string> &dependencies() const
   {
     return _dependencies;
@@ -53,11 +155,120 @@ public:
     _load = shouldLoad;
   }
 
+  // Values for the $name parameters used in system and render SQL.
+  const std::map<std::string, double> &params() const
+  {
+    return _params;
+  }
+
+  // Initial values of global variables, as written in the YAML.
+  const std::map<std::string, std::string> &vars() const
+  {
+    return _vars;
+  }
+
+  // Components whose writes wake an entity, each with the condition that
+  // keeps it awake, e.g. mobile: "vel > 0.0 OR accel != 0.0".
+  const std::map<std::string, std::string> &activity() const
+  {
+    return _activity;
+  }
+
+  // Ticks an entity stays active without meeting any condition or being
+  // written; 0 when the module does not set it.
+  size_t sleepAfter() const
+  {
+    return _sleepAfter;
+  }
+
+  // The component holding world transforms computed from the hierarchy
+  // component, or empty when the module declares no hierarchy.
+  const std::string &hierarchy() const
+  {
+    return _hierarchy;
+  }
+
+  const std::vector<std::string> &components() const
+  {
+    return _componentOrder;
+  }
+
+  const std::vector<std::string> &systems() const
+  {
+    return _systemOrder;
+  }
+
+  const std::vector<std::string> &renders() const
+  {
+    return _renderOrder;
+  }
+
+  const std::vector<std::string> &views() const
+  {
+    return _viewOrder;
+  }
+
+  const std::vector<std::string> &aggregates() const
+  {
+    return _aggregateOrder;
+  }
+
+  // Components listed under double_buffer, which keep a copy of their
+  // rows as of the end of the previous tick.
+  const std::vector<std::string> &buffers() const
+  {
+    return _bufferOrder;
+  }
+
+  const std::vector<std::string> &timers() const
+  {
+    return _timerOrder;
+  }
+
+  const std::vector<std::string> &pools() const
+  {
+    return _poolOrder;
+  }
+
+  // Event channels, which hold the events appended to them for one tick.
+  const std::vector<std::string> &events() const
+  {
+    return _eventOrder;
+  }
+
   void loadModule();
+  void loadParams(YAML::Node &params);
+  void loadVars(YAML::Node &vars);
+  void loadActivity(YAML::Node &activity);
   void loadComponent(std::string key, YAML::Node &component);
+  void loadBuffers(YAML::Node &buffers);
   void loadSystem(std::string key, YAML::Node &system);
+  // Splits the text of a .sql include into the system program key. Its
+  // BEGIN ... COMMIT blocks become savepoints within the tick transaction.
+  void loadProgram(std::string key, const std::string &sql);
+  void loadRender(std::string key, YAML::Node &render);
+  void loadView(std::string key, YAML::Node &view);
+  void loadAggregate(std::string key, YAML::Node &aggregate);
+  void loadTimer(std::string key, YAML::Node &timer);
+  void loadPool(std::string key, YAML::Node &pool);
+  void loadEvent(std::string key, YAML::Node &event);
+  void loadHierarchy(YAML::Node &hierarchy);
   const std::string getComponentSQL(const std::string &component);
+  std::string componentHeader() const;
+  const std::string getBufferSQL(const std::string &component);
+  // The table a system reads a component from: its previous-tick copy when
+  // the component is double-buffered, the component itself otherwise.
+  static std::string readTable(
+      const systemInfo &system, const std::string &component);
   const std::string getSystemSQL(const std::string &system);
+  const systemInfo &getSystemInfo(const std::string &system);
+  const std::string getRenderSQL(const std::string &render);
+  const std::vector<std::string> &getRenderInputs(const std::string &render);
+  const viewInfo &getViewInfo(const std::string &view);
+  const aggregateInfo &getAggregateInfo(const std::string &aggregate);
+  const timerInfo &getTimerInfo(const std::string &timer);
+  const poolInfo &getPoolInfo(const std::string &pool);
+  const std::string getEventSQL(const std::string &event);
 };
 
 } // namespace nebula
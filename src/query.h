@@ -0,0 +1,179 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_QUERY_H
+#define NEBULA_QUERY_H
+
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <utility>
+
+extern "C" {
+#include "sqlite3.h"
+}
+
+namespace nebula {
+
+template <typename C, typename M>
+struct field {
+  const char *_name;
+  M C::*_member;
+};
+
+template <typename C, typename M>
+constexpr field<C, M> makeField(const char *name, M C::*member)
+{
+  return {name, member};
+}
+
+// Specialized for every component struct, normally by the header that
+// module::componentHeader() generates. A specialization provides
+//   static constexpr const char *name;
+//   static constexpr auto fields = std::make_tuple(makeField(...), ...);
+template <typename T>
+struct componentTraits;
+
+namespace detail {
+
+inline void readColumn(sqlite3_stmt *stmt, int col, double &value)
+{
+  value = sqlite3_column_double(stmt, col);
+}
+
+inline void readColumn(sqlite3_stmt *stmt, int col, float &value)
+{
+  value = static_cast<float>(sqlite3_column_double(stmt, col));
+}
+
+inline void readColumn(sqlite3_stmt *stmt, int col, sqlite3_int64 &value)
+{
+  value = sqlite3_column_int64(stmt, col);
+}
+
+inline void readColumn(sqlite3_stmt *stmt, int col, int &value)
+{
+  value = sqlite3_column_int(stmt, col);
+}
+
+inline void readColumn(sqlite3_stmt *stmt, int col, std::string &value)
+{
+  auto text = sqlite3_column_text(stmt, col);
+  value.assign(text ? reinterpret_cast<const char *>(text) : "",
+      sqlite3_column_bytes(stmt, col));
+}
+
+template <typename T>
+void readComponent(sqlite3_stmt *stmt, int &col, T &component)
+{
+  std::apply(
+      [&](const auto &...fields) {
+        (readColumn(stmt, col++, component.*(fields._member)), ...);
+      },
+      componentTraits<T>::fields);
+}
+
+template <typename T>
+void appendColumns(std::string &sql)
+{
+  std::apply(
+      [&](const auto &...fields) {
+        ((sql += std::string(", ") + componentTraits<T>::name + "."
+                 + fields._name),
+            ...);
+      },
+      componentTraits<T>::fields);
+}
+
+} // namespace detail
+
+// Typed view over the entities that have every component in Ts. The
+// statement is prepared and cached by the ecs; iterating steps it and fills
+// one row of component structs at a time.
+template <typename... Ts>
+class typedQuery {
+public:
+  using row = std::tuple<sqlite3_int64, Ts...>;
+
+  class iterator {
+  private:
+    sqlite3_stmt *_stmt;
+    row _row;
+
+    void step()
+    {
+      if (sqlite3_step(_stmt) != SQLITE_ROW) {
+        sqlite3_reset(_stmt);
+        _stmt = nullptr;
+        return;
+      }
+      std::get<0>(_row) = sqlite3_column_int64(_stmt, 0);
+      int col           = 1;
+      std::apply(
+          [&](sqlite3_int64 &, Ts &...components) {
+            (detail::readComponent(_stmt, col, components), ...);
+          },
+          _row);
+    }
+
+  public:
+    explicit iterator(sqlite3_stmt *stmt) : _stmt(stmt)
+    {
+      if (_stmt) {
+        step();
+      }
+    }
+
+    const row &operator*() const
+    {
+      return _row;
+    }
+
+    iterator &operator++()
+    {
+      step();
+      return *this;
+    }
+
+    bool operator!=(const iterator &other) const
+    {
+      return _stmt != other._stmt;
+    }
+  };
+
+private:
+  sqlite3_stmt *_stmt;
+
+public:
+  explicit typedQuery(sqlite3_stmt *stmt) : _stmt(stmt) { }
+
+  static std::string sql()
+  {
+    using first = std::tuple_element_t<0, std::tuple<Ts...>>;
+    std::string sql
+        = std::string("SELECT ") + componentTraits<first>::name + ".entity";
+    (detail::appendColumns<Ts>(sql), ...);
+    sql += std::string(" FROM ") + componentTraits<first>::name;
+    ((std::string(componentTraits<Ts>::name) != componentTraits<first>::name
+             ? (sql += std::string(" JOIN ") + componentTraits<Ts>::name
+                       + " USING (entity)")
+             : sql),
+        ...);
+    return sql + " ORDER BY " + componentTraits<first>::name + ".entity;";
+  }
+
+  iterator begin()
+  {
+    sqlite3_reset(_stmt);
+    return iterator(_stmt);
+  }
+
+  iterator end()
+  {
+    return iterator(nullptr);
+  }
+};
+
+} // namespace nebula
+
+#endif // NEBULA_QUERY_H
@@ -0,0 +1,150 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "rng.h"
+
+// Unit Testing includes
+#include "doctest.h"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+SCENARIO("class rng")
+{
+  GIVEN("two generators with the same seed")
+  {
+    nebula::rng a(42);
+    nebula::rng b(42);
+    THEN("they produce the same sequence")
+    {
+      for (int i = 0; i < 100; ++i) {
+        REQUIRE(a.next() == b.next());
+      }
+    }
+    WHEN("one of them is reseeded after drawing")
+    {
+      uint64_t first = a.next();
+      a.next();
+      a.seed(42);
+      THEN("it starts the sequence over")
+      {
+        REQUIRE(a.next() == first);
+      }
+    }
+  }
+  GIVEN("a generator drawing bounded values")
+  {
+    nebula::rng r(7);
+    THEN("values stay within their bounds and cover the range")
+    {
+      bool seen[5] = {false, false, false, false, false};
+      for (int i = 0; i < 1000; ++i) {
+        double u = r.uniform();
+        REQUIRE(u >= 0.0);
+        REQUIRE(u < 1.0);
+        int64_t n = r.integer(-2, 2);
+        REQUIRE(n >= -2);
+        REQUIRE(n <= 2);
+        seen[n + 2] = true;
+      }
+      REQUIRE((seen[0] && seen[1] && seen[2] && seen[3] && seen[4]));
+      REQUIRE(r.integer(3, 3) == 3);
+    }
+  }
+  GIVEN("named streams from one seed")
+  {
+    THEN("each name gets its own reproducible sequence")
+    {
+      auto a = nebula::rng::stream(1, "update_location");
+      auto b = nebula::rng::stream(1, "spawn_asteroid");
+      REQUIRE(a.next() != b.next());
+      REQUIRE(nebula::rng::stream(1, "spawn_asteroid").next()
+              == nebula::rng::stream(1, "spawn_asteroid").next());
+    }
+  }
+}
+#endif
+
+namespace nebula {
+
+namespace {
+
+uint64_t splitmix64(uint64_t &x)
+{
+  uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+  z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z          = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+uint64_t rotl(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+} // namespace
+
+rng::rng(uint64_t seed)
+{
+  this->seed(seed);
+}
+
+rng rng::stream(uint64_t seed, const std::string &name)
+{
+  // FNV-1a of the name, mixed in after the seed went through splitmix64.
+  // XORing the two directly would let seeds that differ by the XOR of two
+  // name hashes swap streams.
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : name) {
+    hash = (hash ^ c) * 0x100000001b3ULL;
+  }
+  return rng(splitmix64(seed) ^ hash);
+}
+
+void rng::seed(uint64_t seed)
+{
+  for (auto &word : _state) {
+    word = splitmix64(seed);
+  }
+}
+
+uint64_t rng::next()
+{
+  uint64_t result = rotl(_state[1] * 5, 7) * 9;
+  uint64_t t      = _state[1] << 17;
+  _state[2] ^= _state[0];
+  _state[3] ^= _state[1];
+  _state[1] ^= _state[2];
+  _state[0] ^= _state[3];
+  _state[2] ^= t;
+  _state[3] = rotl(_state[3], 45);
+  return result;
+}
+
+double rng::uniform()
+{
+  return static_cast<double>(next() >> 11) * 0x1.0p-53;
+}
+
+double rng::uniform(double lo, double hi)
+{
+  return lo + (hi - lo) * uniform();
+}
+
+int64_t rng::integer(int64_t lo, int64_t hi)
+{
+  if (hi < lo) {
+    return lo;
+  }
+  uint64_t range = static_cast<uint64_t>(hi) - static_cast<uint64_t>(lo) + 1;
+  if (range == 0) {
+    return static_cast<int64_t>(next());
+  }
+  // Reject the low values that would make the modulo uneven
+  uint64_t threshold = (0 - range) % range;
+  uint64_t r;
+  do {
+    r = next();
+  } while (r < threshold);
+  return static_cast<int64_t>(static_cast<uint64_t>(lo) + r % range);
+}
+
+} // namespace nebula
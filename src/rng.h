@@ -0,0 +1,37 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_RNG_H
+#define NEBULA_RNG_H
+
+#include <cstdint>
+#include <string>
+
+namespace nebula {
+
+// xoshiro256** generator. The output depends only on the seed, so a world
+// seeded the same way replays the same sequence on every platform.
+class rng {
+private:
+  uint64_t _state[4];
+
+public:
+  explicit rng(uint64_t seed = 0);
+
+  // An independent stream for a named consumer such as a system. Streams
+  // depend on the name, not on creation order, so adding a system does not
+  // perturb the numbers any other system draws.
+  static rng stream(uint64_t seed, const std::string &name);
+
+  void seed(uint64_t seed);
+  uint64_t next();
+  // Uniform in [0, 1)
+  double uniform();
+  double uniform(double lo, double hi);
+  // Uniform over [lo, hi], without modulo bias
+  int64_t integer(int64_t lo, int64_t hi);
+};
+
+} // namespace nebula
+
+#endif // NEBULA_RNG_H
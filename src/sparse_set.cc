@@ -0,0 +1,714 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "sparse_set.h"
+
+// Exception includes
+#include "exceptions.h"
+
+#include <algorithm>
+#include <limits>
+
+// Unit Testing includes
+#include "doctest.h"
+
+// Logging system includes
+#include "loguru.hpp"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+SCENARIO("class sparseSet")
+{
+  GIVEN("a database with a sparse_set virtual table")
+  {
+    sqlite3 *db;
+    sqlite3_open(":memory:", &db);
+    std::map<std::string, std::unique_ptr<nebula::sparseSet>> sets;
+    nebula::sparseSet::registerModule(db, sets);
+    REQUIRE(sqlite3_exec(db,
+                "CREATE VIRTUAL TABLE player_ship USING sparse_set(reload "
+                "REAL, shield INTEGER, name TEXT);"
+                "INSERT INTO player_ship VALUES (5000, 1.5, '12', 'one'), "
+                "(2, 2, 20, NULL), (7, 'x', 70.0, 7);",
+                nullptr,
+                nullptr,
+                nullptr)
+            == SQLITE_OK);
+    REQUIRE(sets.count("player_ship") == 1);
+    auto &set = *sets["player_ship"];
+    WHEN("rows are inserted through SQL")
+    {
+      THEN("they are packed in insertion order and found by entity")
+      {
+        REQUIRE(set.size() == 3);
+        REQUIRE(set.entities()
+                == std::vector<sqlite3_int64> {5000, 2, 7});
+        REQUIRE(set.find(7) == 2);
+        REQUIRE(set.find(6) == nebula::sparseSet::npos);
+        REQUIRE(set.find(1 << 20) == nebula::sparseSet::npos);
+        REQUIRE(set.find(-1) == nebula::sparseSet::npos);
+      }
+      THEN("values take the affinity of their declared type")
+      {
+        REQUIRE(std::get<sqlite3_int64>(set.get(0, 1)) == 12);
+        REQUIRE(std::get<double>(set.get(1, 0)) == 2.0);
+        REQUIRE(std::get<std::string>(set.get(2, 0)) == "x");
+        REQUIRE(std::get<sqlite3_int64>(set.get(2, 1)) == 70);
+        REQUIRE(std::get<std::string>(set.get(2, 2)) == "7");
+        REQUIRE(set.get(1, 2).index() == 0);
+      }
+      THEN("SQL looks rows up by entity")
+      {
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db,
+            "SELECT shield FROM player_ship WHERE entity = 2.0;",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(sqlite3_column_int(stmt, 0) == 20);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_DONE);
+        sqlite3_finalize(stmt);
+      }
+      THEN("duplicate and negative entities are rejected")
+      {
+        REQUIRE(sqlite3_exec(db,
+                    "INSERT INTO player_ship (entity) VALUES (2);",
+                    nullptr,
+                    nullptr,
+                    nullptr)
+                == SQLITE_CONSTRAINT);
+        REQUIRE(sqlite3_exec(db,
+                    "INSERT INTO player_ship (entity) VALUES (-2);",
+                    nullptr,
+                    nullptr,
+                    nullptr)
+                == SQLITE_CONSTRAINT);
+      }
+    }
+    WHEN("a row is deleted and another updated")
+    {
+      set.track();
+      REQUIRE(sqlite3_exec(db,
+                  "DELETE FROM player_ship WHERE entity = 5000;"
+                  "UPDATE player_ship SET shield = shield + 1;",
+                  nullptr,
+                  nullptr,
+                  nullptr)
+              == SQLITE_OK);
+      THEN("the last row fills the gap and keeps its values")
+      {
+        REQUIRE(set.entities() == std::vector<sqlite3_int64> {7, 2});
+        REQUIRE(set.find(7) == 0);
+        REQUIRE(set.find(5000) == nebula::sparseSet::npos);
+        REQUIRE(std::get<sqlite3_int64>(set.get(0, 1)) == 71);
+        REQUIRE(std::get<std::string>(set.get(0, 2)) == "7");
+        REQUIRE(set.takeDirty() == std::vector<sqlite3_int64> {2, 7, 5000});
+      }
+    }
+    WHEN("rows are removed while a scan over the set is running")
+    {
+      sqlite3_stmt *stmt;
+      sqlite3_prepare_v2(
+          db, "SELECT entity FROM player_ship;", -1, &stmt, nullptr);
+      REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+      REQUIRE(sqlite3_exec(db,
+                  "DELETE FROM player_ship WHERE entity IN (5000, 2);",
+                  nullptr,
+                  nullptr,
+                  nullptr)
+              == SQLITE_OK);
+      THEN("the scan stops at the end of the rows left")
+      {
+        REQUIRE(set.size() == 1);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_DONE);
+      }
+      sqlite3_finalize(stmt);
+    }
+    WHEN("a transaction writing rows is rolled back")
+    {
+      REQUIRE(sqlite3_exec(db,
+                  "BEGIN; DELETE FROM player_ship WHERE entity = 5000;"
+                  "UPDATE player_ship SET shield = 0 WHERE entity = 2;"
+                  "INSERT INTO player_ship (entity) VALUES (9);",
+                  nullptr,
+                  nullptr,
+                  nullptr)
+              == SQLITE_OK);
+      REQUIRE(set.find(5000) == nebula::sparseSet::npos);
+      REQUIRE(sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr)
+              == SQLITE_OK);
+      THEN("its rows and values are as they were before it")
+      {
+        REQUIRE(set.size() == 3);
+        REQUIRE(set.find(9) == nebula::sparseSet::npos);
+        REQUIRE(std::get<sqlite3_int64>(set.get(set.find(2), 1)) == 20);
+        REQUIRE(std::get<double>(set.get(set.find(5000), 0)) == 1.5);
+        REQUIRE(std::get<std::string>(set.get(set.find(5000), 2)) == "one");
+      }
+    }
+    sqlite3_close(db);
+  }
+}
+#endif
+
+namespace nebula {
+
+namespace {
+
+constexpr uint32_t absent = std::numeric_limits<uint32_t>::max();
+
+struct setTable {
+  sqlite3_vtab _base;
+  sqlite3 *_db;
+  sparseSet *_set;
+  std::map<std::string, std::unique_ptr<sparseSet>> *_sets;
+  std::string _name;
+  std::vector<size_t> _savepoints;
+};
+
+struct setCursor {
+  sqlite3_vtab_cursor _base;
+  size_t _row;
+  size_t _end;
+};
+
+enum setPlan {
+  planScan  = 0,
+  planEqual = 1
+};
+
+std::string declaration(const sparseSet &set)
+{
+  std::string sql = "CREATE TABLE x(entity INTEGER";
+  for (const auto &[name, dtype] : set.schema()) {
+    sql += ", " + name;
+    switch (dtype) {
+    case columnStore::type::f32:
+    case columnStore::type::real:
+      sql += " REAL";
+      break;
+    case columnStore::type::integer:
+      sql += " INTEGER";
+      break;
+    case columnStore::type::text:
+      sql += " TEXT";
+      break;
+    }
+  }
+  return sql + ");";
+}
+
+int setConnect(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err,
+    bool create)
+{
+  auto sets
+      = static_cast<std::map<std::string, std::unique_ptr<sparseSet>> *>(aux);
+  std::string name = argv[2];
+  try {
+    if (create) {
+      std::vector<std::pair<std::string, columnStore::type>> columns;
+      for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto split      = arg.find_first_of(" \t");
+        if (split == std::string::npos) {
+          throw nebulaException("Column without a type: " + arg);
+        }
+        auto start = arg.find_first_not_of(" \t", split);
+        auto dtype = columnStore::parseType(arg.substr(start));
+        if (dtype == columnStore::type::f32) {
+          throw nebulaException("sparse_set cannot pack f32 column " + arg);
+        }
+        columns.emplace_back(arg.substr(0, split), dtype);
+      }
+      (*sets)[name] = std::make_unique<sparseSet>(columns);
+    } else if (sets->count(name) == 0) {
+      *err = sqlite3_mprintf("no sparse set named %s", name.c_str());
+      return SQLITE_ERROR;
+    }
+    auto table   = new setTable();
+    table->_db   = db;
+    table->_set  = (*sets)[name].get();
+    table->_sets = sets;
+    table->_name = name;
+    int res = sqlite3_declare_vtab(db, declaration(*table->_set).c_str());
+    if (res != SQLITE_OK) {
+      delete table;
+      return res;
+    }
+    sqlite3_vtab_config(db, SQLITE_VTAB_CONSTRAINT_SUPPORT, 1);
+    *vtab = &table->_base;
+  } catch (std::exception &e) {
+    *err = sqlite3_mprintf("%s", e.what());
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+int setCreate(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err)
+{
+  return setConnect(db, aux, argc, argv, vtab, err, true);
+}
+
+int setReconnect(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err)
+{
+  return setConnect(db, aux, argc, argv, vtab, err, false);
+}
+
+int setDisconnect(sqlite3_vtab *vtab)
+{
+  delete reinterpret_cast<setTable *>(vtab);
+  return SQLITE_OK;
+}
+
+int setDestroy(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<setTable *>(vtab);
+  table->_sets->erase(table->_name);
+  delete table;
+  return SQLITE_OK;
+}
+
+// An equality constraint on entity is answered through the entity index;
+// anything else scans the packed rows, which are in no particular order.
+int setBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+  auto table   = reinterpret_cast<setTable *>(vtab);
+  double rows  = table->_set->size() + 1;
+  info->idxNum = planScan;
+  for (int i = 0; i < info->nConstraint; ++i) {
+    const auto &c = info->aConstraint[i];
+    if (c.usable && (c.iColumn == 0 || c.iColumn == -1)
+        && c.op == SQLITE_INDEX_CONSTRAINT_EQ)
+    {
+      info->aConstraintUsage[i].argvIndex = 1;
+      info->aConstraintUsage[i].omit      = 1;
+      info->idxNum                        = planEqual;
+      info->idxFlags |= SQLITE_INDEX_SCAN_UNIQUE;
+      rows = 1;
+      break;
+    }
+  }
+  info->estimatedRows = static_cast<sqlite3_int64>(rows);
+  info->estimatedCost = rows;
+  return SQLITE_OK;
+}
+
+int setOpen(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+  auto cur = new setCursor();
+  *cursor  = &cur->_base;
+  return SQLITE_OK;
+}
+
+int setClose(sqlite3_vtab_cursor *cursor)
+{
+  delete reinterpret_cast<setCursor *>(cursor);
+  return SQLITE_OK;
+}
+
+int setFilter(sqlite3_vtab_cursor *cursor,
+    int plan,
+    const char *idxStr,
+    int argc,
+    sqlite3_value **argv)
+{
+  auto cur  = reinterpret_cast<setCursor *>(cursor);
+  auto set  = reinterpret_cast<setTable *>(cursor->pVtab)->_set;
+  cur->_row = 0;
+  cur->_end = set->size();
+  if (plan == planEqual) {
+    // Only keys with an integral numeric value, such as 3 or 3.0, can match
+    int type      = sqlite3_value_numeric_type(argv[0]);
+    double number = sqlite3_value_double(argv[0]);
+    sqlite3_int64 entity = sqlite3_value_int64(argv[0]);
+    bool integral = type == SQLITE_INTEGER
+                 || (type == SQLITE_FLOAT && number == entity);
+    size_t row = integral ? set->find(entity) : sparseSet::npos;
+    cur->_row  = row == sparseSet::npos ? 0 : row;
+    cur->_end  = row == sparseSet::npos ? 0 : row + 1;
+  }
+  return SQLITE_OK;
+}
+
+int setNext(sqlite3_vtab_cursor *cursor)
+{
+  reinterpret_cast<setCursor *>(cursor)->_row++;
+  return SQLITE_OK;
+}
+
+// Rows removed during a scan shrink the set below the end captured in
+// setFilter(), so the cursor is checked against the current size too.
+int setEof(sqlite3_vtab_cursor *cursor)
+{
+  auto cur = reinterpret_cast<setCursor *>(cursor);
+  auto set = reinterpret_cast<setTable *>(cursor->pVtab)->_set;
+  return cur->_row >= std::min(cur->_end, set->size());
+}
+
+int setColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int col)
+{
+  auto cur = reinterpret_cast<setCursor *>(cursor);
+  auto set = reinterpret_cast<setTable *>(cursor->pVtab)->_set;
+  if (cur->_row >= set->size()) {
+    sqlite3_result_null(ctx);
+  } else if (col == 0) {
+    sqlite3_result_int64(ctx, set->entities()[cur->_row]);
+  } else {
+    set->result(cur->_row, col - 1, ctx);
+  }
+  return SQLITE_OK;
+}
+
+int setRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+  auto cur = reinterpret_cast<setCursor *>(cursor);
+  auto set = reinterpret_cast<setTable *>(cursor->pVtab)->_set;
+  if (cur->_row >= set->size()) {
+    return SQLITE_ERROR;
+  }
+  *rowid = set->entities()[cur->_row];
+  return SQLITE_OK;
+}
+
+int setUpdate(
+    sqlite3_vtab *vtab, int argc, sqlite3_value **argv, sqlite3_int64 *rowid)
+{
+  auto table = reinterpret_cast<setTable *>(vtab);
+  auto set   = table->_set;
+  if (argc == 1) {
+    auto row = set->find(sqlite3_value_int64(argv[0]));
+    if (row != sparseSet::npos) {
+      set->remove(row);
+    }
+    return SQLITE_OK;
+  }
+  sqlite3_value *key
+      = sqlite3_value_type(argv[2]) != SQLITE_NULL ? argv[2] : argv[1];
+  sqlite3_int64 entity = sqlite3_value_int64(key);
+  if (sqlite3_value_type(key) == SQLITE_NULL || entity < 0) {
+    sqlite3_free(vtab->zErrMsg);
+    vtab->zErrMsg = sqlite3_mprintf(
+        "%s.entity must be a non-negative integer", table->_name.c_str());
+    return SQLITE_CONSTRAINT;
+  }
+  bool isUpdate = sqlite3_value_type(argv[0]) != SQLITE_NULL;
+  if (isUpdate && sqlite3_value_int64(argv[0]) != entity) {
+    auto old = set->find(sqlite3_value_int64(argv[0]));
+    if (old != sparseSet::npos) {
+      set->remove(old);
+    }
+    isUpdate = false;
+  }
+  size_t row = set->find(entity);
+  if (!isUpdate && row != sparseSet::npos
+      && sqlite3_vtab_on_conflict(table->_db) != SQLITE_REPLACE)
+  {
+    sqlite3_free(vtab->zErrMsg);
+    vtab->zErrMsg = sqlite3_mprintf(
+        "UNIQUE constraint failed: %s.entity", table->_name.c_str());
+    return SQLITE_CONSTRAINT;
+  }
+  try {
+    if (row == sparseSet::npos) {
+      row = set->insert(entity);
+    }
+    for (size_t c = 0; c < set->schema().size(); ++c) {
+      set->set(row, c, argv[3 + c]);
+    }
+  } catch (std::bad_alloc &e) {
+    return SQLITE_NOMEM;
+  }
+  *rowid = entity;
+  return SQLITE_OK;
+}
+
+// Logged like column stores; see storeBegin()
+int setBegin(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<setTable *>(vtab);
+  table->_set->begin();
+  table->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int setCommit(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<setTable *>(vtab);
+  table->_set->commit();
+  table->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int setRollback(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<setTable *>(vtab);
+  table->_set->rollback();
+  table->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int setSavepoint(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<setTable *>(vtab);
+  auto here  = table->_set->savepoint();
+  table->_savepoints.resize(savepoint + 1, here);
+  table->_savepoints[savepoint] = here;
+  return SQLITE_OK;
+}
+
+int setRelease(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<setTable *>(vtab);
+  if (static_cast<size_t>(savepoint) < table->_savepoints.size()) {
+    table->_savepoints.resize(savepoint);
+  }
+  return SQLITE_OK;
+}
+
+int setRollbackTo(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<setTable *>(vtab);
+  if (static_cast<size_t>(savepoint) < table->_savepoints.size()) {
+    table->_set->rollbackTo(table->_savepoints[savepoint]);
+    table->_savepoints.resize(savepoint + 1);
+  }
+  return SQLITE_OK;
+}
+
+sqlite3_module setModule = {
+    2,             // iVersion
+    setCreate,     // xCreate
+    setReconnect,  // xConnect
+    setBestIndex,  // xBestIndex
+    setDisconnect, // xDisconnect
+    setDestroy,    // xDestroy
+    setOpen,       // xOpen
+    setClose,      // xClose
+    setFilter,     // xFilter
+    setNext,       // xNext
+    setEof,        // xEof
+    setColumn,     // xColumn
+    setRowid,      // xRowid
+    setUpdate,     // xUpdate
+    setBegin,      // xBegin
+    nullptr,       // xSync
+    setCommit,     // xCommit
+    setRollback,   // xRollback
+    nullptr,       // xFindFunction
+    nullptr,       // xRename
+    setSavepoint,  // xSavepoint
+    setRelease,    // xRelease
+    setRollbackTo, // xRollbackTo
+};
+
+} // namespace
+
+sparseSet::sparseSet(
+    const std::vector<std::pair<std::string, columnStore::type>> &columns)
+    : _schema(columns), _columns(columns.size()), _version(0),
+      _tracked(false), _logging(false)
+{
+}
+
+void sparseSet::registerModule(
+    sqlite3 *db, std::map<std::string, std::unique_ptr<sparseSet>> &sets)
+{
+  if (sqlite3_create_module_v2(db, "sparse_set", &setModule, &sets, nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(db);
+  }
+}
+
+std::vector<sqlite3_int64> sparseSet::takeDirty()
+{
+  std::vector<sqlite3_int64> dirty;
+  dirty.swap(_dirty);
+  std::sort(dirty.begin(), dirty.end());
+  dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+  return dirty;
+}
+
+size_t sparseSet::find(sqlite3_int64 entity) const
+{
+  if (entity < 0) {
+    return npos;
+  }
+  auto page = static_cast<uint64_t>(entity) / pageSize;
+  if (page >= _pages.size() || !_pages[page]) {
+    return npos;
+  }
+  uint32_t row = _pages[page][entity % pageSize];
+  return row == absent ? npos : row;
+}
+
+// Pages of the entity index are only allocated for ranges of entities that
+// have held a row, so a handful of rows costs a handful of pages.
+size_t sparseSet::insert(sqlite3_int64 entity)
+{
+  auto page = static_cast<uint64_t>(entity) / pageSize;
+  if (page >= _pages.size()) {
+    _pages.resize(page + 1);
+  }
+  if (!_pages[page]) {
+    _pages[page] = std::make_unique<uint32_t[]>(pageSize);
+    std::fill_n(_pages[page].get(), pageSize, absent);
+  }
+  size_t row = _entities.size();
+  _entities.push_back(entity);
+  for (auto &col : _columns) {
+    col.emplace_back();
+  }
+  _pages[page][entity % pageSize] = static_cast<uint32_t>(row);
+  ++_version;
+  if (_tracked) {
+    _dirty.push_back(entity);
+  }
+  if (_logging) {
+    _undo.push_back({change::kind::inserted, npos, entity, {}});
+  }
+  return row;
+}
+
+void sparseSet::remove(size_t row)
+{
+  sqlite3_int64 entity = _entities[row];
+  size_t last          = _entities.size() - 1;
+  if (_logging) {
+    for (size_t c = 0; c < _columns.size(); ++c) {
+      _undo.push_back({change::kind::written, c, entity, _columns[c][row]});
+    }
+    _undo.push_back({change::kind::removed, npos, entity, {}});
+  }
+  if (row != last) {
+    sqlite3_int64 moved = _entities[last];
+    _entities[row]      = moved;
+    for (auto &col : _columns) {
+      col[row] = std::move(col[last]);
+    }
+    _pages[moved / pageSize][moved % pageSize] = static_cast<uint32_t>(row);
+  }
+  _entities.pop_back();
+  for (auto &col : _columns) {
+    col.pop_back();
+  }
+  _pages[entity / pageSize][entity % pageSize] = absent;
+  ++_version;
+  if (_tracked) {
+    _dirty.push_back(entity);
+  }
+}
+
+// Virtual tables get no column affinity from SQLite, so values are converted
+// here the way an ordinary table column of the declared type would.
+void sparseSet::set(size_t row, size_t c, sqlite3_value *value)
+{
+  auto &cell = _columns[c][row];
+  if (_logging) {
+    _undo.push_back({change::kind::written, c, _entities[row], cell});
+  }
+  ++_version;
+  if (_tracked && (_dirty.empty() || _dirty.back() != _entities[row])) {
+    _dirty.push_back(_entities[row]);
+  }
+  int type = sqlite3_value_type(value);
+  if (type == SQLITE_NULL) {
+    cell = std::monostate();
+    return;
+  }
+  if (_schema[c].second != columnStore::type::text) {
+    type = sqlite3_value_numeric_type(value);
+  }
+  if (type == SQLITE_INTEGER && _schema[c].second == columnStore::type::real) {
+    type = SQLITE_FLOAT;
+  }
+  if (type == SQLITE_FLOAT
+      && _schema[c].second == columnStore::type::integer)
+  {
+    double number         = sqlite3_value_double(value);
+    sqlite3_int64 integer = sqlite3_value_int64(value);
+    type = number == integer ? SQLITE_INTEGER : SQLITE_FLOAT;
+  }
+  switch (_schema[c].second == columnStore::type::text ? SQLITE_TEXT : type) {
+  case SQLITE_INTEGER:
+    cell = sqlite3_value_int64(value);
+    break;
+  case SQLITE_FLOAT:
+    cell = sqlite3_value_double(value);
+    break;
+  default: {
+    auto text = reinterpret_cast<const char *>(sqlite3_value_text(value));
+    cell      = std::string(text ? text : "", sqlite3_value_bytes(value));
+    break;
+  }
+  }
+}
+
+void sparseSet::result(size_t row, size_t c, sqlite3_context *ctx) const
+{
+  const auto &cell = _columns[c][row];
+  if (auto integer = std::get_if<sqlite3_int64>(&cell)) {
+    sqlite3_result_int64(ctx, *integer);
+  } else if (auto real = std::get_if<double>(&cell)) {
+    sqlite3_result_double(ctx, *real);
+  } else if (auto text = std::get_if<std::string>(&cell)) {
+    sqlite3_result_text(ctx, text->c_str(), text->size(), SQLITE_TRANSIENT);
+  } else {
+    sqlite3_result_null(ctx);
+  }
+}
+
+// A removed row is logged as its cells followed by the removal, so undoing
+// in reverse inserts it again before restoring them.
+void sparseSet::rollbackTo(size_t savepoint)
+{
+  bool logging = _logging;
+  _logging     = false;
+  while (_undo.size() > savepoint) {
+    auto &c = _undo.back();
+    if (c._kind == change::kind::removed) {
+      insert(c._entity);
+    } else if (size_t row = find(c._entity); row != npos) {
+      if (c._kind == change::kind::inserted) {
+        remove(row);
+      } else {
+        _columns[c._column][row] = std::move(c._value);
+        ++_version;
+        if (_tracked) {
+          _dirty.push_back(c._entity);
+        }
+      }
+    }
+    _undo.pop_back();
+  }
+  _logging = logging;
+}
+
+void sparseSet::commit()
+{
+  _logging = false;
+  _undo.clear();
+}
+
+void sparseSet::rollback()
+{
+  rollbackTo(0);
+  commit();
+}
+
+} // namespace nebula
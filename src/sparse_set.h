@@ -0,0 +1,131 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_SPARSE_SET_H
+#define NEBULA_SPARSE_SET_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "column_store.h"
+
+extern "C" {
+#include "sqlite3.h"
+}
+
+namespace nebula {
+
+// Storage for components few entities have, exposed to SQL through the
+// sparse_set virtual table module. Rows are kept densely packed in insertion
+// order and found through a paged entity index, so insert, remove and lookup
+// by entity are all constant time; removal moves the last row into the gap.
+class sparseSet {
+public:
+  // A cell: NULL, INTEGER, REAL or TEXT
+  using value
+      = std::variant<std::monostate, sqlite3_int64, double, std::string>;
+
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+private:
+  static constexpr size_t pageSize = 1024;
+
+  // One logged change: the entity was inserted, its row removed after its
+  // cells were logged, or one cell written.
+  struct change {
+    enum class kind : uint8_t {
+      inserted,
+      removed,
+      written
+    };
+
+    kind _kind;
+    size_t _column;
+    sqlite3_int64 _entity;
+    value _value;
+  };
+
+  std::vector<std::unique_ptr<uint32_t[]>> _pages;
+  std::vector<sqlite3_int64> _entities;
+  std::vector<std::pair<std::string, columnStore::type>> _schema;
+  std::vector<std::vector<value>> _columns;
+  uint64_t _version;
+  bool _tracked;
+  std::vector<sqlite3_int64> _dirty;
+  bool _logging;
+  std::vector<change> _undo;
+
+public:
+  sparseSet(
+      const std::vector<std::pair<std::string, columnStore::type>> &columns);
+
+  static void registerModule(
+      sqlite3 *db, std::map<std::string, std::unique_ptr<sparseSet>> &sets);
+
+  size_t size() const
+  {
+    return _entities.size();
+  }
+
+  const std::vector<sqlite3_int64> &entities() const
+  {
+    return _entities;
+  }
+
+  const std::vector<std::pair<std::string, columnStore::type>> &schema() const
+  {
+    return _schema;
+  }
+
+  // Incremented on every write, for consumers caching derived data.
+  uint64_t version() const
+  {
+    return _version;
+  }
+
+  // While tracked, every written or removed entity is recorded until the
+  // owner collects it with takeDirty().
+  void track()
+  {
+    _tracked = true;
+  }
+
+  std::vector<sqlite3_int64> takeDirty();
+
+  const value &get(size_t row, size_t col) const
+  {
+    return _columns[col][row];
+  }
+
+  // The row holding entity, or npos when it has none.
+  size_t find(sqlite3_int64 entity) const;
+  size_t insert(sqlite3_int64 entity);
+  void remove(size_t row);
+  void set(size_t row, size_t col, sqlite3_value *value);
+  void result(size_t row, size_t col, sqlite3_context *ctx) const;
+
+  // Changes are logged from begin() until commit() or rollback(); a
+  // savepoint() is a position in the log for rollbackTo(). Rows restored
+  // by a rollback may come back in a different order.
+  void begin()
+  {
+    _logging = true;
+  }
+
+  size_t savepoint() const
+  {
+    return _undo.size();
+  }
+
+  void rollbackTo(size_t savepoint);
+  void commit();
+  void rollback();
+};
+
+} // namespace nebula
+
+#endif // NEBULA_SPARSE_SET_H
@@ -0,0 +1,540 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "tag_set.h"
+
+// Exception includes
+#include "exceptions.h"
+
+#include <string>
+
+// Unit Testing includes
+#include "doctest.h"
+
+// Logging system includes
+#include "loguru.hpp"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+SCENARIO("class tagSet")
+{
+  GIVEN("a database with a tag_set virtual table")
+  {
+    sqlite3 *db;
+    sqlite3_open(":memory:", &db);
+    std::map<std::string, std::unique_ptr<nebula::tagSet>> sets;
+    nebula::tagSet::registerModule(db, sets);
+    REQUIRE(sqlite3_exec(db,
+                "CREATE VIRTUAL TABLE asteroid USING tag_set;"
+                "INSERT INTO asteroid VALUES (70), (3), (130);",
+                nullptr,
+                nullptr,
+                nullptr)
+            == SQLITE_OK);
+    REQUIRE(sets.count("asteroid") == 1);
+    auto &set = *sets["asteroid"];
+    WHEN("entities are tagged through SQL")
+    {
+      THEN("they are members of the bitset")
+      {
+        REQUIRE(set.size() == 3);
+        REQUIRE(set.has(70));
+        REQUIRE_FALSE(set.has(71));
+        REQUIRE_FALSE(set.has(-1));
+        REQUIRE(set.next(4) == 70);
+        REQUIRE(set.next(131) == nebula::tagSet::npos);
+        REQUIRE(set.nextAbsent(3, 10) == 4);
+        REQUIRE(set.nextAbsent(70, 71) == nebula::tagSet::npos);
+        REQUIRE(set.nextAbsent(130, 1000) == 131);
+      }
+      THEN("SQL iterates them in order and looks them up by entity")
+      {
+        sqlite3_stmt *stmt;
+        sqlite3_prepare_v2(db,
+            "SELECT group_concat(entity), (SELECT count(*) FROM asteroid "
+            "WHERE entity = 130) FROM asteroid;",
+            -1,
+            &stmt,
+            nullptr);
+        REQUIRE(sqlite3_step(stmt) == SQLITE_ROW);
+        REQUIRE(std::string(reinterpret_cast<const char *>(
+                    sqlite3_column_text(stmt, 0)))
+                == "3,70,130");
+        REQUIRE(sqlite3_column_int(stmt, 1) == 1);
+        sqlite3_finalize(stmt);
+      }
+    }
+    WHEN("an entity is tagged twice or untagged")
+    {
+      REQUIRE(sqlite3_exec(db,
+                  "INSERT INTO asteroid VALUES (3);",
+                  nullptr,
+                  nullptr,
+                  nullptr)
+              == SQLITE_CONSTRAINT);
+      REQUIRE(sqlite3_exec(db,
+                  "INSERT OR IGNORE INTO asteroid VALUES (3);"
+                  "DELETE FROM asteroid WHERE entity = 70;",
+                  nullptr,
+                  nullptr,
+                  nullptr)
+              == SQLITE_OK);
+      THEN("membership changes only where it should")
+      {
+        REQUIRE(set.size() == 2);
+        REQUIRE(set.has(3));
+        REQUIRE_FALSE(set.has(70));
+      }
+    }
+    WHEN("a transaction changing membership is rolled back")
+    {
+      REQUIRE(sqlite3_exec(db,
+                  "BEGIN; DELETE FROM asteroid WHERE entity = 3;"
+                  "INSERT INTO asteroid VALUES (4);"
+                  "SAVEPOINT inner; DELETE FROM asteroid; ROLLBACK TO inner;",
+                  nullptr,
+                  nullptr,
+                  nullptr)
+              == SQLITE_OK);
+      REQUIRE(set.size() == 3);
+      REQUIRE(sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr)
+              == SQLITE_OK);
+      THEN("the bitset is as it was before it")
+      {
+        REQUIRE(set.size() == 3);
+        REQUIRE(set.has(3));
+        REQUIRE_FALSE(set.has(4));
+        REQUIRE(set.has(130));
+      }
+    }
+    sqlite3_close(db);
+  }
+}
+#endif
+
+namespace nebula {
+
+namespace {
+
+struct tagTable {
+  sqlite3_vtab _base;
+  sqlite3 *_db;
+  tagSet *_set;
+  std::map<std::string, std::unique_ptr<tagSet>> *_sets;
+  std::string _name;
+  std::vector<size_t> _savepoints;
+};
+
+struct tagCursor {
+  sqlite3_vtab_cursor _base;
+  sqlite3_int64 _entity;
+  bool _single;
+};
+
+enum tagPlan {
+  planScan  = 0,
+  planEqual = 1
+};
+
+int tagConnect(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err,
+    bool create)
+{
+  auto sets
+      = static_cast<std::map<std::string, std::unique_ptr<tagSet>> *>(aux);
+  std::string name = argv[2];
+  if (argc > 3) {
+    *err = sqlite3_mprintf("tag_set %s cannot have columns", name.c_str());
+    return SQLITE_ERROR;
+  }
+  if (create) {
+    (*sets)[name] = std::make_unique<tagSet>();
+  } else if (sets->count(name) == 0) {
+    *err = sqlite3_mprintf("no tag set named %s", name.c_str());
+    return SQLITE_ERROR;
+  }
+  auto table   = new tagTable();
+  table->_db   = db;
+  table->_set  = (*sets)[name].get();
+  table->_sets = sets;
+  table->_name = name;
+  int res = sqlite3_declare_vtab(db, "CREATE TABLE x(entity INTEGER);");
+  if (res != SQLITE_OK) {
+    delete table;
+    return res;
+  }
+  sqlite3_vtab_config(db, SQLITE_VTAB_CONSTRAINT_SUPPORT, 1);
+  *vtab = &table->_base;
+  return SQLITE_OK;
+}
+
+int tagCreate(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err)
+{
+  return tagConnect(db, aux, argc, argv, vtab, err, true);
+}
+
+int tagReconnect(sqlite3 *db,
+    void *aux,
+    int argc,
+    const char *const *argv,
+    sqlite3_vtab **vtab,
+    char **err)
+{
+  return tagConnect(db, aux, argc, argv, vtab, err, false);
+}
+
+int tagDisconnect(sqlite3_vtab *vtab)
+{
+  delete reinterpret_cast<tagTable *>(vtab);
+  return SQLITE_OK;
+}
+
+int tagDestroy(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<tagTable *>(vtab);
+  table->_sets->erase(table->_name);
+  delete table;
+  return SQLITE_OK;
+}
+
+// An equality constraint on entity is a single bit test; anything else is
+// a scan over the set bits, which always comes out in entity order.
+int tagBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+  auto table   = reinterpret_cast<tagTable *>(vtab);
+  double rows  = table->_set->size() + 1;
+  info->idxNum = planScan;
+  for (int i = 0; i < info->nConstraint; ++i) {
+    const auto &c = info->aConstraint[i];
+    if (c.usable && (c.iColumn == 0 || c.iColumn == -1)
+        && c.op == SQLITE_INDEX_CONSTRAINT_EQ)
+    {
+      info->aConstraintUsage[i].argvIndex = 1;
+      info->aConstraintUsage[i].omit      = 1;
+      info->idxNum                        = planEqual;
+      info->idxFlags |= SQLITE_INDEX_SCAN_UNIQUE;
+      rows = 1;
+      break;
+    }
+  }
+  if (info->nOrderBy == 1
+      && (info->aOrderBy[0].iColumn == 0 || info->aOrderBy[0].iColumn == -1)
+      && !info->aOrderBy[0].desc)
+  {
+    info->orderByConsumed = 1;
+  }
+  info->estimatedRows = static_cast<sqlite3_int64>(rows);
+  info->estimatedCost = rows;
+  return SQLITE_OK;
+}
+
+int tagOpen(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+  auto cur     = new tagCursor();
+  cur->_entity = tagSet::npos;
+  cur->_single = false;
+  *cursor      = &cur->_base;
+  return SQLITE_OK;
+}
+
+int tagClose(sqlite3_vtab_cursor *cursor)
+{
+  delete reinterpret_cast<tagCursor *>(cursor);
+  return SQLITE_OK;
+}
+
+int tagFilter(sqlite3_vtab_cursor *cursor,
+    int plan,
+    const char *idxStr,
+    int argc,
+    sqlite3_value **argv)
+{
+  auto cur     = reinterpret_cast<tagCursor *>(cursor);
+  auto set     = reinterpret_cast<tagTable *>(cursor->pVtab)->_set;
+  cur->_single = plan == planEqual;
+  if (cur->_single) {
+    // Only keys with an integral numeric value, such as 3 or 3.0, can match
+    int type      = sqlite3_value_numeric_type(argv[0]);
+    double number = sqlite3_value_double(argv[0]);
+    sqlite3_int64 entity = sqlite3_value_int64(argv[0]);
+    bool integral = type == SQLITE_INTEGER
+                 || (type == SQLITE_FLOAT && number == entity);
+    cur->_entity = integral && set->has(entity) ? entity : tagSet::npos;
+  } else {
+    cur->_entity = set->next(0);
+  }
+  return SQLITE_OK;
+}
+
+int tagNext(sqlite3_vtab_cursor *cursor)
+{
+  auto cur = reinterpret_cast<tagCursor *>(cursor);
+  auto set = reinterpret_cast<tagTable *>(cursor->pVtab)->_set;
+  // An equality lookup has one row at most. A scan moves on to the next set
+  // bit, which is still right when the current entity was just untagged.
+  cur->_entity = cur->_single ? tagSet::npos : set->next(cur->_entity + 1);
+  return SQLITE_OK;
+}
+
+int tagEof(sqlite3_vtab_cursor *cursor)
+{
+  return reinterpret_cast<tagCursor *>(cursor)->_entity == tagSet::npos;
+}
+
+int tagColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int col)
+{
+  sqlite3_result_int64(ctx, reinterpret_cast<tagCursor *>(cursor)->_entity);
+  return SQLITE_OK;
+}
+
+int tagRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
+{
+  *rowid = reinterpret_cast<tagCursor *>(cursor)->_entity;
+  return SQLITE_OK;
+}
+
+int tagUpdate(
+    sqlite3_vtab *vtab, int argc, sqlite3_value **argv, sqlite3_int64 *rowid)
+{
+  auto table = reinterpret_cast<tagTable *>(vtab);
+  auto set   = table->_set;
+  if (argc == 1) {
+    set->remove(sqlite3_value_int64(argv[0]));
+    return SQLITE_OK;
+  }
+  sqlite3_value *value
+      = sqlite3_value_type(argv[2]) != SQLITE_NULL ? argv[2] : argv[1];
+  sqlite3_int64 entity = sqlite3_value_int64(value);
+  if (sqlite3_value_type(value) == SQLITE_NULL || entity < 0) {
+    sqlite3_free(vtab->zErrMsg);
+    vtab->zErrMsg = sqlite3_mprintf(
+        "%s.entity must be a non-negative integer", table->_name.c_str());
+    return SQLITE_CONSTRAINT;
+  }
+  bool isUpdate = sqlite3_value_type(argv[0]) != SQLITE_NULL;
+  if (isUpdate && sqlite3_value_int64(argv[0]) == entity) {
+    *rowid = entity;
+    return SQLITE_OK;
+  }
+  if (set->has(entity)
+      && sqlite3_vtab_on_conflict(table->_db) != SQLITE_REPLACE)
+  {
+    sqlite3_free(vtab->zErrMsg);
+    vtab->zErrMsg = sqlite3_mprintf(
+        "UNIQUE constraint failed: %s.entity", table->_name.c_str());
+    return SQLITE_CONSTRAINT;
+  }
+  try {
+    if (isUpdate) {
+      set->remove(sqlite3_value_int64(argv[0]));
+    }
+    set->insert(entity);
+  } catch (std::bad_alloc &e) {
+    return SQLITE_NOMEM;
+  }
+  *rowid = entity;
+  return SQLITE_OK;
+}
+
+// Logged like column stores; see storeBegin()
+int tagBegin(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<tagTable *>(vtab);
+  table->_set->begin();
+  table->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int tagCommit(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<tagTable *>(vtab);
+  table->_set->commit();
+  table->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int tagRollback(sqlite3_vtab *vtab)
+{
+  auto table = reinterpret_cast<tagTable *>(vtab);
+  table->_set->rollback();
+  table->_savepoints.clear();
+  return SQLITE_OK;
+}
+
+int tagSavepoint(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<tagTable *>(vtab);
+  auto here  = table->_set->savepoint();
+  table->_savepoints.resize(savepoint + 1, here);
+  table->_savepoints[savepoint] = here;
+  return SQLITE_OK;
+}
+
+int tagRelease(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<tagTable *>(vtab);
+  if (static_cast<size_t>(savepoint) < table->_savepoints.size()) {
+    table->_savepoints.resize(savepoint);
+  }
+  return SQLITE_OK;
+}
+
+int tagRollbackTo(sqlite3_vtab *vtab, int savepoint)
+{
+  auto table = reinterpret_cast<tagTable *>(vtab);
+  if (static_cast<size_t>(savepoint) < table->_savepoints.size()) {
+    table->_set->rollbackTo(table->_savepoints[savepoint]);
+    table->_savepoints.resize(savepoint + 1);
+  }
+  return SQLITE_OK;
+}
+
+sqlite3_module tagModule = {
+    2,             // iVersion
+    tagCreate,     // xCreate
+    tagReconnect,  // xConnect
+    tagBestIndex,  // xBestIndex
+    tagDisconnect, // xDisconnect
+    tagDestroy,    // xDestroy
+    tagOpen,       // xOpen
+    tagClose,      // xClose
+    tagFilter,     // xFilter
+    tagNext,       // xNext
+    tagEof,        // xEof
+    tagColumn,     // xColumn
+    tagRowid,      // xRowid
+    tagUpdate,     // xUpdate
+    tagBegin,      // xBegin
+    nullptr,       // xSync
+    tagCommit,     // xCommit
+    tagRollback,   // xRollback
+    nullptr,       // xFindFunction
+    nullptr,       // xRename
+    tagSavepoint,  // xSavepoint
+    tagRelease,    // xRelease
+    tagRollbackTo, // xRollbackTo
+};
+
+} // namespace
+
+tagSet::tagSet() : _count(0), _version(0), _logging(false) { }
+
+void tagSet::registerModule(
+    sqlite3 *db, std::map<std::string, std::unique_ptr<tagSet>> &sets)
+{
+  if (sqlite3_create_module_v2(db, "tag_set", &tagModule, &sets, nullptr)
+      != SQLITE_OK)
+  {
+    throw sqliteException(db);
+  }
+}
+
+sqlite3_int64 tagSet::next(sqlite3_int64 from) const
+{
+  if (from < 0) {
+    from = 0;
+  }
+  size_t word = static_cast<uint64_t>(from) / 64;
+  if (word >= _bits.size()) {
+    return npos;
+  }
+  uint64_t bits = _bits[word] & (~uint64_t(0) << (from % 64));
+  while (bits == 0) {
+    if (++word == _bits.size()) {
+      return npos;
+    }
+    bits = _bits[word];
+  }
+  return static_cast<sqlite3_int64>(word * 64 + __builtin_ctzll(bits));
+}
+
+sqlite3_int64 tagSet::nextAbsent(
+    sqlite3_int64 from, sqlite3_int64 until) const
+{
+  if (from < 0) {
+    from = 0;
+  }
+  while (from < until) {
+    size_t word = static_cast<uint64_t>(from) / 64;
+    if (word >= _bits.size()) {
+      return from;
+    }
+    uint64_t clear = ~_bits[word] & (~uint64_t(0) << (from % 64));
+    if (clear != 0) {
+      sqlite3_int64 entity = word * 64 + __builtin_ctzll(clear);
+      return entity < until ? entity : npos;
+    }
+    from = (word + 1) * 64;
+  }
+  return npos;
+}
+
+bool tagSet::insert(sqlite3_int64 entity)
+{
+  if (has(entity)) {
+    return false;
+  }
+  auto word = static_cast<uint64_t>(entity) / 64;
+  if (word >= _bits.size()) {
+    _bits.resize(word + 1, 0);
+  }
+  _bits[word] |= uint64_t(1) << (entity % 64);
+  ++_count;
+  ++_version;
+  if (_logging) {
+    _undo.emplace_back(entity, true);
+  }
+  return true;
+}
+
+bool tagSet::remove(sqlite3_int64 entity)
+{
+  if (!has(entity)) {
+    return false;
+  }
+  _bits[static_cast<uint64_t>(entity) / 64] &= ~(uint64_t(1) << (entity % 64));
+  --_count;
+  ++_version;
+  if (_logging) {
+    _undo.emplace_back(entity, false);
+  }
+  return true;
+}
+
+void tagSet::rollbackTo(size_t savepoint)
+{
+  bool logging = _logging;
+  _logging     = false;
+  while (_undo.size() > savepoint) {
+    auto [entity, inserted] = _undo.back();
+    if (inserted) {
+      remove(entity);
+    } else {
+      insert(entity);
+    }
+    _undo.pop_back();
+  }
+  _logging = logging;
+}
+
+void tagSet::commit()
+{
+  _logging = false;
+  _undo.clear();
+}
+
+void tagSet::rollback()
+{
+  rollbackTo(0);
+  commit();
+}
+
+} // namespace nebula
@@ -0,0 +1,87 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_TAG_SET_H
+#define NEBULA_TAG_SET_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "sqlite3.h"
+}
+
+namespace nebula {
+
+// Membership of a component without columns, kept as a dense bitset indexed
+// by entity and exposed to SQL through the tag_set virtual table module.
+// Membership tests are a single bit lookup, and entities are iterated in
+// increasing order by scanning for set bits.
+class tagSet {
+public:
+  static constexpr sqlite3_int64 npos = -1;
+
+private:
+  std::vector<uint64_t> _bits;
+  size_t _count;
+  uint64_t _version;
+  // Entities whose membership changed while logging, and whether they
+  // were inserted
+  bool _logging;
+  std::vector<std::pair<sqlite3_int64, bool>> _undo;
+
+public:
+  tagSet();
+
+  static void registerModule(
+      sqlite3 *db, std::map<std::string, std::unique_ptr<tagSet>> &sets);
+
+  size_t size() const
+  {
+    return _count;
+  }
+
+  uint64_t version() const
+  {
+    return _version;
+  }
+
+  bool has(sqlite3_int64 entity) const
+  {
+    auto word = static_cast<uint64_t>(entity) / 64;
+    return entity >= 0 && word < _bits.size()
+        && (_bits[word] >> (entity % 64) & 1);
+  }
+
+  // The first tagged entity at or after from, or npos when there is none.
+  sqlite3_int64 next(sqlite3_int64 from) const;
+  // The first untagged entity in [from, until), or npos when there is none.
+  sqlite3_int64 nextAbsent(sqlite3_int64 from, sqlite3_int64 until) const;
+  // Both return whether membership changed. Entities must not be negative.
+  bool insert(sqlite3_int64 entity);
+  bool remove(sqlite3_int64 entity);
+
+  // Membership changes are logged from begin() until commit() or
+  // rollback(); a savepoint() is a position in the log for rollbackTo().
+  void begin()
+  {
+    _logging = true;
+  }
+
+  size_t savepoint() const
+  {
+    return _undo.size();
+  }
+
+  void rollbackTo(size_t savepoint);
+  void commit();
+  void rollback();
+};
+
+} // namespace nebula
+
+#endif // NEBULA_TAG_SET_H
@@ -0,0 +1,134 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "timer_wheel.h"
+
+// Unit Testing includes
+#include "doctest.h"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+SCENARIO("class timerWheel")
+{
+  GIVEN("a wheel with timers near, far and beyond its levels")
+  {
+    nebula::timerWheel wheel;
+    std::vector<uint64_t> dues = {1, 63, 64, 65, 4096, 300000, 1u << 25};
+    for (size_t i = 0; i < dues.size(); ++i) {
+      wheel.schedule({dues[i], i, static_cast<sqlite3_int64>(i)});
+    }
+    REQUIRE(wheel.size() == dues.size());
+    WHEN("it is advanced past each due time in turn")
+    {
+      THEN("every timer expires exactly when it falls due")
+      {
+        std::vector<nebula::timerWheel::timer> expired;
+        for (size_t i = 0; i < dues.size(); ++i) {
+          wheel.advance(dues[i] - 1, expired);
+          REQUIRE(expired.empty());
+          wheel.advance(dues[i], expired);
+          REQUIRE(expired.size() == 1);
+          REQUIRE(expired[0]._id == i);
+          expired.clear();
+        }
+        REQUIRE(wheel.size() == 0);
+      }
+    }
+    WHEN("it is advanced in one large step")
+    {
+      std::vector<nebula::timerWheel::timer> expired;
+      wheel.advance(5000, expired);
+      THEN("only the timers due by then expire")
+      {
+        REQUIRE(expired.size() == 5);
+        REQUIRE(wheel.size() == 2);
+      }
+      AND_WHEN("a timer is scheduled in the past")
+      {
+        expired.clear();
+        wheel.schedule({10, 99, 99});
+        wheel.advance(5000, expired);
+        THEN("the next advance returns it")
+        {
+          REQUIRE(expired.size() == 1);
+          REQUIRE(expired[0]._id == 99);
+        }
+      }
+    }
+  }
+}
+#endif
+
+namespace nebula {
+
+timerWheel::timerWheel() : _now(0), _size(0) { }
+
+// A timer goes on the level of the highest group of slotBits in which its
+// due time differs from now, in the slot that group selects. It is moved
+// down when now reaches the start of that slot.
+void timerWheel::place(const timer &t)
+{
+  if (t._due <= _now) {
+    _late.push_back(t);
+    return;
+  }
+  uint64_t diff = t._due ^ _now;
+  size_t level  = (63 - __builtin_clzll(diff)) / slotBits;
+  if (level >= levels) {
+    _overflow.push_back(t);
+    return;
+  }
+  _slots[level][(t._due >> (level * slotBits)) % slots].push_back(t);
+}
+
+void timerWheel::schedule(const timer &t)
+{
+  ++_size;
+  place(t);
+}
+
+void timerWheel::advance(uint64_t to, std::vector<timer> &expired)
+{
+  const uint64_t span = uint64_t(1) << (levels * slotBits);
+  while (_now < to && _size > _late.size()) {
+    if (_size == _late.size() + _overflow.size()) {
+      // Only the overflow is pending, which nothing touches before the wrap
+      uint64_t wrap = (_now / span + 1) * span;
+      if (wrap > to) {
+        break;
+      }
+      _now = wrap - 1;
+    }
+    ++_now;
+    if (_now % span == 0) {
+      std::vector<timer> pending;
+      pending.swap(_overflow);
+      for (const auto &t : pending) {
+        place(t);
+      }
+    }
+    // Higher levels are cascaded first, since their timers may land in the
+    // lower slots cascaded in the same step.
+    for (size_t level = levels - 1; level > 0; --level) {
+      if (_now % (uint64_t(1) << (level * slotBits)) != 0) {
+        continue;
+      }
+      std::vector<timer> pending;
+      pending.swap(_slots[level][(_now >> (level * slotBits)) % slots]);
+      for (const auto &t : pending) {
+        place(t);
+      }
+    }
+    auto &slot = _slots[0][_now % slots];
+    _late.insert(_late.end(), slot.begin(), slot.end());
+    slot.clear();
+  }
+  if (_now < to) {
+    // No slot on the way holds a timer, so there is nothing to cascade
+    _now = to;
+  }
+  _size -= _late.size();
+  expired.insert(expired.end(), _late.begin(), _late.end());
+  _late.clear();
+}
+
+} // namespace nebula
@@ -0,0 +1,66 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_TIMER_WHEEL_H
+#define NEBULA_TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include "sqlite3.h"
+}
+
+namespace nebula {
+
+// A hierarchical timing wheel over integer time units. Four levels of 64
+// slots cover 2^24 units ahead of the current time, and timers further out
+// wait in an overflow list revisited whenever the top level wraps. A timer
+// is moved down a level at most once per level, so advancing costs the
+// slots passed plus the timers falling due, however many are pending.
+class timerWheel {
+public:
+  struct timer {
+    uint64_t _due;
+    size_t _id;
+    sqlite3_int64 _entity;
+  };
+
+private:
+  static constexpr unsigned slotBits = 6;
+  static constexpr size_t slots      = size_t(1) << slotBits;
+  static constexpr size_t levels     = 4;
+
+  std::vector<timer> _slots[levels][slots];
+  std::vector<timer> _overflow;
+  std::vector<timer> _late;
+  uint64_t _now;
+  size_t _size;
+
+  void place(const timer &t);
+
+public:
+  timerWheel();
+
+  uint64_t now() const
+  {
+    return _now;
+  }
+
+  // Timers scheduled and not yet returned by advance()
+  size_t size() const
+  {
+    return _size;
+  }
+
+  // A timer already due is returned by the next advance().
+  void schedule(const timer &t);
+  // Moves the wheel forward to time to, appending every timer due by then
+  // to expired.
+  void advance(uint64_t to, std::vector<timer> &expired);
+};
+
+} // namespace nebula
+
+#endif // NEBULA_TIMER_WHEEL_H
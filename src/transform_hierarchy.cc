@@ -0,0 +1,411 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "transform_hierarchy.h"
+#include "bulk_array.h"
+
+// Exception includes
+#include "exceptions.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+// Unit Testing includes
+#include "doctest.h"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+static double _queryReal(sqlite3 *db, const char *sql)
+{
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+  sqlite3_step(stmt);
+  double value = sqlite3_column_double(stmt, 0);
+  sqlite3_finalize(stmt);
+  return value;
+}
+
+SCENARIO("class transformHierarchy")
+{
+  GIVEN("a ship with a turret carrying a gun")
+  {
+    sqlite3 *db;
+    sqlite3_open(":memory:", &db);
+    std::map<std::string, std::unique_ptr<nebula::sparseSet>> sets;
+    nebula::sparseSet::registerModule(db, sets);
+    nebula::bulkArray::registerModule(db);
+    REQUIRE(sqlite3_exec(db,
+                "CREATE TABLE location (entity INTEGER PRIMARY KEY, x REAL, "
+                "y REAL, theta REAL);"
+                "CREATE VIRTUAL TABLE hierarchy USING sparse_set(parent "
+                "INTEGER, x REAL, y REAL, theta REAL);"
+                "INSERT INTO location VALUES (1, 10, 0, 1.5707963267948966), "
+                "(2, 0, 0, 0), (3, 0, 0, 0), (4, 7, 7, 7);"
+                "INSERT INTO hierarchy VALUES (3, 2, 1, 0, 0.5), "
+                "(2, 1, 0, 2, 0), (4, 4, 0, 0, 0);",
+                nullptr,
+                nullptr,
+                nullptr)
+            == SQLITE_OK);
+    auto hierarchy = std::make_unique<nebula::transformHierarchy>(db,
+        sets["hierarchy"].get(),
+        "location",
+        nebula::trig::precision::precise);
+    auto near = [&](const char *sql, double value) {
+      return std::abs(_queryReal(db, sql) - value) < 1e-9;
+    };
+    REQUIRE(hierarchy->update() == 2);
+    WHEN("the hierarchy is first updated")
+    {
+      THEN("children are placed relative to their parents, breadth first")
+      {
+        REQUIRE(near("SELECT x FROM location WHERE entity = 2", 8.0));
+        REQUIRE(near("SELECT y FROM location WHERE entity = 2", 0.0));
+        REQUIRE(near("SELECT x FROM location WHERE entity = 3", 8.0));
+        REQUIRE(near("SELECT y FROM location WHERE entity = 3", 1.0));
+        REQUIRE(near("SELECT theta FROM location WHERE entity = 3",
+            1.5707963267948966 + 0.5));
+      }
+      THEN("an entity attached to itself is left alone")
+      {
+        REQUIRE(near("SELECT x FROM location WHERE entity = 4", 7.0));
+      }
+    }
+    WHEN("nothing has changed")
+    {
+      THEN("nothing is written")
+      {
+        REQUIRE(hierarchy->update() == 0);
+      }
+    }
+    WHEN("something else writes the world transform of the turret")
+    {
+      sqlite3_exec(db,
+          "UPDATE location SET x = 0 WHERE entity = 2;",
+          nullptr,
+          nullptr,
+          nullptr);
+      THEN("the turret and the gun it carries are placed again")
+      {
+        REQUIRE(hierarchy->update() == 2);
+        REQUIRE(near("SELECT x FROM location WHERE entity = 2", 8.0));
+        REQUIRE(near("SELECT x FROM location WHERE entity = 3", 8.0));
+      }
+    }
+    WHEN("only the gun turns")
+    {
+      sqlite3_exec(db,
+          "UPDATE hierarchy SET theta = 1.0 WHERE entity = 3;",
+          nullptr,
+          nullptr,
+          nullptr);
+      THEN("only the gun is written")
+      {
+        REQUIRE(hierarchy->update() == 1);
+        REQUIRE(near("SELECT theta FROM location WHERE entity = 3",
+            1.5707963267948966 + 1.0));
+      }
+    }
+    WHEN("the ship moves")
+    {
+      sqlite3_exec(db,
+          "UPDATE location SET y = 5, theta = 0 WHERE entity = 1;",
+          nullptr,
+          nullptr,
+          nullptr);
+      THEN("its whole subtree follows")
+      {
+        REQUIRE(hierarchy->update() == 2);
+        REQUIRE(near("SELECT x FROM location WHERE entity = 3", 11.0));
+        REQUIRE(near("SELECT y FROM location WHERE entity = 3", 7.0));
+        REQUIRE(near("SELECT theta FROM location WHERE entity = 3", 0.5));
+      }
+    }
+    hierarchy.reset();
+    sqlite3_close(db);
+  }
+}
+#endif
+
+namespace nebula {
+
+transformHierarchy::transformHierarchy(sqlite3 *db,
+    const sparseSet *nodes,
+    const std::string &world,
+    trig::precision math)
+    : _db(db), _nodes(nodes), _math(math), _version(0), _built(false),
+      _read(nullptr), _write(nullptr)
+{
+  const auto &schema = nodes->schema();
+  auto column        = [&](const std::string &name) {
+    for (size_t c = 0; c < schema.size(); ++c) {
+      if (schema[c].first == name) {
+        return c;
+      }
+    }
+    throw nebulaException("Hierarchy component has no column " + name);
+  };
+  _parentCol    = column("parent");
+  _localCols[0] = column("x");
+  _localCols[1] = column("y");
+  _localCols[2] = column("theta");
+  // Both go through the bulk_array function, the read with one statement
+  // per update and the write with one per depth. The read returns the
+  // array's row, the entity's position in breadth-first order.
+  std::string read = "SELECT bulk.rowid, w.x, w.y, w.theta FROM "
+                     "bulk_array(?1) AS bulk JOIN "
+                   + world + " AS w ON w.entity = bulk.entity;";
+  std::string write = "UPDATE " + world
+                    + " SET x = bulk.c0, y = bulk.c1, theta = bulk.c2 FROM "
+                      "bulk_array(?1) AS bulk WHERE "
+                    + world + ".entity = bulk.entity;";
+  if (sqlite3_prepare_v2(_db, read.c_str(), -1, &_read, nullptr) != SQLITE_OK
+      || sqlite3_prepare_v2(_db, write.c_str(), -1, &_write, nullptr)
+             != SQLITE_OK)
+  {
+    sqlite3_finalize(_read);
+    throw sqliteException(_db);
+  }
+}
+
+transformHierarchy::~transformHierarchy()
+{
+  sqlite3_finalize(_read);
+  sqlite3_finalize(_write);
+}
+
+static double _number(const sparseSet::value &value)
+{
+  if (auto integer = std::get_if<sqlite3_int64>(&value)) {
+    return static_cast<double>(*integer);
+  }
+  if (auto real = std::get_if<double>(&value)) {
+    return *real;
+  }
+  return 0.0;
+}
+
+// Runs whenever the hierarchy component was written. World transforms
+// carry over for entities whose parent and local transform are unchanged,
+// and the rest are marked dirty.
+void transformHierarchy::rebuild()
+{
+  std::unordered_map<sqlite3_int64, size_t> previous;
+  for (size_t i = 0; i < _entities.size(); ++i) {
+    previous[_entities[i]] = i;
+  }
+  const auto &attached = _nodes->entities();
+  std::unordered_map<sqlite3_int64, std::vector<size_t>> children;
+  std::vector<sqlite3_int64> anchors;
+  for (size_t row = 0; row < attached.size(); ++row) {
+    auto parent = std::get_if<sqlite3_int64>(&_nodes->get(row, _parentCol));
+    if (!parent) {
+      continue;
+    }
+    auto &siblings = children[*parent];
+    if (siblings.empty() && _nodes->find(*parent) == sparseSet::npos) {
+      anchors.push_back(*parent);
+    }
+    siblings.push_back(row);
+  }
+  std::sort(anchors.begin(), anchors.end());
+
+  std::vector<sqlite3_int64> entities(anchors);
+  std::vector<size_t> parents(anchors.size(), none);
+  std::vector<double> lx(anchors.size()), ly(anchors.size()),
+      ltheta(anchors.size());
+  _levels = {0};
+  for (size_t start = 0; start < entities.size();) {
+    size_t end = entities.size();
+    _levels.push_back(end);
+    for (size_t i = start; i < end; ++i) {
+      auto found = children.find(entities[i]);
+      if (found == children.end()) {
+        continue;
+      }
+      for (size_t row : found->second) {
+        entities.push_back(attached[row]);
+        parents.push_back(i);
+        lx.push_back(_number(_nodes->get(row, _localCols[0])));
+        ly.push_back(_number(_nodes->get(row, _localCols[1])));
+        ltheta.push_back(_number(_nodes->get(row, _localCols[2])));
+      }
+    }
+    start = end;
+  }
+
+  size_t count = entities.size();
+  std::vector<double> wx(count), wy(count), wtheta(count);
+  std::vector<uint8_t> known(count, 0), dirty(count, 1);
+  for (size_t i = 0; i < count; ++i) {
+    auto found = previous.find(entities[i]);
+    if (found == previous.end() || !_known[found->second]) {
+      continue;
+    }
+    size_t j = found->second;
+    wx[i]     = _wx[j];
+    wy[i]     = _wy[j];
+    wtheta[i] = _wtheta[j];
+    known[i]  = 1;
+    if (parents[i] == none) {
+      // Anchors are compared with the world component instead
+      dirty[i] = 0;
+    } else if (_parents[j] != none
+               && _entities[_parents[j]] == entities[parents[i]]
+               && _lx[j] == lx[i] && _ly[j] == ly[i]
+               && _ltheta[j] == ltheta[i])
+    {
+      dirty[i] = 0;
+    }
+  }
+  _entities.swap(entities);
+  _parents.swap(parents);
+  _lx.swap(lx);
+  _ly.swap(ly);
+  _ltheta.swap(ltheta);
+  _wx.swap(wx);
+  _wy.swap(wy);
+  _wtheta.swap(wtheta);
+  _known.swap(known);
+  _dirty.swap(dirty);
+  _version = _nodes->version();
+  _built   = true;
+}
+
+// Anchors are read to place their subtrees. Attached entities are read as
+// well, since a system or statement may have written their world transform
+// since the last update, and those are computed again.
+void transformHierarchy::readWorld()
+{
+  std::vector<uint8_t> found(_entities.size(), 0);
+  bulkArray array(_entities.data(), _entities.size());
+  array.bind(_read, 1);
+  int res;
+  while ((res = sqlite3_step(_read)) == SQLITE_ROW) {
+    auto i       = static_cast<size_t>(sqlite3_column_int64(_read, 0));
+    double x     = sqlite3_column_double(_read, 1);
+    double y     = sqlite3_column_double(_read, 2);
+    double theta = sqlite3_column_double(_read, 3);
+    found[i]     = 1;
+    if (!_known[i] || x != _wx[i] || y != _wy[i] || theta != _wtheta[i]) {
+      _wx[i]     = x;
+      _wy[i]     = y;
+      _wtheta[i] = theta;
+      _known[i]  = 1;
+      _dirty[i]  = 1;
+    }
+  }
+  sqlite3_reset(_read);
+  sqlite3_clear_bindings(_read);
+  if (res != SQLITE_DONE) {
+    throw sqliteException(_db);
+  }
+  for (size_t i = 0; i < found.size(); ++i) {
+    if (!found[i]) {
+      _known[i] = 0;
+    }
+  }
+}
+
+// The parent's rotation and translation are applied to every child of the
+// batch at once. The operands are gathered into separate arrays first, so
+// that each step is a plain loop the compiler can vectorize.
+void transformHierarchy::computeBatch()
+{
+  size_t n = _batch.size();
+  for (auto array : {&_cos, &_sin, &_px, &_py, &_pt, &_bx, &_by, &_bt}) {
+    array->resize(n);
+  }
+  for (size_t k = 0; k < n; ++k) {
+    size_t i = _batch[k];
+    size_t p = _parents[i];
+    _px[k]   = _wx[p];
+    _py[k]   = _wy[p];
+    _pt[k]   = _wtheta[p];
+    _bx[k]   = _lx[i];
+    _by[k]   = _ly[i];
+    _bt[k]   = _ltheta[i];
+  }
+  std::copy(_pt.begin(), _pt.end(), _cos.begin());
+  std::copy(_pt.begin(), _pt.end(), _sin.begin());
+  trig::cos(_cos.data(), n, _math);
+  trig::sin(_sin.data(), n, _math);
+  double *__restrict x        = _bx.data();
+  double *__restrict y        = _by.data();
+  double *__restrict t        = _bt.data();
+  const double *__restrict c  = _cos.data();
+  const double *__restrict s  = _sin.data();
+  const double *__restrict px = _px.data();
+  const double *__restrict py = _py.data();
+  const double *__restrict pt = _pt.data();
+  for (size_t k = 0; k < n; ++k) {
+    double lx = x[k];
+    double ly = y[k];
+    x[k]      = px[k] + (c[k] * lx - s[k] * ly);
+    y[k]      = py[k] + (s[k] * lx + c[k] * ly);
+    t[k]      = pt[k] + t[k];
+  }
+}
+
+void transformHierarchy::writeBatch()
+{
+  size_t n = _batch.size();
+  _batchEntities.resize(n);
+  for (size_t k = 0; k < n; ++k) {
+    size_t i          = _batch[k];
+    _batchEntities[k] = _entities[i];
+    _wx[i]            = _bx[k];
+    _wy[i]            = _by[k];
+    _wtheta[i]        = _bt[k];
+    _known[i]         = 1;
+  }
+  bulkArray array(_batchEntities.data(), n);
+  array.addColumn(_bx.data());
+  array.addColumn(_by.data());
+  array.addColumn(_bt.data());
+  array.bind(_write, 1);
+  int res = sqlite3_step(_write);
+  sqlite3_reset(_write);
+  sqlite3_clear_bindings(_write);
+  if (res != SQLITE_DONE) {
+    throw sqliteException(_db);
+  }
+}
+
+size_t transformHierarchy::update()
+{
+  if (!_built || _nodes->version() != _version) {
+    rebuild();
+  }
+  readWorld();
+  size_t written = 0;
+  for (size_t level = 1; level + 1 < _levels.size(); ++level) {
+    _batch.clear();
+    for (size_t i = _levels[level]; i < _levels[level + 1]; ++i) {
+      size_t p = _parents[i];
+      if (!_known[p]) {
+        continue;
+      }
+      _dirty[i] = _dirty[i] || _dirty[p];
+      if (_dirty[i]) {
+        _batch.push_back(i);
+      }
+    }
+    if (_batch.empty()) {
+      continue;
+    }
+    computeBatch();
+    writeBatch();
+    written += _batch.size();
+  }
+  std::fill(_dirty.begin(), _dirty.end(), 0);
+  return written;
+}
+
+void transformHierarchy::invalidate()
+{
+  std::fill(_known.begin(), _known.end(), 0);
+  std::fill(_dirty.begin(), _dirty.end(), 1);
+}
+
+} // namespace nebula
@@ -0,0 +1,76 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_TRANSFORM_HIERARCHY_H
+#define NEBULA_TRANSFORM_HIERARCHY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "sparse_set.h"
+#include "trig.h"
+
+extern "C" {
+#include "sqlite3.h"
+}
+
+namespace nebula {
+
+// World transforms of entities attached to a parent through the hierarchy
+// component, which holds the parent and the x, y and theta of the entity
+// relative to it. Entities are ordered breadth first from the anchors,
+// parents that are not attached themselves, so each depth is computed as
+// one batch from the depth above. Only subtrees under a changed local
+// transform, or under an entity whose world transform was written by
+// anything else, are computed and written to the world component. Entities
+// caught in a cycle are never reached and keep their transforms.
+class transformHierarchy {
+  static constexpr size_t none = static_cast<size_t>(-1);
+
+  sqlite3 *_db;
+  const sparseSet *_nodes;
+  trig::precision _math;
+  size_t _parentCol;
+  size_t _localCols[3];
+  uint64_t _version;
+  bool _built;
+  sqlite3_stmt *_read;
+  sqlite3_stmt *_write;
+  // Breadth-first order, anchors first; depth d starts at _levels[d]
+  std::vector<sqlite3_int64> _entities;
+  std::vector<size_t> _levels;
+  std::vector<size_t> _parents;
+  std::vector<double> _lx, _ly, _ltheta;
+  std::vector<double> _wx, _wy, _wtheta;
+  // Whether the world transform is known, and whether it changed this pass
+  std::vector<uint8_t> _known;
+  std::vector<uint8_t> _dirty;
+  // Gathered operands of the batch for one depth
+  std::vector<size_t> _batch;
+  std::vector<sqlite3_int64> _batchEntities;
+  std::vector<double> _cos, _sin, _px, _py, _pt, _bx, _by, _bt;
+
+  void rebuild();
+  void readWorld();
+  void computeBatch();
+  void writeBatch();
+
+public:
+  transformHierarchy(sqlite3 *db,
+      const sparseSet *nodes,
+      const std::string &world,
+      trig::precision math);
+  transformHierarchy(const transformHierarchy &other) = delete;
+  ~transformHierarchy();
+
+  // Recomputes what changed since the last update and returns the number
+  // of entities written.
+  size_t update();
+  // Forgets every world transform, so the next update() writes them all;
+  // for when a rollback undid writes of an earlier update().
+  void invalidate();
+};
+
+} // namespace nebula
+
+#endif // NEBULA_TRANSFORM_HIERARCHY_H
@@ -0,0 +1,339 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#include "trig.h"
+
+// Exception includes
+#include "exceptions.h"
+
+#include <cmath>
+
+// Unit Testing includes
+#include "doctest.h"
+
+// Logging system includes
+#include "loguru.hpp"
+
+#ifndef DOCTEST_CONFIG_DISABLE
+SCENARIO("class trig")
+{
+  using nebula::trig;
+  GIVEN("angles spread over several turns")
+  {
+    std::vector<double> angles;
+    for (int i = -2000; i <= 2000; ++i) {
+      angles.push_back(i * 0.0123);
+    }
+    WHEN("sine and cosine are evaluated at each precision")
+    {
+      double fastError          = 0.0;
+      double deterministicError = 0.0;
+      for (double x : angles) {
+        fastError = std::max(fastError,
+            std::abs(trig::sin(x, trig::precision::fast) - std::sin(x)));
+        fastError = std::max(fastError,
+            std::abs(trig::cos(x, trig::precision::fast) - std::cos(x)));
+        deterministicError = std::max(deterministicError,
+            std::abs(
+                trig::sin(x, trig::precision::deterministic) - std::sin(x)));
+        deterministicError = std::max(deterministicError,
+            std::abs(
+                trig::cos(x, trig::precision::deterministic) - std::cos(x)));
+      }
+      THEN("each stays within its error bound")
+      {
+        REQUIRE(fastError < 1e-6);
+        REQUIRE(deterministicError < 1e-15);
+        REQUIRE(trig::sin(0.0, trig::precision::fast) == 0.0);
+        REQUIRE(trig::cos(0.0, trig::precision::deterministic) == 1.0);
+        REQUIRE(std::isnan(trig::sin(INFINITY, trig::precision::fast)));
+      }
+    }
+    WHEN("a batch is evaluated in place")
+    {
+      std::vector<double> values = angles;
+      trig::cos(values.data(), values.size(), trig::precision::deterministic);
+      THEN("it matches the scalar results bit for bit")
+      {
+        for (size_t i = 0; i < angles.size(); ++i) {
+          REQUIRE(values[i]
+                  == trig::cos(angles[i], trig::precision::deterministic));
+        }
+      }
+    }
+  }
+  GIVEN("angles far beyond a few turns")
+  {
+    // Correctly rounded references
+    const double sin1e9  = 0.5458434494486996;
+    const double sin1e22 = -0.8522008497671888;
+    const double cos1e22 = 0.523214785395139;
+    THEN("the deterministic variants stay within an ulp or two")
+    {
+      auto ulps = [](double value, double reference) {
+        return std::abs(value - reference)
+             / (std::nextafter(std::abs(reference), INFINITY)
+                 - std::abs(reference));
+      };
+      REQUIRE(ulps(trig::sin(1e9, trig::precision::deterministic), sin1e9)
+              <= 2.0);
+      REQUIRE(ulps(trig::sin(1e22, trig::precision::deterministic), sin1e22)
+              <= 2.0);
+      REQUIRE(ulps(trig::cos(1e22, trig::precision::deterministic), cos1e22)
+              <= 2.0);
+      REQUIRE(ulps(trig::sin(-1e22, trig::precision::deterministic),
+                  -sin1e22)
+              <= 2.0);
+      REQUIRE(std::abs(trig::sin(1e300, trig::precision::deterministic)
+                       - std::sin(1e300))
+              < 1e-15);
+      REQUIRE(std::abs(trig::cos(1e5, trig::precision::fast) - std::cos(1e5))
+              < 1e-6);
+    }
+  }
+  GIVEN("precision names from a module manifest")
+  {
+    THEN("known names are parsed and unknown names rejected")
+    {
+      REQUIRE(trig::parsePrecision("fast") == trig::precision::fast);
+      REQUIRE(trig::parsePrecision("precise") == trig::precision::precise);
+      REQUIRE_THROWS(trig::parsePrecision("exact"));
+    }
+  }
+}
+#endif
+
+namespace nebula {
+
+namespace {
+
+// Cody-Waite splits of pi/2 from fdlibm. The leading parts have 33 bits, so
+// their products with the quadrant count are exact below reduceLimit.
+constexpr double pio2_1      = 1.57079632673412561417e+00;
+constexpr double pio2_1t     = 6.07710050650619224932e-11;
+constexpr double pio2_2      = 6.07710050630396597660e-11;
+constexpr double pio2_2t     = 2.02226624879595063154e-21;
+constexpr double twoOverPi   = 6.36619772367581382433e-01;
+constexpr double pio2Hi      = 1.57079632679489655800e+00;
+constexpr double pio2Lo      = 6.12323399573676603587e-17;
+constexpr double reduceLimit = 1e5;
+
+// The first 1280 bits of 2/pi, enough to reduce any finite double.
+constexpr uint64_t twoOverPiBits[] = {0xA2F9836E4E441529,
+    0xFC2757D1F534DDC0,
+    0xDB6295993C439041,
+    0xFE5163ABDEBBC561,
+    0xB7246E3A424DD2E0,
+    0x06492EEA09D1921C,
+    0xFE1DEB1CB129A73E,
+    0xE88235F52EBB4484,
+    0xE99C7026B45F7E41,
+    0x3991D639835339F4,
+    0x9C845F8BBDF9283B,
+    0x1FF897FFDE05980F,
+    0xEF2F118B5A0A6D1F,
+    0x6D367ECF27CB09B7,
+    0x4F463F669E5FEA2D,
+    0x7527BAC7EBE5F17B,
+    0x3D0739F78A5292EA,
+    0x6BFB5FB11F8D5D08,
+    0x56033046FC7B6BAB,
+    0xF0CFBC209AF4361D};
+
+// fdlibm __kernel_sin and __kernel_cos coefficients, for |r| <= pi/4.
+constexpr double S1 = -1.66666666666666324348e-01;
+constexpr double S2 = 8.33333333332248946124e-03;
+constexpr double S3 = -1.98412698298579493134e-04;
+constexpr double S4 = 2.75573137070700676789e-06;
+constexpr double S5 = -2.50507602534068634195e-08;
+constexpr double S6 = 1.58969099521155010221e-10;
+constexpr double C1 = 4.16666666666666019037e-02;
+constexpr double C2 = -1.38888888888741095749e-03;
+constexpr double C3 = 2.48015872894767294178e-05;
+constexpr double C4 = -2.75573143513906633035e-07;
+constexpr double C5 = 2.08757232129817482790e-09;
+constexpr double C6 = -1.13596475577881948265e-11;
+
+// Taylor coefficients for the fast variants.
+constexpr double F1 = -1.0 / 6.0;
+constexpr double F2 = 1.0 / 120.0;
+constexpr double F3 = -1.0 / 5040.0;
+constexpr double G1 = -0.5;
+constexpr double G2 = 1.0 / 24.0;
+constexpr double G3 = -1.0 / 720.0;
+constexpr double G4 = 1.0 / 40320.0;
+
+// Bits first to first + 63 of 2/pi, counting from 1 after the binary point
+inline uint64_t twoOverPiWord(int first)
+{
+  constexpr int words = sizeof(twoOverPiBits) / sizeof(twoOverPiBits[0]);
+  auto word = [](int i) {
+    return i < 0 || i >= words ? uint64_t(0) : twoOverPiBits[i];
+  };
+  int offset = first - 1;
+  int index  = offset >= 0 ? offset / 64 : (offset - 63) / 64;
+  int shift  = offset - index * 64;
+  if (shift == 0) {
+    return word(index);
+  }
+  return word(index) << shift | word(index + 1) >> (64 - shift);
+}
+
+// Payne-Hanek reduction of a finite |x| >= reduceLimit to r + quadrant *
+// pi/2 with |r| <= pi/4. x is an integer m times 2^e, so only the bits of
+// 2/pi from 2^(1-e) down change m * 2^e * 2/pi modulo 4; 192 of them leave
+// 126 bits of fraction, far more than the closest any double comes to a
+// multiple of pi/2 cancels.
+inline double reduce(double x, int &quadrant)
+{
+  int e;
+  double mantissa = std::frexp(std::fabs(x), &e);
+  uint64_t m      = static_cast<uint64_t>(std::ldexp(mantissa, 53));
+  e -= 53;
+  // The window starts at bit e - 1, so the product's binary point falls at
+  // bit 190 and bits 190-191 hold the quadrant.
+  int first = e - 1;
+  using wide = unsigned __int128;
+  // Only the low 64 bits of the leading product matter modulo 4
+  wide low      = wide(m) * twoOverPiWord(first + 128);
+  wide mid      = wide(m) * twoOverPiWord(first + 64) + (low >> 64);
+  uint64_t high = m * twoOverPiWord(first) + static_cast<uint64_t>(mid >> 64);
+
+  quadrant      = static_cast<int>(high >> 62);
+  wide fraction = wide(high & (~uint64_t(0) >> 2)) << 64 | uint64_t(mid);
+  // Round to the nearest quadrant, leaving a signed fraction of pi/2
+  __int128 signedFraction = fraction;
+  if (fraction >> 125) {
+    signedFraction -= __int128(1) << 126;
+    quadrant = (quadrant + 1) & 3;
+  }
+  double hi = static_cast<double>(signedFraction);
+  double lo = static_cast<double>(signedFraction - __int128(hi));
+  hi        = std::ldexp(hi, -126);
+  lo        = std::ldexp(lo, -126);
+  double r  = hi * pio2Hi + (lo * pio2Hi + hi * pio2Lo);
+  if (x < 0.0) {
+    quadrant = -quadrant;
+    r        = -r;
+  }
+  return r;
+}
+
+// sin(x + shift * pi/2). Both sine and cosine of the reduced argument are
+// computed and the quadrant selects between them without branching, which
+// keeps the batch loops friendly to vectorization.
+template <trig::precision P>
+inline double evaluate(double x, int shift)
+{
+  double k = 0.0;
+  int q    = shift;
+  if (std::fabs(x) < reduceLimit) {
+    k = std::floor(x * twoOverPi + 0.5);
+    q += static_cast<int>(k);
+  } else if (std::isfinite(x)) {
+    int quadrant;
+    x = reduce(x, quadrant);
+    q += quadrant;
+  } else {
+    return x - x;
+  }
+  q &= 3;
+  double r, s, c;
+  if constexpr (P == trig::precision::fast) {
+    r        = (x - k * pio2_1) - k * pio2_1t;
+    double z = r * r;
+    s        = r + r * z * (F1 + z * (F2 + z * F3));
+    c        = 1.0 + z * (G1 + z * (G2 + z * (G3 + z * G4)));
+  } else {
+    r        = ((x - k * pio2_1) - k * pio2_2) - k * pio2_2t;
+    double z = r * r;
+    double t = S3 + z * (S4 + z * (S5 + z * S6));
+    s        = r + r * z * (S1 + z * (S2 + z * t));
+    t        = C3 + z * (C4 + z * (C5 + z * C6));
+    c        = 1.0 - (0.5 * z - z * z * (C1 + z * (C2 + z * t)));
+  }
+  double v = (q & 1) ? c : s;
+  return (q & 2) ? -v : v;
+}
+
+template <trig::precision P>
+void evaluate(double *values, size_t count, int shift)
+{
+  for (size_t i = 0; i < count; ++i) {
+    values[i] = evaluate<P>(values[i], shift);
+  }
+}
+
+} // namespace
+
+trig::precision trig::parsePrecision(const std::string &name)
+{
+  if (name == "fast") {
+    return precision::fast;
+  }
+  if (name == "deterministic") {
+    return precision::deterministic;
+  }
+  if (name == "precise") {
+    return precision::precise;
+  }
+  throw nebulaException("Unknown math precision: " + name);
+}
+
+double trig::sin(double x, precision p)
+{
+  switch (p) {
+  case precision::fast:
+    return evaluate<precision::fast>(x, 0);
+  case precision::deterministic:
+    return evaluate<precision::deterministic>(x, 0);
+  default:
+    return std::sin(x);
+  }
+}
+
+double trig::cos(double x, precision p)
+{
+  switch (p) {
+  case precision::fast:
+    return evaluate<precision::fast>(x, 1);
+  case precision::deterministic:
+    return evaluate<precision::deterministic>(x, 1);
+  default:
+    return std::cos(x);
+  }
+}
+
+void trig::sin(double *values, size_t count, precision p)
+{
+  switch (p) {
+  case precision::fast:
+    evaluate<precision::fast>(values, count, 0);
+    break;
+  case precision::deterministic:
+    evaluate<precision::deterministic>(values, count, 0);
+    break;
+  default:
+    for (size_t i = 0; i < count; ++i) {
+      values[i] = std::sin(values[i]);
+    }
+  }
+}
+
+void trig::cos(double *values, size_t count, precision p)
+{
+  switch (p) {
+  case precision::fast:
+    evaluate<precision::fast>(values, count, 1);
+    break;
+  case precision::deterministic:
+    evaluate<precision::deterministic>(values, count, 1);
+    break;
+  default:
+    for (size_t i = 0; i < count; ++i) {
+      values[i] = std::cos(values[i]);
+    }
+  }
+}
+
+} // namespace nebula
@@ -0,0 +1,42 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+#ifndef NEBULA_TRIG_H
+#define NEBULA_TRIG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace nebula {
+
+// Sine and cosine at a precision chosen per module:
+//   fast          - short polynomials, under 1e-6 absolute error
+//   deterministic - fdlibm-grade polynomials, within an ulp or two
+//   precise       - the platform libm
+// fast and deterministic use only IEEE adds and multiplies in a fixed order,
+// so they give bit-identical results on every platform as long as the
+// compiler does not contract them into fused multiply-adds. Both reduce
+// arguments of any magnitude against enough bits of pi to keep their
+// error bound, so large angles are no less accurate than small ones.
+class trig {
+public:
+  enum class precision : uint8_t {
+    fast,
+    deterministic,
+    precise
+  };
+
+  static precision parsePrecision(const std::string &name);
+
+  static double sin(double x, precision p);
+  static double cos(double x, precision p);
+
+  // In-place batch forms, used by native kernels.
+  static void sin(double *values, size_t count, precision p);
+  static void cos(double *values, size_t count, precision p);
+};
+
+} // namespace nebula
+
+#endif // NEBULA_TRIG_H
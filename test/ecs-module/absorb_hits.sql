@@ -0,0 +1,4 @@
+-- Shields absorb the damage of this tick's hits on their entity
+UPDATE shield SET strength = strength - (
+  SELECT total(damage) FROM hit() WHERE hit.entity = shield.entity
+);
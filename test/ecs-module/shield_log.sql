@@ -0,0 +1,18 @@
+-- Keeps a history of the total shield strength, one row per tick
+
+CREATE TABLE IF NOT EXISTS shield_log
+(
+  tick INTEGER PRIMARY KEY,
+  total REAL
+);
+
+BEGIN TRANSACTION;
+  INSERT INTO shield_log (total)
+    SELECT total(strength) FROM shield WHERE strength < $field_width;
+  SELECT tick FROM shield_log;
+COMMIT TRANSACTION;
+
+-- Rolled back, so only the block above leaves a row
+BEGIN TRANSACTION;
+  INSERT INTO shield_log (total) VALUES (-1.0);
+ROLLBACK TRANSACTION;
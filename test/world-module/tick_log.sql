@@ -0,0 +1,9 @@
+-- Keeps the sim time of every tick, one row per tick
+
+CREATE TABLE IF NOT EXISTS tick_log
+(
+  tick INTEGER PRIMARY KEY,
+  time REAL
+);
+
+INSERT INTO tick_log (time) VALUES (sim_time());
@@ -0,0 +1,23 @@
+// This document is licensed according to the LGPL v2.1 license
+// Consult the LICENSE file in the root project directory for details
+
+// Build-time generator for the typed component structs used by
+// ecs::query<>(). Usage: componentgen <module path> <output header>
+
+#include <fstream>
+#include <iostream>
+#include "module.h"
+
+int main(int argc, char **argv)
+{
+  if (argc != 3) {
+    std::cerr << "usage: componentgen <module path> <output header>"
+              << std::endl;
+    return 1;
+  }
+  nebula::module mod(argv[1], true);
+  mod.loadModule();
+  std::ofstream header(argv[2]);
+  header << mod.componentHeader();
+  return header ? 0 : 1;
+}